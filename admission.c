@@ -0,0 +1,317 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "admission.h"
+#include "utils.h"
+
+static const char *const pressure_files[] = {
+	"/proc/pressure/cpu",
+	"/proc/pressure/memory",
+	"/proc/pressure/io",
+};
+
+static const char *const reasons[] = {
+	"cpu pressure",
+	"memory pressure",
+	"io pressure",
+	"available memory",
+	"cpu weight",
+	"exclusive",
+	"lock",
+};
+
+static double
+elapsed(const struct timespec *since)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double) (now.tv_sec - since->tv_sec) +
+	    (double) (now.tv_nsec - since->tv_nsec) / 1e9;
+}
+
+/* Reads a small proc file kept open, -1 on errors. */
+static ssize_t
+read_proc(int fd, char *buf, size_t size)
+{
+	ssize_t n;
+
+	n = pread(fd, buf, size - 1, 0);
+	if (n < 0)
+		return -1;
+	buf[n] = '\0';
+
+	return n;
+}
+
+/* The "some" avg10 of a pressure file, -1 when it can't be read. */
+static double
+read_pressure(int fd)
+{
+	char buf[256];
+	char *c;
+
+	if (read_proc(fd, buf, sizeof(buf)) == -1)
+		return -1;
+
+	c = strstr(buf, "some avg10=");
+	if (c == NULL)
+		return -1;
+
+	return strtod(c + strlen("some avg10="), NULL);
+}
+
+static long
+read_available(int fd)
+{
+	char buf[4096];
+	char *c;
+
+	if (read_proc(fd, buf, sizeof(buf)) == -1)
+		return -1;
+
+	c = strstr(buf, "MemAvailable:");
+	if (c == NULL)
+		return -1;
+
+	return strtol(c + strlen("MemAvailable:"), NULL, 10);
+}
+
+void
+admission_init(struct admission *a, const unsigned int *max_pressure,
+		long min_available, int cpus)
+{
+	int i;
+
+	memset(a, 0, sizeof(struct admission));
+	a->held = ADMISSION_OK;
+	a->cpus = cpus;
+	a->min_available = min_available;
+	a->meminfo_fd = -1;
+	a->available = -1;
+
+	for (i = 0; i < 3; i++) {
+		a->max_pressure[i] = max_pressure[i];
+		a->pressure_fds[i] = -1;
+		a->pressure[i] = -1;
+		/* Kernels without PSI just don't hold for pressure. */
+		if (max_pressure[i] > 0)
+			a->pressure_fds[i] = open(pressure_files[i], O_RDONLY | O_CLOEXEC);
+	}
+
+	if (min_available > 0)
+		a->meminfo_fd = open("/proc/meminfo", O_RDONLY | O_CLOEXEC);
+}
+
+void
+admission_free(struct admission *a)
+{
+	int i;
+
+	for (i = 0; i < 3; i++)
+		if (a->pressure_fds[i] != -1)
+			close(a->pressure_fds[i]);
+	if (a->meminfo_fd != -1)
+		close(a->meminfo_fd);
+	free(a->locks);
+}
+
+static int
+cpu_weight(struct admission *a, const struct ptest_conf *conf)
+{
+	return conf->cpu > a->cpus ? a->cpus : conf->cpu;
+}
+
+static int
+lock_held(struct admission *a, const char *lock)
+{
+	int i;
+
+	for (i = 0; i < a->locks_no; i++)
+		if (strcmp(a->locks[i], lock) == 0)
+			return 1;
+
+	return 0;
+}
+
+/* *
+ * Reads the pressure and MemAvailable for a pass over the ptests that
+ * could start, they don't change much between two candidates. The
+ * caller gives the KiB of their declared memory the running ptests
+ * already use: that part is out of MemAvailable already and only the
+ * rest is still reserved.
+ * */
+void
+admission_sample(struct admission *a, long memory_used)
+{
+	int i;
+
+	for (i = 0; i < 3; i++)
+		a->pressure[i] = a->pressure_fds[i] != -1 ?
+		    read_pressure(a->pressure_fds[i]) : -1;
+
+	a->available = a->meminfo_fd != -1 ? read_available(a->meminfo_fd) : -1;
+	a->memory_used = memory_used;
+}
+
+/* *
+ * Whether a ptest with conf can start now, from the last sample. The
+ * caller always starts one when nothing runs.
+ * */
+enum admission_reason
+admission_check(struct admission *a, const struct ptest_conf *conf)
+{
+	int i;
+
+	if (a->exclusive > 0 || conf->exclusive)
+		return ADMISSION_EXCLUSIVE;
+
+	for (i = 0; i < conf->locks_no; i++)
+		if (lock_held(a, conf->locks[i]))
+			return ADMISSION_LOCK;
+
+	if (a->cpu_used + cpu_weight(a, conf) > a->cpus)
+		return ADMISSION_CPU;
+
+	for (i = 0; i < 3; i++) {
+		if (a->pressure[i] != -1 && a->pressure[i] > (double) a->max_pressure[i])
+			return (enum admission_reason) i;
+	}
+
+	if (a->available != -1 &&
+	    a->available - (a->memory_reserved - a->memory_used) - conf->memory <
+	    a->min_available)
+		return ADMISSION_MEMORY;
+
+	return ADMISSION_OK;
+}
+
+/* Whether r holds every ptest, not only the one checked. */
+int
+admission_global(struct admission *a, enum admission_reason r)
+{
+	switch (r) {
+	case ADMISSION_CPU_PRESSURE:
+	case ADMISSION_MEMORY_PRESSURE:
+	case ADMISSION_IO_PRESSURE:
+		return 1;
+	case ADMISSION_EXCLUSIVE:
+		return a->exclusive > 0;
+	default:
+		return 0;
+	}
+}
+
+/* Nothing could start for r, a stall is counted every time starting
+ * goes from allowed to held. */
+void
+admission_hold(struct admission *a, enum admission_reason r)
+{
+	if (r == ADMISSION_OK)
+		return;
+
+	if (a->held == ADMISSION_OK) {
+		a->stalls[r]++;
+		clock_gettime(CLOCK_MONOTONIC, &a->held_since);
+	}
+	a->held = r;
+}
+
+void
+admission_start(struct admission *a, const struct ptest_conf *conf)
+{
+	int i;
+
+	if (a->locks_no + conf->locks_no > a->locks_size) {
+		a->locks_size = (a->locks_no + conf->locks_no) * 2;
+		a->locks = realloc(a->locks, sizeof(char *) * (size_t) a->locks_size);
+		CHECK_ALLOCATION(a->locks, sizeof(char *) * (size_t) a->locks_size, 1);
+	}
+
+	if (a->held != ADMISSION_OK) {
+		a->held_total += elapsed(&a->held_since);
+		a->held = ADMISSION_OK;
+	}
+
+	for (i = 0; i < conf->locks_no; i++)
+		a->locks[a->locks_no++] = conf->locks[i];
+	a->exclusive += conf->exclusive ? 1 : 0;
+	a->cpu_used += cpu_weight(a, conf);
+	a->memory_reserved += conf->memory;
+}
+
+void
+admission_end(struct admission *a, const struct ptest_conf *conf)
+{
+	int i, j;
+
+	/* Locks are compared by address, conf is the one given to start. */
+	for (i = 0; i < conf->locks_no; i++) {
+		for (j = 0; j < a->locks_no; j++) {
+			if (a->locks[j] == conf->locks[i]) {
+				a->locks[j] = a->locks[--a->locks_no];
+				break;
+			}
+		}
+	}
+	a->exclusive -= conf->exclusive ? 1 : 0;
+	a->cpu_used -= cpu_weight(a, conf);
+	a->memory_reserved -= conf->memory;
+}
+
+void
+admission_report(struct admission *a, FILE *fp)
+{
+	unsigned long total = 0;
+	int i;
+
+	if (a->held != ADMISSION_OK) {
+		a->held_total += elapsed(&a->held_since);
+		a->held = ADMISSION_OK;
+	}
+
+	for (i = 0; i < ADMISSION_REASONS; i++)
+		total += a->stalls[i];
+	if (total == 0)
+		return;
+
+	fprintf(fp, "STALLS: %lu", total);
+	for (i = 0; i < ADMISSION_REASONS; i++)
+		if (a->stalls[i] > 0)
+			fprintf(fp, ", %s %lu", reasons[i], a->stalls[i]);
+	fprintf(fp, ", held %.1fs\n", a->held_total);
+}
+
+const char *
+admission_reason_str(enum admission_reason r)
+{
+	return r < ADMISSION_REASONS ? reasons[r] : "none";
+}
@@ -0,0 +1,92 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+
+#ifndef PTEST_RUNNER_ADMISSION_H
+#define PTEST_RUNNER_ADMISSION_H
+
+#include <stdio.h>
+#include <time.h>
+
+#include "conf.h"
+
+enum admission_reason {
+	ADMISSION_CPU_PRESSURE = 0,
+	ADMISSION_MEMORY_PRESSURE,
+	ADMISSION_IO_PRESSURE,
+	ADMISSION_MEMORY,
+	ADMISSION_CPU,
+	ADMISSION_EXCLUSIVE,
+	ADMISSION_LOCK,
+	ADMISSION_REASONS,
+	ADMISSION_OK = ADMISSION_REASONS,
+};
+
+/* *
+ * Decides if another ptest can start next to the running ones, from
+ * the "some" avg10 of /proc/pressure/{cpu,memory,io}, MemAvailable and
+ * what the ptests declare in their ptest-runner.conf: memory, CPUs,
+ * locks and exclusive. Counts how many times and for how long starting
+ * was held.
+ * */
+struct admission {
+	unsigned int max_pressure[3]; /* percent, 0 for no limit */
+	int pressure_fds[3];
+	long min_available; /* KiB, 0 for no limit */
+	int meminfo_fd;
+	int cpus; /* CPUs the running ptests may keep busy */
+
+	int cpu_used;
+	int held; /* reason starting is held or ADMISSION_OK */
+	int exclusive; /* running exclusive ptests */
+	long memory_reserved; /* KiB declared by the running ptests */
+
+	/* Read once by admission_sample() for every candidate of a pass,
+	 * -1 when unknown. */
+	double pressure[3];
+	long available; /* KiB */
+	long memory_used; /* KiB of memory_reserved already in use */
+
+	const char **locks; /* held by the running ptests, may repeat */
+	int locks_no;
+	int locks_size;
+	unsigned long stalls[ADMISSION_REASONS];
+	struct timespec held_since;
+	double held_total; /* seconds */
+};
+
+extern void admission_init(struct admission *, const unsigned int *, long, int);
+extern void admission_free(struct admission *);
+
+extern void admission_sample(struct admission *, long);
+extern enum admission_reason admission_check(struct admission *,
+		const struct ptest_conf *);
+extern int admission_global(struct admission *, enum admission_reason);
+extern void admission_hold(struct admission *, enum admission_reason);
+extern void admission_start(struct admission *, const struct ptest_conf *);
+extern void admission_end(struct admission *, const struct ptest_conf *);
+extern void admission_report(struct admission *, FILE *);
+
+extern const char *admission_reason_str(enum admission_reason);
+
+#endif // PTEST_RUNNER_ADMISSION_H
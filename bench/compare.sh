@@ -0,0 +1,32 @@
+#!/bin/sh
+# Compares two results files of bench/run.sh.
+#
+# Usage: bench/compare.sh old-results new-results
+#
+# Every result is printed with its old and new values and the change in
+# percent, the ones only in one of the files with a - for the other.
+
+if [ $# -ne 2 ]; then
+	echo "Usage: $0 old-results new-results" >&2
+	exit 1
+fi
+
+awk 'NR == FNR {
+	old[$1] = $2
+	next
+}
+{
+	if (!($1 in old))
+		printf("%-28s %14s %14s\n", $1, "-", $2)
+	else if (old[$1] == 0)
+		printf("%-28s %14s %14s\n", $1, old[$1], $2)
+	else
+		printf("%-28s %14s %14s %+8.1f%%\n", $1, old[$1], $2,
+			($2 - old[$1]) * 100 / old[$1])
+	seen[$1] = 1
+}
+END {
+	for (name in old)
+		if (!(name in seen))
+			printf("%-28s %14s %14s\n", name, old[name], "-")
+}' "$1" "$2"
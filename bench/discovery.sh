@@ -0,0 +1,48 @@
+#!/bin/sh
+# Measures how long ptest-runner takes to find the ptests installed.
+#
+# Usage: bench/discovery.sh [ptest-runner] [packages] [roots]
+#
+# A tree with the given number of packages, half of them with a ptest,
+# is split across the given number of -d roots and the time taken by
+# ptest-runner -l is printed in seconds.
+
+RUNNER=${1:-./ptest-runner}
+PACKAGES=${2:-10000}
+ROOTS=${3:-1}
+
+TMPDIR=$(mktemp -d)
+trap 'rm -rf $TMPDIR' EXIT
+
+i=0
+while [ $i -lt $PACKAGES ]; do
+	dir=$TMPDIR/root$((i % ROOTS))/package$i
+	if [ $((i % 2)) -eq 0 ]; then
+		mkdir -p $dir/ptest
+		printf '#!/bin/sh\n' > $dir/ptest/run-ptest
+		chmod +x $dir/ptest/run-ptest
+	else
+		mkdir -p $dir
+	fi
+	i=$((i + 1))
+done
+
+dirs=$TMPDIR/root0
+i=1
+while [ $i -lt $ROOTS ]; do
+	dirs="$dirs $TMPDIR/root$i"
+	i=$((i + 1))
+done
+
+now() {
+	date +%s.%N
+}
+
+# Once to warm up the dentry cache, the second run is the one reported.
+$RUNNER -d "$dirs" -l > /dev/null
+start=$(now)
+$RUNNER -d "$dirs" -l > /dev/null
+end=$(now)
+
+awk -v n=$PACKAGES -v r=$ROOTS -v s=$start -v e=$end \
+	'BEGIN { printf("%d packages %d roots %.3f sec\n", n, r, e - s) }'
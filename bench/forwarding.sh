@@ -0,0 +1,40 @@
+#!/bin/sh
+# Measures how fast ptest-runner forwards the output of a ptest.
+#
+# Usage: bench/forwarding.sh [ptest-runner] [megabytes]
+#
+# A ptest printing the given amount of data is run with the output
+# redirected to a file and to a pipe, the throughput is printed in
+# bytes/sec for each.
+
+RUNNER=${1:-./ptest-runner}
+MB=${2:-1024}
+
+TMPDIR=$(mktemp -d)
+trap 'rm -rf $TMPDIR' EXIT
+
+mkdir -p $TMPDIR/ptests/output/ptest
+cat > $TMPDIR/ptests/output/ptest/run-ptest <<EOT
+#!/bin/sh
+exec head -c ${MB}M /dev/zero
+EOT
+chmod +x $TMPDIR/ptests/output/ptest/run-ptest
+
+now() {
+	date +%s.%N
+}
+
+report() {
+	awk -v name=$1 -v mb=$MB -v s=$2 -v e=$3 \
+		'BEGIN { printf("%s %.0f bytes/sec\n", name, mb * 1048576 / (e - s)) }'
+}
+
+start=$(now)
+$RUNNER -d $TMPDIR/ptests -t 60 > $TMPDIR/out
+end=$(now)
+report file $start $end
+
+start=$(now)
+$RUNNER -d $TMPDIR/ptests -t 60 | cat > /dev/null
+end=$(now)
+report pipe $start $end
@@ -0,0 +1,51 @@
+#!/bin/sh
+# Generates synthetic ptests for the benchmarks.
+#
+# Usage: bench/generate.sh directory kind count [size]
+#
+# Every ptest is directory/<kind><n>/ptest/run-ptest, the kinds are:
+#   tiny     exits right away
+#   output   prints size megabytes (1024 by default)
+#   trickle  prints size lines (250 by default), one every 10ms
+#   tree     a chain of size nested shells (64 by default)
+#   hang     never ends, to be stopped by the runner timeout
+
+DIR=$1
+KIND=$2
+COUNT=${3:-1}
+SIZE=$4
+
+if [ -z "$DIR" ] || [ -z "$KIND" ]; then
+	echo "Usage: $0 directory kind count [size]" >&2
+	exit 1
+fi
+
+case $KIND in
+	tiny)
+		script='#!/bin/sh\n'
+		;;
+	output)
+		script="#!/bin/sh\nexec head -c ${SIZE:-1024}M /dev/zero\n"
+		;;
+	trickle)
+		script="#!/bin/sh\ni=0\nwhile [ \$i -lt ${SIZE:-250} ]; do\n\techo line \$i\n\tsleep 0.01\n\ti=\$((i + 1))\ndone\n"
+		;;
+	tree)
+		script="#!/bin/sh\nn=\${1:-${SIZE:-64}}\nif [ \$n -gt 0 ]; then\n\t\"\$0\" \$((n - 1))\nelse\n\techo depth reached\nfi\n"
+		;;
+	hang)
+		script='#!/bin/sh\necho hanging\nexec sleep 3600\n'
+		;;
+	*)
+		echo "Unknown kind $KIND" >&2
+		exit 1
+		;;
+esac
+
+i=0
+while [ $i -lt $COUNT ]; do
+	mkdir -p $DIR/$KIND$i/ptest
+	printf "$script" > $DIR/$KIND$i/ptest/run-ptest
+	chmod +x $DIR/$KIND$i/ptest/run-ptest
+	i=$((i + 1))
+done
@@ -0,0 +1,85 @@
+#!/bin/sh
+# Runs the benchmark suite, "make bench".
+#
+# Usage: bench/run.sh [ptest-runner] [results-file]
+#
+# Every result is a "name value" line of the results file, two of them
+# taken on different commits are compared with bench/compare.sh. The
+# sizes are BENCH_PACKAGES (10000 packages to discover), BENCH_TINY
+# (10000 tiny ptests), BENCH_MB (1024 megabytes of output), BENCH_TRICKLE
+# (4 ptests trickling output), BENCH_DEPTH (64 nested shells) and
+# BENCH_HANG (4 ptests timing out).
+
+RUNNER=$(realpath ${1:-./ptest-runner})
+RESULTS=${2:-bench-results.txt}
+BENCH=$(dirname $0)
+JOBS=$(nproc)
+
+TMPDIR=$(mktemp -d)
+trap 'rm -rf $TMPDIR' EXIT
+
+: > $RESULTS
+
+now() {
+	date +%s.%N
+}
+
+result() {
+	echo "$1 $2" >> $RESULTS
+	echo "$1 $2"
+}
+
+# A value of the --stats JSON file of the scenario.
+stats_value() {
+	sed -n "s/^\t\"$2\": \([0-9]*\),\{0,1\}$/\1/p" $TMPDIR/$1.json
+}
+
+# Runs the ptests of $TMPDIR/<name> with the given options, the output
+# goes to a file as in a CI log.
+scenario() {
+	name=$1
+	shift
+
+	start=$(now)
+	$RUNNER -d $TMPDIR/$name --stats=$TMPDIR/$name.json "$@" > $TMPDIR/$name.log 2>&1
+	end=$(now)
+	rm -f $TMPDIR/$name.log
+
+	result ${name}_sec $(awk -v s=$start -v e=$end 'BEGIN { printf("%.3f", e - s) }')
+	result ${name}_runner_cpu_ms $((($(stats_value $name user_us) + $(stats_value $name sys_us)) / 1000))
+	result ${name}_maxrss_kib $(stats_value $name maxrss_kib)
+}
+
+# A counter of the stats per second of the run.
+per_second() {
+	awk -v n=$(stats_value $1 $2) -v ns=$(stats_value $1 run_ns) \
+		'BEGIN { printf("%.1f", ns > 0 ? n * 1e9 / ns : 0) }'
+}
+
+result discovery_sec $($BENCH/discovery.sh $RUNNER ${BENCH_PACKAGES:-10000} 1 | awk '{ print $5 }')
+result discovery_4roots_sec $($BENCH/discovery.sh $RUNNER ${BENCH_PACKAGES:-10000} 4 | awk '{ print $5 }')
+
+TINY=${BENCH_TINY:-10000}
+$BENCH/generate.sh $TMPDIR/tiny tiny $TINY
+scenario tiny -j $JOBS
+result tiny_spawn_us $(($(stats_value tiny spawn_ns) / $(stats_value tiny spawns) / 1000))
+result tiny_spawn_max_us $(($(stats_value tiny spawn_max_ns) / 1000))
+result tiny_per_ptest_us $(($(stats_value tiny run_ns) / $TINY / 1000))
+
+$BENCH/generate.sh $TMPDIR/output output 1 ${BENCH_MB:-1024}
+scenario output
+result output_bytes_s $(per_second output bytes_forwarded)
+$BENCH/forwarding.sh $RUNNER ${BENCH_MB:-1024} | while read name bytes unit; do
+	result forwarding_${name}_bytes_s $bytes
+done
+
+$BENCH/generate.sh $TMPDIR/trickle trickle ${BENCH_TRICKLE:-4}
+scenario trickle -j $JOBS
+result trickle_wakeups_s $(per_second trickle wakeups)
+
+$BENCH/generate.sh $TMPDIR/tree tree 1 ${BENCH_DEPTH:-64}
+scenario tree
+
+# The time over the 1s timeout is what stopping the ptests takes.
+$BENCH/generate.sh $TMPDIR/hang hang ${BENCH_HANG:-4}
+scenario hang -j $JOBS -t 1 --grace 1 --collect-timeout 0
@@ -0,0 +1,458 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "utils.h"
+
+/* On disk every root is followed by its path and entries, every entry
+ * by its name. */
+struct cache_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t roots_no;
+};
+
+struct cache_file_root {
+	uint64_t dev;
+	uint64_t ino;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	int64_t scanned;
+	uint32_t path_len;
+	uint32_t entries_no;
+};
+
+struct cache_file_entry {
+	uint64_t dev;
+	uint64_t ino;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint64_t ptest_dev;
+	uint64_t ptest_ino;
+	int64_t ptest_mtime_sec;
+	int64_t ptest_mtime_nsec;
+	uint64_t run_ptest_dev;
+	uint64_t run_ptest_ino;
+	uint32_t name_len;
+	uint32_t flags;
+};
+
+struct cache_root *
+cache_root_alloc(const char *path, const struct stat *st, time_t scanned)
+{
+	struct cache_root *r;
+
+	r = calloc(1, sizeof(struct cache_root));
+	CHECK_ALLOCATION(r, sizeof(struct cache_root), 0);
+	if (r == NULL)
+		return NULL;
+
+	r->path = strdup(path);
+	CHECK_ALLOCATION(r->path, strlen(path), 0);
+	if (r->path == NULL) {
+		free(r);
+		return NULL;
+	}
+
+	if (st != NULL) {
+		r->dev = st->st_dev;
+		r->ino = st->st_ino;
+		r->mtime = st->st_mtim;
+	}
+	r->scanned = scanned;
+
+	return r;
+}
+
+void
+cache_root_free(struct cache_root *r)
+{
+	size_t i;
+
+	if (r == NULL)
+		return;
+
+	for (i = 0; i < r->entries_no; i++)
+		free(r->entries[i].name);
+	free(r->entries);
+	free(r->path);
+	free(r);
+}
+
+struct cache_entry *
+cache_root_add(struct cache_root *r, const char *name)
+{
+	struct cache_entry *e;
+
+	if (r->entries_no == r->size) {
+		size_t size = r->size ? r->size * 2 : 64;
+
+		e = realloc(r->entries, size * sizeof(struct cache_entry));
+		CHECK_ALLOCATION(e, size * sizeof(struct cache_entry), 0);
+		if (e == NULL)
+			return NULL;
+		r->entries = e;
+		r->size = size;
+	}
+
+	e = &r->entries[r->entries_no];
+	memset(e, 0, sizeof(struct cache_entry));
+	e->name = strdup(name);
+	CHECK_ALLOCATION(e->name, strlen(name), 0);
+	if (e->name == NULL)
+		return NULL;
+	r->entries_no++;
+
+	return e;
+}
+
+/* Whether st is still the file recorded, a mtime in the second the root
+ * was scanned may be followed by changes that keep it the same. */
+int
+cache_stat_valid(const struct cache_root *r, dev_t dev, ino_t ino,
+		const struct timespec *mtime, const struct stat *st)
+{
+	return st->st_dev == dev && st->st_ino == ino &&
+	    st->st_mtim.tv_sec == mtime->tv_sec &&
+	    st->st_mtim.tv_nsec == mtime->tv_nsec &&
+	    mtime->tv_sec < r->scanned;
+}
+
+static struct cache_root *
+cache_read_root(const char **buf, const char *end)
+{
+	struct cache_file_root fr;
+	struct cache_root *r;
+	char *path;
+	uint32_t i;
+
+	if ((size_t) (end - *buf) < sizeof(fr))
+		return NULL;
+	memcpy(&fr, *buf, sizeof(fr));
+	*buf += sizeof(fr);
+
+	if (fr.path_len == 0 || (size_t) (end - *buf) < fr.path_len)
+		return NULL;
+	path = strndup(*buf, fr.path_len);
+	CHECK_ALLOCATION(path, fr.path_len, 0);
+	if (path == NULL)
+		return NULL;
+	*buf += fr.path_len;
+
+	r = cache_root_alloc(path, NULL, (time_t) fr.scanned);
+	free(path);
+	if (r == NULL)
+		return NULL;
+	r->dev = (dev_t) fr.dev;
+	r->ino = (ino_t) fr.ino;
+	r->mtime.tv_sec = (time_t) fr.mtime_sec;
+	r->mtime.tv_nsec = (long) fr.mtime_nsec;
+
+	for (i = 0; i < fr.entries_no; i++) {
+		struct cache_file_entry fe;
+		struct cache_entry *e;
+		char *name;
+
+		if ((size_t) (end - *buf) < sizeof(fe))
+			break;
+		memcpy(&fe, *buf, sizeof(fe));
+		*buf += sizeof(fe);
+
+		if (fe.name_len == 0 || (size_t) (end - *buf) < fe.name_len)
+			break;
+		name = strndup(*buf, fe.name_len);
+		CHECK_ALLOCATION(name, fe.name_len, 0);
+		if (name == NULL)
+			break;
+		*buf += fe.name_len;
+
+		e = cache_root_add(r, name);
+		free(name);
+		if (e == NULL)
+			break;
+
+		e->flags = fe.flags;
+		e->dev = (dev_t) fe.dev;
+		e->ino = (ino_t) fe.ino;
+		e->mtime.tv_sec = (time_t) fe.mtime_sec;
+		e->mtime.tv_nsec = (long) fe.mtime_nsec;
+		e->ptest_dev = (dev_t) fe.ptest_dev;
+		e->ptest_ino = (ino_t) fe.ptest_ino;
+		e->ptest_mtime.tv_sec = (time_t) fe.ptest_mtime_sec;
+		e->ptest_mtime.tv_nsec = (long) fe.ptest_mtime_nsec;
+		e->run_ptest_dev = (dev_t) fe.run_ptest_dev;
+		e->run_ptest_ino = (ino_t) fe.run_ptest_ino;
+	}
+
+	if (i != fr.entries_no) {
+		cache_root_free(r);
+		return NULL;
+	}
+
+	return r;
+}
+
+/* A missing or invalid cache file gives an empty cache, it's rebuilt by
+ * the next cache_write(). */
+struct ptest_cache *
+cache_open(const char *filename)
+{
+	struct ptest_cache *c;
+	struct cache_file_header fh;
+	struct stat st_buf;
+	const char *buf, *end;
+	char *data = NULL;
+	int fd;
+	uint32_t i;
+
+	c = calloc(1, sizeof(struct ptest_cache));
+	CHECK_ALLOCATION(c, sizeof(struct ptest_cache), 0);
+	if (c == NULL)
+		return NULL;
+
+	c->filename = strdup(filename);
+	CHECK_ALLOCATION(c->filename, strlen(filename), 0);
+	if (c->filename == NULL) {
+		free(c);
+		return NULL;
+	}
+
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return c;
+
+	do {
+		if (fstat(fd, &st_buf) == -1 ||
+		    (size_t) st_buf.st_size < sizeof(fh))
+			break;
+
+		data = malloc((size_t) st_buf.st_size);
+		CHECK_ALLOCATION(data, (size_t) st_buf.st_size, 0);
+		if (data == NULL)
+			break;
+
+		if (read(fd, data, (size_t) st_buf.st_size) != st_buf.st_size)
+			break;
+
+		memcpy(&fh, data, sizeof(fh));
+		if (memcmp(fh.magic, CACHE_MAGIC, sizeof(fh.magic)) != 0 ||
+		    fh.version != CACHE_VERSION)
+			break;
+
+		buf = data + sizeof(fh);
+		end = data + st_buf.st_size;
+		for (i = 0; i < fh.roots_no; i++) {
+			struct cache_root *r = cache_read_root(&buf, end);
+
+			if (r == NULL || cache_root_set(c, r) == -1) {
+				cache_root_free(r);
+				break;
+			}
+		}
+		c->dirty = 0;
+	} while (0);
+
+	free(data);
+	close(fd);
+
+	return c;
+}
+
+static int
+cache_write_root(FILE *fp, const struct cache_root *r)
+{
+	struct cache_file_root fr;
+	size_t i;
+
+	memset(&fr, 0, sizeof(fr));
+	fr.dev = (uint64_t) r->dev;
+	fr.ino = (uint64_t) r->ino;
+	fr.mtime_sec = (int64_t) r->mtime.tv_sec;
+	fr.mtime_nsec = (int64_t) r->mtime.tv_nsec;
+	fr.scanned = (int64_t) r->scanned;
+	fr.path_len = (uint32_t) strlen(r->path);
+	fr.entries_no = (uint32_t) r->entries_no;
+
+	if (fwrite(&fr, sizeof(fr), 1, fp) != 1 ||
+	    fwrite(r->path, fr.path_len, 1, fp) != 1)
+		return -1;
+
+	for (i = 0; i < r->entries_no; i++) {
+		const struct cache_entry *e = &r->entries[i];
+		struct cache_file_entry fe;
+
+		memset(&fe, 0, sizeof(fe));
+		fe.dev = (uint64_t) e->dev;
+		fe.ino = (uint64_t) e->ino;
+		fe.mtime_sec = (int64_t) e->mtime.tv_sec;
+		fe.mtime_nsec = (int64_t) e->mtime.tv_nsec;
+		fe.ptest_dev = (uint64_t) e->ptest_dev;
+		fe.ptest_ino = (uint64_t) e->ptest_ino;
+		fe.ptest_mtime_sec = (int64_t) e->ptest_mtime.tv_sec;
+		fe.ptest_mtime_nsec = (int64_t) e->ptest_mtime.tv_nsec;
+		fe.run_ptest_dev = (uint64_t) e->run_ptest_dev;
+		fe.run_ptest_ino = (uint64_t) e->run_ptest_ino;
+		fe.name_len = (uint32_t) strlen(e->name);
+		fe.flags = e->flags;
+
+		if (fwrite(&fe, sizeof(fe), 1, fp) != 1 ||
+		    fwrite(e->name, fe.name_len, 1, fp) != 1)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Replaces the file so concurrent readers see the old or the new cache,
+ * nothing is written when no root changed. */
+int
+cache_write(struct ptest_cache *c)
+{
+	struct cache_file_header fh;
+	char *tmp;
+	FILE *fp;
+	int fd;
+	int i;
+	int rc = -1;
+
+	if (!c->dirty)
+		return 0;
+
+	if (asprintf(&tmp, "%s.XXXXXX", c->filename) == -1)
+		return -1;
+
+	fd = mkstemp(tmp);
+	if (fd == -1) {
+		free(tmp);
+		return -1;
+	}
+	fchmod(fd, 0644);
+
+	fp = fdopen(fd, "w");
+	if (fp == NULL) {
+		close(fd);
+		unlink(tmp);
+		free(tmp);
+		return -1;
+	}
+
+	do {
+		memset(&fh, 0, sizeof(fh));
+		memcpy(fh.magic, CACHE_MAGIC, sizeof(fh.magic));
+		fh.version = CACHE_VERSION;
+		fh.roots_no = (uint32_t) c->roots_no;
+		if (fwrite(&fh, sizeof(fh), 1, fp) != 1)
+			break;
+
+		for (i = 0; i < c->roots_no; i++) {
+			if (cache_write_root(fp, c->roots[i]) == -1)
+				break;
+		}
+		if (i != c->roots_no)
+			break;
+
+		rc = 0;
+	} while (0);
+
+	if (fclose(fp) != 0)
+		rc = -1;
+
+	if (rc == 0 && rename(tmp, c->filename) == 0)
+		c->dirty = 0;
+	else {
+		rc = -1;
+		unlink(tmp);
+	}
+	free(tmp);
+
+	return rc;
+}
+
+void
+cache_close(struct ptest_cache *c)
+{
+	int i;
+
+	if (c == NULL)
+		return;
+
+	for (i = 0; i < c->roots_no; i++)
+		cache_root_free(c->roots[i]);
+	free(c->roots);
+	free(c->filename);
+	free(c);
+}
+
+struct cache_root *
+cache_root_search(struct ptest_cache *c, const char *path)
+{
+	int i;
+
+	if (c == NULL)
+		return NULL;
+
+	for (i = 0; i < c->roots_no; i++) {
+		if (strcmp(c->roots[i]->path, path) == 0)
+			return c->roots[i];
+	}
+
+	return NULL;
+}
+
+/* Takes ownership of r, replacing the root with the same path. */
+int
+cache_root_set(struct ptest_cache *c, struct cache_root *r)
+{
+	struct cache_root **roots;
+	int i;
+
+	for (i = 0; i < c->roots_no; i++) {
+		if (strcmp(c->roots[i]->path, r->path) == 0) {
+			cache_root_free(c->roots[i]);
+			c->roots[i] = r;
+			c->dirty = 1;
+			return 0;
+		}
+	}
+
+	roots = realloc(c->roots, sizeof(struct cache_root *) * (size_t) (c->roots_no + 1));
+	CHECK_ALLOCATION(roots, sizeof(struct cache_root *) * (size_t) (c->roots_no + 1), 0);
+	if (roots == NULL)
+		return -1;
+	c->roots = roots;
+	c->roots[c->roots_no++] = r;
+	c->dirty = 1;
+
+	return 0;
+}
@@ -0,0 +1,91 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+
+#ifndef PTEST_RUNNER_CACHE_H
+#define PTEST_RUNNER_CACHE_H
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#define CACHE_MAGIC "PTESTDSC"
+#define CACHE_VERSION 1
+
+#define CACHE_ENTRY_PTEST_DIR 0x1 /* <name>/ptest is a directory */
+#define CACHE_ENTRY_PTEST 0x2 /* <name>/ptest/run-ptest is a file */
+
+/* *
+ * The discovery cache keeps, for every -d root, the directories found
+ * in it with the identity and mtime of <name> and <name>/ptest, those
+ * change whenever a ptest is installed or removed so the ptests of a
+ * root can be listed again by only stat'ing its directories. Entries
+ * that aren't directories aren't kept, they can only turn into one by
+ * being replaced and that changes the mtime of the root.
+ * */
+struct cache_entry {
+	char *name;
+	uint32_t flags;
+	uint32_t padding1;
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	dev_t ptest_dev;
+	ino_t ptest_ino;
+	struct timespec ptest_mtime;
+	dev_t run_ptest_dev;
+	ino_t run_ptest_ino;
+};
+
+struct cache_root {
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	time_t scanned; /* mtimes from this second on can't be trusted */
+	struct cache_entry *entries; /* in the order the ptests are listed */
+	size_t entries_no;
+	size_t size;
+};
+
+struct ptest_cache {
+	char *filename;
+	struct cache_root **roots;
+	int roots_no;
+	int dirty;
+};
+
+extern struct ptest_cache *cache_open(const char *);
+extern int cache_write(struct ptest_cache *);
+extern void cache_close(struct ptest_cache *);
+
+extern struct cache_root *cache_root_search(struct ptest_cache *, const char *);
+extern int cache_root_set(struct ptest_cache *, struct cache_root *);
+
+extern struct cache_root *cache_root_alloc(const char *, const struct stat *, time_t);
+extern void cache_root_free(struct cache_root *);
+extern struct cache_entry *cache_root_add(struct cache_root *, const char *);
+extern int cache_stat_valid(const struct cache_root *, dev_t, ino_t,
+		const struct timespec *, const struct stat *);
+
+#endif // PTEST_RUNNER_CACHE_H
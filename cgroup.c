@@ -0,0 +1,432 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "cgroup.h"
+#include "utils.h"
+
+static const struct {
+	unsigned int flag;
+	const char *name;
+} controllers[] = {
+	{ CGROUP_MEMORY, "memory" },
+	{ CGROUP_CPU, "cpu" },
+	{ CGROUP_PIDS, "pids" },
+	{ CGROUP_IO, "io" },
+};
+
+static ssize_t
+read_file(int dfd, const char *name, char *buf, size_t size)
+{
+	ssize_t n;
+	int fd;
+
+	fd = openat(dfd, name, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	n = read(fd, buf, size - 1);
+	close(fd);
+	if (n < 0)
+		return -1;
+	buf[n] = '\0';
+
+	return n;
+}
+
+static int
+write_file(int dfd, const char *name, const char *value)
+{
+	ssize_t n;
+	int fd;
+
+	fd = openat(dfd, name, O_WRONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	n = write(fd, value, strlen(value));
+	close(fd);
+
+	return n == (ssize_t) strlen(value) ? 0 : -1;
+}
+
+/* The cgroup2 mount point joined with the group of the runner. */
+static char *
+runner_group(void)
+{
+	char line[4096], mount[PATH_MAX], path[PATH_MAX];
+	char *group = NULL, *c;
+	FILE *fp;
+
+	mount[0] = path[0] = '\0';
+
+	fp = fopen("/proc/self/mountinfo", "re");
+	if (fp == NULL)
+		return NULL;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		c = strstr(line, " - cgroup2 ");
+		if (c != NULL && sscanf(line, "%*d %*d %*s %*s %4095s", mount) == 1)
+			break;
+		mount[0] = '\0';
+	}
+	fclose(fp);
+
+	fp = fopen("/proc/self/cgroup", "re");
+	if (fp == NULL)
+		return NULL;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (strncmp(line, "0::", 3) == 0) {
+			line[strcspn(line, "\n")] = '\0';
+			snprintf(path, sizeof(path), "%s", line + 3);
+			break;
+		}
+	}
+	fclose(fp);
+
+	if (mount[0] == '\0' || path[0] != '/') {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	if (asprintf(&group, "%s%s", mount, strcmp(path, "/") == 0 ? "" : path) == -1)
+		return NULL;
+
+	return group;
+}
+
+/* *
+ * No process can be in a group that enables controllers for its
+ * children unless it's the root, the runner moves out of the way to
+ * ptest-runner.<pid>/runner.
+ * */
+static int
+move_runner(int dfd)
+{
+	char pid[16];
+	int runner_dfd, r;
+
+	if (mkdirat(dfd, "runner", 0755) == -1 && errno != EEXIST)
+		return -1;
+
+	runner_dfd = openat(dfd, "runner", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (runner_dfd == -1) {
+		unlinkat(dfd, "runner", AT_REMOVEDIR);
+		return -1;
+	}
+	snprintf(pid, sizeof(pid), "%d", (int) getpid());
+	r = write_file(runner_dfd, "cgroup.procs", pid);
+	close(runner_dfd);
+	if (r == -1)
+		unlinkat(dfd, "runner", AT_REMOVEDIR);
+
+	return r;
+}
+
+/* Enables the controller in the group of the runner, fails when it has
+ * other processes unless it's the root, and then in ptest-runner.<pid>. */
+static int
+enable_controller(int parent_dfd, int dfd, const char *name)
+{
+	char value[32];
+
+	snprintf(value, sizeof(value), "+%s", name);
+	write_file(parent_dfd, "cgroup.subtree_control", value);
+
+	return write_file(dfd, "cgroup.subtree_control", value);
+}
+
+struct ptest_cgroups *
+cgroup_open(long memory_max, unsigned int cpu_max, unsigned int pids_max, FILE *fp)
+{
+	struct ptest_cgroups *cg;
+	char name[64];
+	char *group;
+	int parent_dfd;
+	size_t i;
+
+	group = runner_group();
+	if (group == NULL)
+		return NULL;
+
+	parent_dfd = open(group, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (parent_dfd == -1) {
+		free(group);
+		return NULL;
+	}
+
+	snprintf(name, sizeof(name), "ptest-runner.%d", (int) getpid());
+	if (mkdirat(parent_dfd, name, 0755) == -1 && errno != EEXIST) {
+		int saved_errno = errno;
+
+		close(parent_dfd);
+		free(group);
+		errno = saved_errno;
+		return NULL;
+	}
+
+	cg = calloc(1, sizeof(struct ptest_cgroups));
+	CHECK_ALLOCATION(cg, sizeof(struct ptest_cgroups), 1);
+	cg->memory_max = memory_max;
+	cg->cpu_max = cpu_max;
+	cg->pids_max = pids_max;
+
+	cg->dfd = openat(parent_dfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (cg->dfd == -1 || asprintf(&cg->path, "%s/%s", group, name) == -1) {
+		int saved_errno = errno;
+
+		if (cg->dfd != -1)
+			close(cg->dfd);
+		unlinkat(parent_dfd, name, AT_REMOVEDIR);
+		close(parent_dfd);
+		free(group);
+		free(cg);
+		errno = saved_errno;
+		return NULL;
+	}
+
+	if (move_runner(cg->dfd) == -1)
+		fprintf(fp, "WARNING: The runner can't be moved to %s/runner, %s.\n",
+			cg->path, strerror(errno));
+
+	for (i = 0; i < sizeof(controllers) / sizeof(controllers[0]); i++)
+		if (enable_controller(parent_dfd, cg->dfd, controllers[i].name) == 0)
+			cg->controllers |= controllers[i].flag;
+	close(parent_dfd);
+	free(group);
+
+	if (memory_max > 0 && !(cg->controllers & CGROUP_MEMORY))
+		fprintf(fp, "WARNING: The memory controller can't be enabled in %s, no memory.max.\n",
+			cg->path);
+	if (cpu_max > 0 && !(cg->controllers & CGROUP_CPU))
+		fprintf(fp, "WARNING: The cpu controller can't be enabled in %s, no cpu.max.\n",
+			cg->path);
+	if (pids_max > 0 && !(cg->controllers & CGROUP_PIDS))
+		fprintf(fp, "WARNING: The pids controller can't be enabled in %s, no pids.max.\n",
+			cg->path);
+
+	return cg;
+}
+
+/* The groups of the ptests must be removed already, the runner moves
+ * back to the group it came from. */
+void
+cgroup_close(struct ptest_cgroups *cg)
+{
+	char pid[16];
+	char *c;
+	int parent_dfd;
+
+	if (cg == NULL)
+		return;
+
+	c = strrchr(cg->path, '/');
+	if (c != NULL) {
+		*c = '\0';
+		parent_dfd = open(cg->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (parent_dfd != -1) {
+			snprintf(pid, sizeof(pid), "%d", (int) getpid());
+			write_file(parent_dfd, "cgroup.procs", pid);
+			unlinkat(cg->dfd, "runner", AT_REMOVEDIR);
+			unlinkat(parent_dfd, c + 1, AT_REMOVEDIR);
+			close(parent_dfd);
+		}
+	}
+	close(cg->dfd);
+	free(cg->path);
+	free(cg);
+}
+
+/* *
+ * Creates the group of the next ptest with the limits applied. Returns
+ * its dfd and in procs_fd the cgroup.procs the child writes "0" to, the
+ * group name is kept in seq for cgroup_remove().
+ * */
+int
+cgroup_create(struct ptest_cgroups *cg, unsigned long *seq, int *procs_fd)
+{
+	char name[32], value[64];
+	int dfd;
+
+	*seq = cg->seq++;
+	snprintf(name, sizeof(name), "%lu", *seq);
+	if (mkdirat(cg->dfd, name, 0755) == -1)
+		return -1;
+
+	dfd = openat(cg->dfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dfd == -1) {
+		unlinkat(cg->dfd, name, AT_REMOVEDIR);
+		return -1;
+	}
+
+	do {
+		if (cg->memory_max > 0 && (cg->controllers & CGROUP_MEMORY)) {
+			snprintf(value, sizeof(value), "%ld", cg->memory_max * 1024);
+			if (write_file(dfd, "memory.max", value) == -1)
+				break;
+		}
+		if (cg->cpu_max > 0 && (cg->controllers & CGROUP_CPU)) {
+			snprintf(value, sizeof(value), "%u 100000", cg->cpu_max * 1000);
+			if (write_file(dfd, "cpu.max", value) == -1)
+				break;
+		}
+		if (cg->pids_max > 0 && (cg->controllers & CGROUP_PIDS)) {
+			snprintf(value, sizeof(value), "%u", cg->pids_max);
+			if (write_file(dfd, "pids.max", value) == -1)
+				break;
+		}
+
+		*procs_fd = openat(dfd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+		if (*procs_fd == -1)
+			break;
+
+		return dfd;
+	} while (0);
+
+	close(dfd);
+	unlinkat(cg->dfd, name, AT_REMOVEDIR);
+	return -1;
+}
+
+/* Whether processes are left in the group, from cgroup.events. */
+int
+cgroup_populated(int dfd)
+{
+	char buf[256];
+	char *c;
+
+	if (read_file(dfd, "cgroup.events", buf, sizeof(buf)) <= 0)
+		return 0;
+	c = strstr(buf, "populated ");
+
+	return c != NULL && c[strlen("populated ")] == '1';
+}
+
+/* *
+ * Kills every process left in the group with cgroup.kill, it doesn't
+ * wait for them, the group is empty once cgroup_populated() says so.
+ * The processes found are printed on fp unless it's NULL, returns their
+ * number.
+ * */
+int
+cgroup_kill(int dfd, FILE *fp)
+{
+	char buf[4096], comm[64], path[64];
+	char *line, *saveptr;
+	int n = 0;
+
+	if (!cgroup_populated(dfd))
+		return 0;
+
+	if (read_file(dfd, "cgroup.procs", buf, sizeof(buf)) > 0) {
+		for (line = strtok_r(buf, "\n", &saveptr); line != NULL;
+		     line = strtok_r(NULL, "\n", &saveptr)) {
+			n++;
+			if (fp == NULL)
+				continue;
+
+			snprintf(path, sizeof(path), "/proc/%s/comm", line);
+			if (read_file(AT_FDCWD, path, comm, sizeof(comm)) <= 0)
+				strcpy(comm, "?");
+			comm[strcspn(comm, "\n")] = '\0';
+			fprintf(fp, "LEFTOVER: %s (%s) killed\n", line, comm);
+		}
+	}
+
+	write_file(dfd, "cgroup.kill", "1");
+
+	return n;
+}
+
+static long long
+read_key(const char *buf, const char *key)
+{
+	const char *c = buf;
+	size_t len = strlen(key);
+
+	while ((c = strstr(c, key)) != NULL) {
+		if ((c == buf || c[-1] == '\n' || c[-1] == ' ') && c[len] == ' ')
+			return strtoll(c + len + 1, NULL, 10);
+		c += len;
+	}
+
+	return -1;
+}
+
+void
+cgroup_stat(int dfd, struct cgroup_stat *st)
+{
+	char buf[4096];
+	char *c;
+
+	st->usage_us = st->user_us = st->system_us = -1;
+	st->memory_peak = st->io_rbytes = st->io_wbytes = -1;
+
+	if (read_file(dfd, "cpu.stat", buf, sizeof(buf)) > 0) {
+		st->usage_us = read_key(buf, "usage_usec");
+		st->user_us = read_key(buf, "user_usec");
+		st->system_us = read_key(buf, "system_usec");
+	}
+
+	if (read_file(dfd, "memory.peak", buf, sizeof(buf)) > 0)
+		st->memory_peak = strtoll(buf, NULL, 10);
+
+	/* A line per device, "8:0 rbytes=N wbytes=N rios=N ...". */
+	if (read_file(dfd, "io.stat", buf, sizeof(buf)) >= 0) {
+		st->io_rbytes = st->io_wbytes = 0;
+		for (c = buf; (c = strstr(c, "rbytes=")) != NULL; c++)
+			st->io_rbytes += strtoll(c + strlen("rbytes="), NULL, 10);
+		for (c = buf; (c = strstr(c, "wbytes=")) != NULL; c++)
+			st->io_wbytes += strtoll(c + strlen("wbytes="), NULL, 10);
+	}
+}
+
+/* Bytes the group uses now, -1 without the memory controller. */
+long long
+cgroup_memory_current(int dfd)
+{
+	char buf[64];
+
+	if (read_file(dfd, "memory.current", buf, sizeof(buf)) <= 0)
+		return -1;
+
+	return strtoll(buf, NULL, 10);
+}
+
+void
+cgroup_remove(struct ptest_cgroups *cg, int dfd, unsigned long seq)
+{
+	char name[32];
+
+	close(dfd);
+	snprintf(name, sizeof(name), "%lu", seq);
+	unlinkat(cg->dfd, name, AT_REMOVEDIR);
+}
@@ -0,0 +1,75 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+#ifndef PTEST_RUNNER_CGROUP_H
+#define PTEST_RUNNER_CGROUP_H
+
+#include <stdio.h>
+
+enum {
+	CGROUP_MEMORY = 1 << 0,
+	CGROUP_CPU = 1 << 1,
+	CGROUP_PIDS = 1 << 2,
+	CGROUP_IO = 1 << 3,
+};
+
+/* *
+ * Every ptest runs in its own cgroup v2 group, <runner group>/
+ * ptest-runner.<pid>/<n>, so the daemons it starts can't escape the
+ * accounting or the cleanup. The runner itself moves to
+ * ptest-runner.<pid>/runner, a group with processes can't enable
+ * controllers for its children. The controllers are enabled when the
+ * hierarchy allows it, without them the limits can't be applied and
+ * only the CPU time is accounted.
+ * */
+struct ptest_cgroups {
+	int dfd; /* ptest-runner.<pid> */
+	unsigned int controllers; /* CGROUP_* enabled for the ptests */
+	long memory_max; /* KiB, 0 for no limit */
+	unsigned int cpu_max; /* percent of a CPU, 0 for no limit */
+	unsigned int pids_max; /* 0 for no limit */
+	unsigned long seq;
+	char *path;
+};
+
+/* Accounting of a group, -1 when the controller isn't enabled. */
+struct cgroup_stat {
+	long long usage_us;
+	long long user_us;
+	long long system_us;
+	long long memory_peak; /* bytes */
+	long long io_rbytes;
+	long long io_wbytes;
+};
+
+extern struct ptest_cgroups *cgroup_open(long, unsigned int, unsigned int, FILE *);
+extern void cgroup_close(struct ptest_cgroups *);
+
+extern int cgroup_create(struct ptest_cgroups *, unsigned long *, int *);
+extern int cgroup_kill(int, FILE *);
+extern int cgroup_populated(int);
+extern void cgroup_stat(int, struct cgroup_stat *);
+extern long long cgroup_memory_current(int);
+extern void cgroup_remove(struct ptest_cgroups *, int, unsigned long);
+
+#endif // PTEST_RUNNER_CGROUP_H
@@ -0,0 +1,330 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "conf.h"
+#include "ptest_list.h"
+#include "utils.h"
+
+static char *
+strip(char *s)
+{
+	char *end;
+
+	while (isspace((unsigned char) *s))
+		s++;
+
+	end = s + strlen(s);
+	while (end > s && isspace((unsigned char) end[-1]))
+		*--end = '\0';
+
+	return s;
+}
+
+/* Sizes in KiB, a number without suffix is in bytes. Fails when it
+ * doesn't fit in a long. */
+int
+conf_parse_size(const char *value, long *size)
+{
+	long multiplier = 1;
+	char *end;
+	long n;
+
+	errno = 0;
+	n = strtol(value, &end, 10);
+	if (errno != 0 || end == value || n < 0)
+		return -1;
+
+	switch (toupper((unsigned char) *end)) {
+		case '\0':
+			n /= 1024;
+			break;
+		case 'K':
+			break;
+		case 'M':
+			multiplier = 1024;
+			break;
+		case 'G':
+			multiplier = 1024 * 1024;
+			break;
+		default:
+			return -1;
+	}
+	if (*end != '\0' && end[1] != '\0')
+		return -1;
+	if (n > LONG_MAX / multiplier)
+		return -1;
+	n *= multiplier;
+
+	*size = n;
+	return 0;
+}
+
+static int
+parse_int(const char *value, int *n)
+{
+	char *end;
+	long l;
+
+	errno = 0;
+	l = strtol(value, &end, 10);
+	if (errno != 0 || end == value || *end != '\0' || l < 0 || l > INT_MAX)
+		return -1;
+
+	*n = (int) l;
+	return 0;
+}
+
+static int
+parse_bool(const char *value, int *b)
+{
+	if (strcmp(value, "yes") == 0 || strcmp(value, "true") == 0 ||
+	    strcmp(value, "1") == 0)
+		*b = 1;
+	else if (strcmp(value, "no") == 0 || strcmp(value, "false") == 0 ||
+	    strcmp(value, "0") == 0)
+		*b = 0;
+	else
+		return -1;
+
+	return 0;
+}
+
+static void
+free_locks(char **locks, int locks_no)
+{
+	int i;
+
+	for (i = 0; i < locks_no; i++)
+		free(locks[i]);
+	free(locks);
+}
+
+/* Names separated by commas or spaces, replacing the ones set before. */
+static int
+parse_locks(char *value, struct ptest_conf *conf)
+{
+	char **locks = NULL;
+	char *tok, *saveptr;
+	int n = 0;
+
+	for (tok = strtok_r(value, ", \t", &saveptr); tok != NULL;
+	     tok = strtok_r(NULL, ", \t", &saveptr)) {
+		char **tmp = realloc(locks, sizeof(char *) * (size_t) (n + 1));
+
+		CHECK_ALLOCATION(tmp, sizeof(char *) * (size_t) (n + 1), 0);
+		if (tmp == NULL) {
+			free_locks(locks, n);
+			return -1;
+		}
+		locks = tmp;
+
+		locks[n] = strdup(tok);
+		CHECK_ALLOCATION(locks[n], strlen(tok), 0);
+		if (locks[n] == NULL) {
+			free_locks(locks, n);
+			return -1;
+		}
+		n++;
+	}
+
+	free_locks(conf->locks, conf->locks_no);
+	conf->locks = locks;
+	conf->locks_no = n;
+
+	return 0;
+}
+
+void
+conf_init(struct ptest_conf *conf)
+{
+	memset(conf, 0, sizeof(struct ptest_conf));
+	conf->timeout = -1;
+	conf->max_duration = -1;
+	conf->cpu = 1;
+	conf->expected_duration = -1;
+}
+
+/* Applies a line of the file, returns -1 when it can't be understood
+ * leaving conf as it was. */
+int
+conf_parse(struct ptest_conf *conf, const char *line)
+{
+	char buf[256];
+	char *key, *value, *c;
+
+	if (strlen(line) >= sizeof(buf))
+		return -1;
+	strcpy(buf, line);
+
+	c = strchr(buf, '#');
+	if (c != NULL)
+		*c = '\0';
+
+	key = strip(buf);
+	if (*key == '\0')
+		return 0;
+
+	c = strchr(key, '=');
+	if (c == NULL)
+		return -1;
+	*c = '\0';
+	key = strip(key);
+	value = strip(c + 1);
+
+	if (strcmp(key, "timeout") == 0)
+		return parse_int(value, &conf->timeout);
+	if (strcmp(key, "max-duration") == 0)
+		return parse_int(value, &conf->max_duration);
+	if (strcmp(key, "exclusive") == 0)
+		return parse_bool(value, &conf->exclusive);
+	if (strcmp(key, "locks") == 0)
+		return parse_locks(value, conf);
+	if (strcmp(key, "expected-duration") == 0) {
+		int seconds;
+
+		if (parse_int(value, &seconds) == -1)
+			return -1;
+		conf->expected_duration = seconds * 1000L;
+		return 0;
+	}
+	if (strcmp(key, "memory") == 0)
+		return conf_parse_size(value, &conf->memory);
+	if (strcmp(key, "cpu") == 0) {
+		int cpu;
+
+		if (parse_int(value, &cpu) == -1 || cpu < 1)
+			return -1;
+		conf->cpu = cpu;
+		return 0;
+	}
+
+	return 0;
+}
+
+/* *
+ * Applies the lines of filename to conf. A line that can't be understood
+ * changes nothing and is reported on fp with its number. Returns -1 when
+ * the file can't be opened, ENOENT when there's none.
+ * */
+int
+conf_read(struct ptest_conf *conf, const char *filename, FILE *fp)
+{
+	char line[256];
+	int lineno = 0;
+	FILE *f;
+	int c;
+
+	f = fopen(filename, "re");
+	if (f == NULL)
+		return -1;
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		lineno++;
+		if (strchr(line, '\n') == NULL && !feof(f)) {
+			fprintf(fp, "WARNING: %s:%d: line too long, ignored.\n",
+				filename, lineno);
+			while ((c = fgetc(f)) != EOF && c != '\n');
+			continue;
+		}
+
+		if (conf_parse(conf, line) == -1)
+			fprintf(fp, "WARNING: %s:%d: can't understand \"%s\", ignored.\n",
+				filename, lineno, strip(line));
+	}
+	fclose(f);
+
+	return 0;
+}
+
+/* *
+ * The settings of p, read when the ptest is discovered so mistakes are
+ * reported before anything runs. A ptest put in a list some other way
+ * gets them the first time they're needed.
+ * */
+const struct ptest_conf *
+ptest_conf(struct ptest_list *p)
+{
+	struct ptest_conf *conf;
+	char *filename, *c;
+
+	if (p->conf != NULL)
+		return p->conf;
+
+	conf = malloc(sizeof(struct ptest_conf));
+	CHECK_ALLOCATION(conf, sizeof(struct ptest_conf), 1);
+	conf_init(conf);
+	p->conf = conf;
+
+	filename = malloc(strlen(p->run_ptest) + sizeof(CONF_FILENAME));
+	CHECK_ALLOCATION(filename, strlen(p->run_ptest) + sizeof(CONF_FILENAME), 1);
+	strcpy(filename, p->run_ptest);
+	c = strrchr(filename, '/');
+	strcpy(c != NULL ? c + 1 : filename, CONF_FILENAME);
+
+	conf_read(conf, filename, stderr);
+	free(filename);
+
+	return conf;
+}
+
+/* A copy of conf for a ptest copied into another list. */
+struct ptest_conf *
+conf_dup(const struct ptest_conf *conf)
+{
+	struct ptest_conf *dup;
+	int i;
+
+	dup = malloc(sizeof(struct ptest_conf));
+	CHECK_ALLOCATION(dup, sizeof(struct ptest_conf), 1);
+	*dup = *conf;
+	if (conf->locks_no == 0)
+		return dup;
+
+	dup->locks = malloc(sizeof(char *) * (size_t) conf->locks_no);
+	CHECK_ALLOCATION(dup->locks, sizeof(char *) * (size_t) conf->locks_no, 1);
+	for (i = 0; i < conf->locks_no; i++) {
+		dup->locks[i] = strdup(conf->locks[i]);
+		CHECK_ALLOCATION(dup->locks[i], strlen(conf->locks[i]), 1);
+	}
+
+	return dup;
+}
+
+void
+conf_free(struct ptest_conf *conf)
+{
+	if (conf == NULL)
+		return;
+
+	free_locks(conf->locks, conf->locks_no);
+	free(conf);
+}
@@ -0,0 +1,67 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+
+#ifndef PTEST_RUNNER_CONF_H
+#define PTEST_RUNNER_CONF_H
+
+#include <stdio.h>
+
+#define CONF_FILENAME "ptest-runner.conf"
+
+/* *
+ * Settings a ptest declares in ptest/ptest-runner.conf, one "key = value"
+ * per line and # for comments. Unknown keys are ignored so older runners
+ * can read newer files.
+ *
+ *   timeout = 3600		seconds, overrides -t, 0 for none
+ *   max-duration = 7200	seconds, overrides --max-duration, 0 for none
+ *   exclusive = yes		doesn't run next to any other ptest
+ *   locks = port-80, dbus	doesn't run next to ptests with the same lock
+ *   expected-duration = 600	seconds, used without history
+ *   memory = 512M		memory the ptest needs, K, M or G
+ *   cpu = 2			CPUs the ptest keeps busy, default 1
+ * */
+struct ptest_conf {
+	int timeout; /* seconds, -1 for the default */
+	int max_duration; /* seconds, -1 for the default */
+	int exclusive;
+	int padding1;
+	char **locks;
+	int locks_no;
+	int cpu;
+	long expected_duration; /* milliseconds, -1 when unknown */
+	long memory; /* KiB, 0 when unknown */
+};
+
+struct ptest_list;
+
+extern void conf_init(struct ptest_conf *);
+extern int conf_parse(struct ptest_conf *, const char *);
+extern int conf_parse_size(const char *, long *);
+extern int conf_read(struct ptest_conf *, const char *, FILE *);
+extern const struct ptest_conf *ptest_conf(struct ptest_list *);
+extern struct ptest_conf *conf_dup(const struct ptest_conf *);
+extern void conf_free(struct ptest_conf *);
+
+#endif // PTEST_RUNNER_CONF_H
@@ -0,0 +1,404 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "history.h"
+#include "utils.h"
+
+#define HISTORY_LENGTH(size) \
+	(sizeof(struct history_header) + (size_t) (size) * sizeof(struct history_entry))
+
+static uint32_t
+history_hash(const char *ptest)
+{
+	uint32_t h = 2166136261u;
+
+	for (; *ptest; ptest++) {
+		h ^= (unsigned char) *ptest;
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+/* *
+ * Maps the table of h->fd, which must be locked. Fails with EINVAL for a
+ * file that isn't a history and with EBADMSG for a table that can't be
+ * trusted: a size that isn't a power of two breaks the mask of
+ * history_slot(), a full table its probing and a length that doesn't
+ * match the size the mapping.
+ * */
+static int
+history_map(struct ptest_history *h)
+{
+	struct history_header header;
+	struct stat st_buf;
+	void *m;
+
+	if (fstat(h->fd, &st_buf) == -1)
+		return -1;
+
+	if (pread(h->fd, &header, sizeof(header), 0) != sizeof(header) ||
+	    memcmp(header.magic, HISTORY_MAGIC, sizeof(header.magic)) != 0 ||
+	    header.version != HISTORY_VERSION) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (header.size == 0 || (header.size & (header.size - 1)) != 0 ||
+	    header.used >= header.size ||
+	    (off_t) HISTORY_LENGTH(header.size) != st_buf.st_size) {
+		errno = EBADMSG;
+		return -1;
+	}
+
+	m = mmap(NULL, (size_t) st_buf.st_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED, h->fd, 0);
+	if (m == MAP_FAILED)
+		return -1;
+
+	h->length = (size_t) st_buf.st_size;
+	h->header = m;
+	h->entries = (struct history_entry *) (h->header + 1);
+
+	return 0;
+}
+
+static void
+history_unmap(struct ptest_history *h)
+{
+	if (h->header != NULL)
+		munmap(h->header, h->length);
+	h->header = NULL;
+	h->entries = NULL;
+	h->length = 0;
+}
+
+/* *
+ * Locks the file with op. The table is never changed in place once
+ * written, other runners replace the whole file, so when the file open
+ * isn't the one at filename anymore the new one is opened and locked
+ * instead, leaving h unmapped.
+ * */
+static int
+history_lock(struct ptest_history *h, int op)
+{
+	struct stat st_fd, st_path;
+	int fd;
+
+	for (;;) {
+		flock(h->fd, op);
+		if (fstat(h->fd, &st_fd) == -1 || stat(h->filename, &st_path) == -1 ||
+		    (st_fd.st_dev == st_path.st_dev && st_fd.st_ino == st_path.st_ino))
+			return 0;
+
+		fd = open(h->filename, O_RDWR | O_CLOEXEC);
+		if (fd == -1) {
+			flock(h->fd, LOCK_UN);
+			return -1;
+		}
+
+		history_unmap(h);
+		close(h->fd);
+		h->fd = fd;
+	}
+}
+
+/* Maps the table after history_lock() switched files. */
+static int
+history_sync(struct ptest_history *h)
+{
+	if (h->header != NULL)
+		return 0;
+
+	return history_map(h);
+}
+
+/* Returns the entry for ptest or the empty slot where it belongs. */
+static struct history_entry *
+history_slot(struct history_header *header, struct history_entry *entries,
+		const char *ptest)
+{
+	uint32_t mask = header->size - 1;
+	uint32_t i = history_hash(ptest) & mask;
+
+	while (entries[i].ptest[0] != '\0') {
+		if (strcmp(entries[i].ptest, ptest) == 0)
+			break;
+		i = (i + 1) & mask;
+	}
+
+	return &entries[i];
+}
+
+/* *
+ * Writes a table of size slots holding the entries of the mapped one,
+ * if any, to a new file and renames it over the old one. Readers never
+ * see a table half rehashed and a runner dying half way leaves the old
+ * one. Must be called with the file locked, the new one is left locked
+ * and mapped in its place.
+ * */
+static int
+history_replace(struct ptest_history *h, uint32_t size)
+{
+	struct history_header *header;
+	struct history_entry *entries;
+	size_t length = HISTORY_LENGTH(size);
+	void *m = MAP_FAILED;
+	char *tmp;
+	uint32_t i;
+	int fd;
+
+	if (asprintf(&tmp, "%s.XXXXXX", h->filename) == -1)
+		return -1;
+
+	fd = mkostemp(tmp, O_CLOEXEC);
+	if (fd == -1) {
+		free(tmp);
+		return -1;
+	}
+	fchmod(fd, 0644);
+	flock(fd, LOCK_EX);
+
+	if (ftruncate(fd, (off_t) length) == 0)
+		m = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (m == MAP_FAILED) {
+		close(fd);
+		unlink(tmp);
+		free(tmp);
+		return -1;
+	}
+
+	header = m;
+	entries = (struct history_entry *) (header + 1);
+	memcpy(header->magic, HISTORY_MAGIC, sizeof(header->magic));
+	header->version = HISTORY_VERSION;
+	header->size = size;
+	for (i = 0; h->header != NULL && i < h->header->size; i++) {
+		if (h->entries[i].ptest[0] == '\0')
+			continue;
+		*history_slot(header, entries, h->entries[i].ptest) = h->entries[i];
+		header->used++;
+	}
+
+	if (rename(tmp, h->filename) == -1) {
+		munmap(m, length);
+		close(fd);
+		unlink(tmp);
+		free(tmp);
+		return -1;
+	}
+	free(tmp);
+
+	history_unmap(h);
+	close(h->fd);
+	h->fd = fd;
+	h->length = length;
+	h->header = header;
+	h->entries = entries;
+
+	return 0;
+}
+
+struct ptest_history *
+history_open(const char *filename)
+{
+	struct ptest_history *h;
+	struct stat st_buf;
+	int saved_errno;
+
+	h = calloc(1, sizeof(struct ptest_history));
+	CHECK_ALLOCATION(h, sizeof(struct ptest_history), 0);
+	if (h == NULL)
+		return NULL;
+
+	h->filename = strdup(filename);
+	CHECK_ALLOCATION(h->filename, strlen(filename), 0);
+	if (h->filename == NULL) {
+		free(h);
+		return NULL;
+	}
+
+	h->fd = open(filename, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (h->fd == -1 || history_lock(h, LOCK_EX) == -1) {
+		saved_errno = errno;
+		if (h->fd != -1)
+			close(h->fd);
+		free(h->filename);
+		free(h);
+		errno = saved_errno;
+		return NULL;
+	}
+
+	do {
+		if (fstat(h->fd, &st_buf) == -1)
+			break;
+
+		if (st_buf.st_size == 0) {
+			if (history_replace(h, HISTORY_MIN_SIZE) == -1)
+				break;
+		} else if (history_map(h) == -1) {
+			/* The runs of a broken table are lost, not the history. */
+			if (errno != EBADMSG ||
+			    history_replace(h, HISTORY_MIN_SIZE) == -1)
+				break;
+		}
+
+		flock(h->fd, LOCK_UN);
+		return h;
+	} while (0);
+
+	saved_errno = errno;
+	history_close(h);
+	errno = saved_errno;
+
+	return NULL;
+}
+
+void
+history_close(struct ptest_history *h)
+{
+	if (h == NULL)
+		return;
+
+	history_unmap(h);
+	close(h->fd);
+	free(h->filename);
+	free(h);
+}
+
+/* The returned entry is only valid until the next call on h. */
+struct history_entry *
+history_search(struct ptest_history *h, const char *ptest)
+{
+	struct history_entry *e = NULL;
+
+	if (h == NULL || ptest == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (strlen(ptest) >= HISTORY_PTEST_MAX)
+		return NULL;
+
+	if (history_lock(h, LOCK_SH) == -1)
+		return NULL;
+	if (history_sync(h) == 0) {
+		e = history_slot(h->header, h->entries, ptest);
+		if (e->ptest[0] == '\0')
+			e = NULL;
+	}
+	flock(h->fd, LOCK_UN);
+
+	return e;
+}
+
+int
+history_add(struct ptest_history *h, const char *ptest, unsigned int duration,
+		int status, int timeouted)
+{
+	struct history_entry *e;
+	struct history_run *r;
+	int rc = -1;
+
+	if (h == NULL || ptest == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (strlen(ptest) >= HISTORY_PTEST_MAX) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	if (history_lock(h, LOCK_EX) == -1)
+		return -1;
+	do {
+		if (history_sync(h) == -1)
+			break;
+
+		e = history_slot(h->header, h->entries, ptest);
+		if (e->ptest[0] == '\0') {
+			/* Keep the load factor under 3/4. */
+			if ((h->header->used + 1) * 4 > h->header->size * 3) {
+				if (history_replace(h, h->header->size * 2) == -1)
+					break;
+				e = history_slot(h->header, h->entries, ptest);
+			}
+
+			strcpy(e->ptest, ptest);
+			h->header->used++;
+		}
+
+		r = &e->run[e->runs % HISTORY_RUNS];
+		r->duration = duration;
+		r->status = status;
+		r->timeouted = (uint32_t) timeouted;
+		e->runs++;
+
+		rc = 0;
+	} while (0);
+	flock(h->fd, LOCK_UN);
+
+	return rc;
+}
+
+const struct history_run *
+history_last(const struct history_entry *e)
+{
+	if (e == NULL || e->runs == 0)
+		return NULL;
+
+	return &e->run[(e->runs - 1) % HISTORY_RUNS];
+}
+
+/* Mean duration in milliseconds of the recorded runs, -1 without history. */
+long
+history_expected_duration(struct ptest_history *h, const char *ptest)
+{
+	struct history_entry *e;
+	unsigned long total = 0;
+	uint32_t i, n;
+
+	e = history_search(h, ptest);
+	if (e == NULL || e->runs == 0)
+		return -1;
+
+	n = e->runs < HISTORY_RUNS ? e->runs : HISTORY_RUNS;
+	for (i = 0; i < n; i++)
+		total += e->run[i].duration;
+
+	return (long) (total / n);
+}
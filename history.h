@@ -0,0 +1,81 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+#ifndef PTEST_RUNNER_HISTORY_H
+#define PTEST_RUNNER_HISTORY_H
+
+#include <stdint.h>
+
+#define HISTORY_MAGIC "PTESTHST"
+#define HISTORY_VERSION 1
+#define HISTORY_RUNS 8
+#define HISTORY_PTEST_MAX 112
+#define HISTORY_MIN_SIZE 64
+
+/* *
+ * The history file is a hash table of fixed size entries keyed by the
+ * ptest name, it's mapped in memory so opening it doesn't depend on the
+ * number of ptests recorded. Every entry keeps the last HISTORY_RUNS
+ * runs in a ring. Growing the table writes a new file renamed over the
+ * old one, runners sharing it follow the rename.
+ * */
+struct history_run {
+	uint32_t duration; /* milliseconds */
+	int32_t status;
+	uint32_t timeouted;
+	uint32_t padding1;
+};
+
+struct history_entry {
+	char ptest[HISTORY_PTEST_MAX];
+	uint32_t runs; /* total runs recorded, last one at (runs - 1) % HISTORY_RUNS */
+	uint32_t padding1;
+	struct history_run run[HISTORY_RUNS];
+};
+
+struct history_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t size;
+	uint32_t used;
+	uint32_t padding1;
+};
+
+struct ptest_history {
+	int fd;
+	int padding1;
+	size_t length;
+	struct history_header *header;
+	struct history_entry *entries;
+	char *filename;
+};
+
+extern struct ptest_history *history_open(const char *);
+extern void history_close(struct ptest_history *);
+
+extern struct history_entry *history_search(struct ptest_history *, const char *);
+extern int history_add(struct ptest_history *, const char *, unsigned int, int, int);
+extern const struct history_run *history_last(const struct history_entry *);
+extern long history_expected_duration(struct ptest_history *, const char *);
+
+#endif // PTEST_RUNNER_HISTORY_H
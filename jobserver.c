@@ -0,0 +1,166 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "jobserver.h"
+#include "spawn.h"
+#include "utils.h"
+
+#define JOBSERVER_TOKEN '+'
+
+/* Above the fds the ptests get them as, see spawn_child(). */
+#define JOBSERVER_MIN_FD (SPAWN_JOBSERVER_FD + 2)
+
+static int
+move_fd(int fd)
+{
+	int new_fd;
+
+	if (fd >= JOBSERVER_MIN_FD)
+		return fd;
+
+	new_fd = fcntl(fd, F_DUPFD_CLOEXEC, JOBSERVER_MIN_FD);
+	close(fd);
+
+	return new_fd;
+}
+
+struct ptest_jobserver *
+jobserver_open(int jobs)
+{
+	struct ptest_jobserver *js;
+	char token = JOBSERVER_TOKEN;
+	char path[64];
+	char *makeflags;
+	const char *old;
+	int i;
+
+	js = calloc(1, sizeof(struct ptest_jobserver));
+	CHECK_ALLOCATION(js, sizeof(struct ptest_jobserver), 0);
+	if (js == NULL)
+		return NULL;
+	js->fds[0] = js->fds[1] = js->fd_read = -1;
+
+	do {
+		if (pipe2(js->fds, O_CLOEXEC) == -1)
+			break;
+
+		js->fds[0] = move_fd(js->fds[0]);
+		js->fds[1] = move_fd(js->fds[1]);
+		if (js->fds[0] == -1 || js->fds[1] == -1)
+			break;
+
+		for (i = 1; i < jobs; i++) {
+			if (write(js->fds[1], &token, 1) != 1)
+				break;
+		}
+		if (i < jobs)
+			break;
+
+		/* *
+		 * Reopening the pipe gives the runner its own file description
+		 * so it can read without blocking while the makes keep reading
+		 * the way they expect. Without /proc there's no jobserver, the
+		 * O_NONBLOCK of a dup would be seen by the makes as well.
+		 * */
+		snprintf(path, sizeof(path), "/proc/self/fd/%d", js->fds[0]);
+		js->fd_read = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		if (js->fd_read == -1)
+			break;
+
+		old = getenv("MAKEFLAGS");
+		if (old != NULL) {
+			js->makeflags = strdup(old);
+			CHECK_ALLOCATION(js->makeflags, strlen(old), 0);
+			if (js->makeflags == NULL)
+				break;
+		}
+
+		/* make uses the last jobserver given, a ptest-runner run from
+		 * make keeps the rest of the flags. */
+		if (asprintf(&makeflags, "%s -j%d --jobserver-auth=%d,%d",
+		    old != NULL ? old : "", jobs, SPAWN_JOBSERVER_FD,
+		    SPAWN_JOBSERVER_FD + 1) == -1)
+			break;
+		i = setenv("MAKEFLAGS", makeflags, 1);
+		free(makeflags);
+		if (i == -1)
+			break;
+		js->env_set = 1;
+
+		return js;
+	} while (0);
+
+	i = errno;
+	jobserver_close(js);
+	errno = i;
+
+	return NULL;
+}
+
+void
+jobserver_close(struct ptest_jobserver *js)
+{
+	if (js == NULL)
+		return;
+
+	if (js->env_set && js->makeflags != NULL)
+		setenv("MAKEFLAGS", js->makeflags, 1);
+	else if (js->env_set)
+		unsetenv("MAKEFLAGS");
+
+	if (js->fds[0] != -1)
+		close(js->fds[0]);
+	if (js->fds[1] != -1)
+		close(js->fds[1]);
+	if (js->fd_read != -1)
+		close(js->fd_read);
+	free(js->makeflags);
+	free(js);
+}
+
+/* Returns 1 with a token taken, 0 when there is none left. */
+int
+jobserver_acquire(struct ptest_jobserver *js)
+{
+	char token;
+
+	return read(js->fd_read, &token, 1) == 1;
+}
+
+void
+jobserver_release(struct ptest_jobserver *js)
+{
+	char token = JOBSERVER_TOKEN;
+
+	while (write(js->fds[1], &token, 1) == -1 && errno == EINTR)
+		;
+}
@@ -0,0 +1,47 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+
+#ifndef PTEST_RUNNER_JOBSERVER_H
+#define PTEST_RUNNER_JOBSERVER_H
+
+/* *
+ * GNU make jobserver shared by the ptests, a pipe with a token for every
+ * job but one. The runner takes a token for every ptest it runs besides
+ * the first and the makes run by the ptests take the rest, so the ptests
+ * and their makes keep -j jobs busy in total.
+ * */
+struct ptest_jobserver {
+	int fds[2];	/* given to the ptests */
+	int fd_read;	/* non blocking read end of the runner */
+	int env_set;
+	char *makeflags;	/* MAKEFLAGS of the runner, restored on close */
+};
+
+extern struct ptest_jobserver *jobserver_open(int);
+extern void jobserver_close(struct ptest_jobserver *);
+
+extern int jobserver_acquire(struct ptest_jobserver *);
+extern void jobserver_release(struct ptest_jobserver *);
+
+#endif // PTEST_RUNNER_JOBSERVER_H
@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
+#include <getopt.h>
 
 #ifdef MEMCHECK
 #ifdef RELEASE
@@ -37,18 +38,152 @@
 #include <mcheck.h>
 #endif
 
+#include "cache.h"
+#include "conf.h"
+#include "sampler.h"
+#include "trace.h"
 #include "utils.h"
 
 #ifndef DEFAULT_DIRECTORY
 #define DEFAULT_DIRECTORY "/usr/lib"
 #endif
 #define DEFAULT_TIMEOUT 300
+#define DEFAULT_GRACE 5
+#define DEFAULT_COLLECT_TIMEOUT 10
+#define DEFAULT_SAMPLE_INTERVAL SAMPLER_DEFAULT_INTERVAL_MS
+
+/* Long only options, out of the range of the short ones. */
+enum {
+	OPT_HISTORY = 256,
+	OPT_ORDER,
+	OPT_CACHE,
+	OPT_SHARD,
+	OPT_QUEUE,
+	OPT_JOBSERVER,
+	OPT_MAX_PRESSURE,
+	OPT_MIN_AVAILABLE,
+	OPT_MAX_DURATION,
+	OPT_BUDGET,
+	OPT_GRACE,
+	OPT_COLLECT_TIMEOUT,
+	OPT_CGROUP,
+	OPT_SAMPLES,
+	OPT_SAMPLE_INTERVAL,
+	OPT_TRACE,
+	OPT_STATS,
+};
+
+static const struct option long_options[] = {
+	{"history", required_argument, NULL, OPT_HISTORY},
+	{"order", required_argument, NULL, OPT_ORDER},
+	{"cache", required_argument, NULL, OPT_CACHE},
+	{"shard", required_argument, NULL, OPT_SHARD},
+	{"queue", required_argument, NULL, OPT_QUEUE},
+	{"jobserver", no_argument, NULL, OPT_JOBSERVER},
+	{"max-pressure", required_argument, NULL, OPT_MAX_PRESSURE},
+	{"min-available", required_argument, NULL, OPT_MIN_AVAILABLE},
+	{"max-duration", required_argument, NULL, OPT_MAX_DURATION},
+	{"budget", required_argument, NULL, OPT_BUDGET},
+	{"grace", required_argument, NULL, OPT_GRACE},
+	{"collect-timeout", required_argument, NULL, OPT_COLLECT_TIMEOUT},
+	{"cgroup", optional_argument, NULL, OPT_CGROUP},
+	{"samples", required_argument, NULL, OPT_SAMPLES},
+	{"sample-interval", required_argument, NULL, OPT_SAMPLE_INTERVAL},
+	{"trace", required_argument, NULL, OPT_TRACE},
+	{"stats", optional_argument, NULL, OPT_STATS},
+	{NULL, 0, NULL, 0},
+};
 
 static inline void
 print_usage(FILE *stream, char *progname)
 {
-	fprintf(stream, "Usage: %s [-d directory directory2 ...] [-e exclude] [-l list] [-t timeout]"
-			" [-x xml-filename] [-h] [ptest1 ptest2 ...]\n", progname);
+	fprintf(stream, "Usage: %s [-d directory directory2 ...] [-e exclude] [-j jobs] [-l list]"
+			" [-o log-directory] [-t timeout] [-x xml-filename] [--history history-file]"
+			" [--order alphabetical|longest-first|shortest-first] [--cache cache-file]"
+			" [--shard index/count] [--queue queue-directory] [--jobserver]"
+			" [--max-pressure cpu=N,memory=N,io=N] [--min-available size]"
+			" [--max-duration seconds] [--budget seconds]"
+			" [--grace seconds] [--collect-timeout seconds]"
+			" [--cgroup[=memory=size,cpu=N,pids=N]] [--samples directory]"
+			" [--sample-interval ms] [--trace trace-file] [--stats[=json-file]] [-h]"
+			" [ptest1 ptest2 ...]\n", progname);
+}
+
+/* cpu=N,memory=N,io=N, every one optional, in percent. */
+static int
+parse_pressure(const char *arg, unsigned int *max_pressure)
+{
+	static const char *const names[] = { "cpu", "memory", "io" };
+	char *str, *tok, *saveptr, *end;
+	unsigned long n;
+	size_t len;
+	int i, rc = 0;
+
+	str = strdup(arg);
+	CHECK_ALLOCATION(str, strlen(arg), 1);
+
+	for (tok = strtok_r(str, ",", &saveptr); tok != NULL && rc == 0;
+	     tok = strtok_r(NULL, ",", &saveptr)) {
+		for (i = 0; i < 3; i++) {
+			len = strlen(names[i]);
+			if (strncmp(tok, names[i], len) == 0 && tok[len] == '=')
+				break;
+		}
+		if (i == 3) {
+			rc = -1;
+			break;
+		}
+
+		n = strtoul(tok + len + 1, &end, 10);
+		if (end == tok + len + 1 || *end != '\0' || n > 100)
+			rc = -1;
+		else
+			max_pressure[i] = (unsigned int) n;
+	}
+
+	free(str);
+	return rc;
+}
+
+/* memory=size,cpu=N,pids=N, every one optional, cpu in percent of a CPU. */
+static int
+parse_cgroup(const char *arg, struct ptest_options *opts)
+{
+	char *str, *tok, *saveptr, *value, *end;
+	unsigned long n;
+	int rc = 0;
+
+	str = strdup(arg);
+	CHECK_ALLOCATION(str, strlen(arg), 1);
+
+	for (tok = strtok_r(str, ",", &saveptr); tok != NULL && rc == 0;
+	     tok = strtok_r(NULL, ",", &saveptr)) {
+		value = strchr(tok, '=');
+		if (value == NULL) {
+			rc = -1;
+			break;
+		}
+		*value++ = '\0';
+
+		if (strcmp(tok, "memory") == 0) {
+			if (conf_parse_size(value, &opts->cgroup_memory_max) == -1)
+				rc = -1;
+			continue;
+		}
+
+		n = strtoul(value, &end, 10);
+		if (end == value || *end != '\0' || n > UINT_MAX / 1000)
+			rc = -1;
+		else if (strcmp(tok, "cpu") == 0)
+			opts->cgroup_cpu_max = (unsigned int) n;
+		else if (strcmp(tok, "pids") == 0)
+			opts->cgroup_pids_max = (unsigned int) n;
+		else
+			rc = -1;
+	}
+
+	free(str);
+	return rc;
 }
 
 static char **
@@ -102,6 +237,41 @@ cleanup_ptest_opts(struct ptest_options *opts)
 		free(opts->xml_filename);
 		opts->xml_filename = NULL;
 	}
+
+	if (opts->history_filename) {
+		free(opts->history_filename);
+		opts->history_filename = NULL;
+	}
+
+	if (opts->log_dir) {
+		free(opts->log_dir);
+		opts->log_dir = NULL;
+	}
+
+	if (opts->cache_filename) {
+		free(opts->cache_filename);
+		opts->cache_filename = NULL;
+	}
+
+	if (opts->queue_dir) {
+		free(opts->queue_dir);
+		opts->queue_dir = NULL;
+	}
+
+	if (opts->samples_dir) {
+		free(opts->samples_dir);
+		opts->samples_dir = NULL;
+	}
+
+	if (opts->trace_filename) {
+		free(opts->trace_filename);
+		opts->trace_filename = NULL;
+	}
+
+	if (opts->stats_filename) {
+		free(opts->stats_filename);
+		opts->stats_filename = NULL;
+	}
 }
 
 int
@@ -118,6 +288,9 @@ main(int argc, char *argv[])
 #endif
 
 	struct ptest_list *head, *run;
+	struct ptest_list **heads;
+	struct ptest_cache *cache = NULL;
+	struct timespec phase;
 	__attribute__ ((__cleanup__(cleanup_ptest_opts))) struct ptest_options opts;
 
 	opts.dirs = malloc(sizeof(char **) * 1);
@@ -130,8 +303,32 @@ main(int argc, char *argv[])
 	opts.timeout = DEFAULT_TIMEOUT;
 	opts.ptests = NULL;
 	opts.xml_filename = NULL;
-
-	while ((opt = getopt(argc, argv, "d:e:lt:x:h")) != -1) {
+	opts.jobs = 1;
+	opts.history_filename = NULL;
+	opts.order = PTEST_ORDER_DEFAULT;
+	opts.log_dir = NULL;
+	opts.cache_filename = NULL;
+	opts.shard_index = 0;
+	opts.shard_count = 0;
+	opts.queue_dir = NULL;
+	opts.jobserver = 0;
+	memset(opts.max_pressure, 0, sizeof(opts.max_pressure));
+	opts.min_available = 0;
+	opts.max_duration = 0;
+	opts.budget = 0;
+	opts.grace = DEFAULT_GRACE;
+	opts.collect_timeout = DEFAULT_COLLECT_TIMEOUT;
+	opts.cgroup = 0;
+	opts.cgroup_cpu_max = 0;
+	opts.cgroup_memory_max = 0;
+	opts.cgroup_pids_max = 0;
+	opts.samples_dir = NULL;
+	opts.sample_interval = DEFAULT_SAMPLE_INTERVAL;
+	opts.trace_filename = NULL;
+	opts.stats = 0;
+	opts.stats_filename = NULL;
+
+	while ((opt = getopt_long(argc, argv, "d:e:j:lo:t:x:h", long_options, NULL)) != -1) {
 		switch (opt) {
 			case 'd':
 				free(opts.dirs[0]);
@@ -141,9 +338,21 @@ main(int argc, char *argv[])
 			case 'e':
 				opts.exclude = str2array(optarg, " ", &ptest_exclude_num);
 			break;
+			case 'j':
+				opts.jobs = atoi(optarg);
+				if (opts.jobs < 1) {
+					fprintf(stderr, "Invalid number of jobs, %s.\n", optarg);
+					exit(1);
+				}
+			break;
 			case 'l':
 				opts.list = 1;
 			break;
+			case 'o':
+				free(opts.log_dir);
+				opts.log_dir = strdup(optarg);
+				CHECK_ALLOCATION(opts.log_dir, 1, 1);
+			break;
 			case 't':
 				opts.timeout = (unsigned int) atoi(optarg);
 			break;
@@ -156,6 +365,105 @@ main(int argc, char *argv[])
 				opts.xml_filename = strdup(optarg);
 				CHECK_ALLOCATION(opts.xml_filename, 1, 1);
 			break;
+			case OPT_HISTORY:
+				free(opts.history_filename);
+				opts.history_filename = strdup(optarg);
+				CHECK_ALLOCATION(opts.history_filename, 1, 1);
+			break;
+			case OPT_CACHE:
+				free(opts.cache_filename);
+				opts.cache_filename = strdup(optarg);
+				CHECK_ALLOCATION(opts.cache_filename, 1, 1);
+			break;
+			case OPT_ORDER:
+				if (strcmp(optarg, "alphabetical") == 0)
+					opts.order = PTEST_ORDER_DEFAULT;
+				else if (strcmp(optarg, "longest-first") == 0)
+					opts.order = PTEST_ORDER_LONGEST_FIRST;
+				else if (strcmp(optarg, "shortest-first") == 0)
+					opts.order = PTEST_ORDER_SHORTEST_FIRST;
+				else {
+					fprintf(stderr, "Invalid order, %s.\n", optarg);
+					exit(1);
+				}
+			break;
+			case OPT_MAX_PRESSURE:
+				if (parse_pressure(optarg, opts.max_pressure) == -1) {
+					fprintf(stderr, "Invalid pressure limits, %s.\n", optarg);
+					exit(1);
+				}
+			break;
+			case OPT_MIN_AVAILABLE:
+				if (conf_parse_size(optarg, &opts.min_available) == -1) {
+					fprintf(stderr, "Invalid available memory, %s.\n", optarg);
+					exit(1);
+				}
+			break;
+			case OPT_MAX_DURATION:
+				opts.max_duration = (unsigned int) atoi(optarg);
+			break;
+			case OPT_BUDGET:
+				opts.budget = (unsigned int) atoi(optarg);
+			break;
+			case OPT_GRACE:
+				opts.grace = (unsigned int) atoi(optarg);
+			break;
+			case OPT_COLLECT_TIMEOUT:
+				opts.collect_timeout = (unsigned int) atoi(optarg);
+			break;
+			case OPT_CGROUP:
+				opts.cgroup = 1;
+				if (optarg != NULL && parse_cgroup(optarg, &opts) == -1) {
+					fprintf(stderr, "Invalid cgroup limits, %s.\n", optarg);
+					exit(1);
+				}
+			break;
+			case OPT_SAMPLES:
+				free(opts.samples_dir);
+				opts.samples_dir = strdup(optarg);
+				CHECK_ALLOCATION(opts.samples_dir, 1, 1);
+			break;
+			case OPT_SAMPLE_INTERVAL:
+				opts.sample_interval = (unsigned int) atoi(optarg);
+				if (opts.sample_interval == 0) {
+					fprintf(stderr, "Invalid sample interval, %s.\n", optarg);
+					exit(1);
+				}
+			break;
+			case OPT_TRACE:
+				free(opts.trace_filename);
+				opts.trace_filename = strdup(optarg);
+				CHECK_ALLOCATION(opts.trace_filename, 1, 1);
+			break;
+			case OPT_STATS:
+				opts.stats = 1;
+				if (optarg != NULL) {
+					free(opts.stats_filename);
+					opts.stats_filename = strdup(optarg);
+					CHECK_ALLOCATION(opts.stats_filename, 1, 1);
+				}
+			break;
+			case OPT_JOBSERVER:
+				opts.jobserver = 1;
+			break;
+			case OPT_QUEUE:
+				free(opts.queue_dir);
+				opts.queue_dir = strdup(optarg);
+				CHECK_ALLOCATION(opts.queue_dir, 1, 1);
+			break;
+			case OPT_SHARD: {
+				char c;
+
+				if (sscanf(optarg, "%d/%d%c", &opts.shard_index,
+				    &opts.shard_count, &c) != 2 ||
+				    opts.shard_count < 1 || opts.shard_index < 1 ||
+				    opts.shard_index > opts.shard_count) {
+					fprintf(stderr, "Invalid shard, %s.\n", optarg);
+					exit(1);
+				}
+				opts.shard_index--;
+			}
+			break;
 			default:
 				print_usage(stdout, argv[0]);
 				exit(1);
@@ -174,11 +482,36 @@ main(int argc, char *argv[])
 		}
 	}
 
+	/* A trace file that can't be written doesn't stop the run. */
+	if (opts.trace_filename) {
+		if (trace_open(opts.trace_filename) == 0)
+			atexit(trace_close);
+		else
+			fprintf(stderr, "Trace file %s could not be created, %s.\n",
+				opts.trace_filename, strerror(errno));
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &phase);
+	heads = calloc((size_t) opts.dirs_no, sizeof(struct ptest_list *));
+	CHECK_ALLOCATION(heads, (size_t) opts.dirs_no, 1);
+	if (opts.cache_filename != NULL) {
+		cache = cache_open(opts.cache_filename);
+		CHECK_ALLOCATION(cache, sizeof(struct ptest_cache), 1);
+	}
+	get_available_ptests_dirs(opts.dirs, opts.dirs_no, heads, cache);
+	if (cache != NULL) {
+		if (cache_write(cache) == -1)
+			fprintf(stderr, "Warning: can't write the cache %s, %s.\n",
+					opts.cache_filename, strerror(errno));
+		cache_close(cache);
+	}
+	trace_spanf(trace_tid(), "runner", "discovery", &phase, "\"dirs\":%d", opts.dirs_no);
+
 	head = NULL;
 	for (i = 0; i < opts.dirs_no; i ++) {
 		struct ptest_list *tmp;
 
-		tmp = get_available_ptests(opts.dirs[i]);
+		tmp = heads[i];
 		if (tmp == NULL) {
 			fprintf(stderr, PRINT_PTESTS_NOT_FOUND_DIR, opts.dirs[i]);
 			continue;
@@ -190,6 +523,7 @@ main(int argc, char *argv[])
 		else
 			head = ptest_list_extend(head, tmp);
 	}
+	free(heads);
 	if (head == NULL || ptest_list_length(head) == 0) {
 		fprintf(stderr, PRINT_PTESTS_NOT_FOUND);
 			return 1;
@@ -200,6 +534,7 @@ main(int argc, char *argv[])
 		return 0;
 	}
 
+	clock_gettime(CLOCK_MONOTONIC, &phase);
 	run = head;
 	if (ptest_num > 0) {
 		for (i = 0; i < ptest_num; i++) {
@@ -218,6 +553,21 @@ main(int argc, char *argv[])
 	for (i = 0; i < ptest_exclude_num; i++)
 		ptest_list_remove(run, opts.exclude[i], 1);
 
+	if (opts.shard_count > 0 && shard_ptests(run, opts) == -1) {
+		fprintf(stderr, "Unable to shard the ptests, %s.\n", strerror(errno));
+		ptest_list_free_all(run);
+		return 1;
+	}
+
+	if (sort_ptests(run, opts) == -1) {
+		fprintf(stderr, "Unable to sort the ptests, %s.\n", strerror(errno));
+		ptest_list_free_all(run);
+		return 1;
+	}
+
+	trace_spanf(trace_tid(), "runner", "filtering", &phase, "\"ptests\":%d",
+		ptest_list_length(run));
+
 	rc = run_ptests(run, opts, argv[0], stdout, stderr);
 
 	ptest_list_free_all(run);
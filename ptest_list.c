@@ -26,6 +26,7 @@
 #include <stdio.h>
 #include <errno.h>
 
+#include "conf.h"
 #include "utils.h"
 #include "ptest_list.h"
 
@@ -45,17 +46,184 @@
 		} \
 	} while (0)
 
+
+#define INDEX_MIN_SIZE 64
+
+struct ptest_list_index {
+	struct ptest_list *tail;
+	int length;
+	int pending; /* nodes whose run-ptest isn't stat'ed yet */
+	size_t size; /* buckets, power of two */
+	struct ptest_list **names;
+	struct ptest_list **files;
+};
+
+static size_t
+hash_name(const char *ptest)
+{
+	size_t h = 5381;
+
+	for (; *ptest; ptest++)
+		h = h * 33 + (unsigned char) *ptest;
+
+	return h;
+}
+
+static size_t
+hash_file(dev_t dev, ino_t ino)
+{
+	return (size_t) (ino * 2654435761u) ^ (size_t) dev;
+}
+
+static void
+index_insert_file(struct ptest_list_index *idx, struct ptest_list *n)
+{
+	struct ptest_list **b;
+
+	b = &idx->files[hash_file(n->st_dev, n->st_ino) & (idx->size - 1)];
+	n->file_next = *b;
+	*b = n;
+}
+
+static void
+index_insert(struct ptest_list_index *idx, struct ptest_list *n)
+{
+	struct ptest_list **b;
+
+	if (n->ptest != NULL) {
+		/* Append to keep the first node added with a name in front. */
+		for (b = &idx->names[hash_name(n->ptest) & (idx->size - 1)];
+		     *b != NULL; b = &(*b)->name_next);
+		*b = n;
+	}
+
+	if (n->st_state == 1)
+		index_insert_file(idx, n);
+}
+
+static void
+index_delete(struct ptest_list_index *idx, struct ptest_list *n)
+{
+	struct ptest_list **b;
+
+	if (n->ptest != NULL) {
+		for (b = &idx->names[hash_name(n->ptest) & (idx->size - 1)];
+		     *b != NULL; b = &(*b)->name_next) {
+			if (*b == n) {
+				*b = n->name_next;
+				break;
+			}
+		}
+	}
+
+	if (n->st_state == 1) {
+		for (b = &idx->files[hash_file(n->st_dev, n->st_ino) & (idx->size - 1)];
+		     *b != NULL; b = &(*b)->file_next) {
+			if (*b == n) {
+				*b = n->file_next;
+				break;
+			}
+		}
+	} else if (n->st_state == 0)
+		idx->pending--;
+
+	n->name_next = NULL;
+	n->file_next = NULL;
+}
+
+static int
+index_resize(struct ptest_list *head, size_t size)
+{
+	struct ptest_list_index *idx = head->index;
+	struct ptest_list **names, **files;
+	struct ptest_list *p;
+
+	names = calloc(size, sizeof(struct ptest_list *));
+	files = calloc(size, sizeof(struct ptest_list *));
+	if (names == NULL || files == NULL) {
+		free(names);
+		free(files);
+		return -1;
+	}
+
+	free(idx->names);
+	free(idx->files);
+	idx->names = names;
+	idx->files = files;
+	idx->size = size;
+
+	for (p = head->next; p != NULL; p = p->next) {
+		p->name_next = NULL;
+		p->file_next = NULL;
+		index_insert(idx, p);
+	}
+
+	return 0;
+}
+
+/* The index of a head is created by the first node added. */
+static struct ptest_list_index *
+index_get(struct ptest_list *head)
+{
+	struct ptest_list_index *idx = head->index;
+
+	if (idx != NULL)
+		return idx;
+
+	idx = calloc(1, sizeof(struct ptest_list_index));
+	CHECK_ALLOCATION(idx, sizeof(struct ptest_list_index), 0);
+	if (idx == NULL)
+		return NULL;
+
+	idx->tail = head;
+	head->index = idx;
+	if (index_resize(head, INDEX_MIN_SIZE) == -1) {
+		free(idx);
+		head->index = NULL;
+		return NULL;
+	}
+
+	return idx;
+}
+
+/* Fills the file hash with the nodes added without a stat. */
+static void
+index_stat_pending(struct ptest_list *head)
+{
+	struct ptest_list_index *idx = head->index;
+	struct ptest_list *p;
+	struct stat st_buf;
+
+	for (p = head->next; p != NULL && idx->pending > 0; p = p->next) {
+		if (p->st_state != 0)
+			continue;
+
+		idx->pending--;
+		if (p->run_ptest == NULL || stat(p->run_ptest, &st_buf) == -1) {
+			p->st_state = -1;
+			continue;
+		}
+
+		p->st_dev = st_buf.st_dev;
+		p->st_ino = st_buf.st_ino;
+		p->st_state = 1;
+		index_insert_file(idx, p);
+	}
+}
+
 struct ptest_list *
 ptest_list_alloc()
 {
-	struct ptest_list *p = malloc(sizeof(struct ptest_list));
+	struct ptest_list *p = calloc(1, sizeof(struct ptest_list));
 	CHECK_ALLOCATION(p, sizeof(struct ptest_list), 0);
 	if (p != NULL) {
 		p->ptest = NULL;
 		p->run_ptest = NULL;
+		p->duration = -1;
 
 		p->next = NULL;
 		p->prev = NULL;
+		p->index = NULL;
 	}
 
 	return p;
@@ -64,6 +232,12 @@ ptest_list_alloc()
 void
 ptest_list_free(struct ptest_list *p)
 {
+	if (p->index != NULL) {
+		free(p->index->names);
+		free(p->index->files);
+		free(p->index);
+	}
+	conf_free(p->conf);
 	free(p->ptest);
 	free(p->run_ptest);
 	free(p);
@@ -92,83 +266,93 @@ ptest_list_free_all(struct ptest_list *head)
 int
 ptest_list_length(struct ptest_list *head)
 {
-	int i = 0;
-	struct ptest_list *p;
-
 	VALIDATE_PTR_RINT(head);
 
-	for (p = head->next; p != NULL; p = p->next)
-		i++;
-
-	return i;
+	return head->index != NULL ? head->index->length : 0;
 }
 
 struct ptest_list *
 ptest_list_search(struct ptest_list *head, char *ptest)
 {
-	struct ptest_list *q = NULL;
 	struct ptest_list *p;
 
 	VALIDATE_PTR_RNULL(head);
 	VALIDATE_PTR_RNULL(ptest);
 
-	for (p = head; p != NULL; p = p->next) {
-		if (p->ptest == NULL) 
-			continue;
+	if (head->index == NULL)
+		return NULL;
 
-		if (strcmp(p->ptest, ptest) == 0) {
-			q = p;
+	for (p = head->index->names[hash_name(ptest) & (head->index->size - 1)];
+	     p != NULL; p = p->name_next) {
+		if (strcmp(p->ptest, ptest) == 0)
 			break;
-		}
 	}
 
-	return q;
+	return p;
 }
 
 
 struct ptest_list *
 ptest_list_search_by_file(struct ptest_list *head, char *run_ptest, struct stat st_buf)
 {
-	struct ptest_list *q = NULL;
 	struct ptest_list *p;
-	struct stat st_buf_p;
 
 	VALIDATE_PTR_RNULL(head);
 	VALIDATE_PTR_RNULL(run_ptest);
 
-	for (p = head; p != NULL; p = p->next) {
-		if (p->ptest == NULL) 
-			continue;
-
-		if (stat(p->run_ptest, &st_buf_p) == -1)
-			continue;
-
-		if (strcmp(p->run_ptest, run_ptest) == 0) {
-			q = p;
-			break;
-		}
+	if (head->index == NULL)
+		return NULL;
 
-		/* *
-		 * In some ptest packages exists symlink in the ptest directory
-		 * causing to load/run twice the same ptest, 
-		 *
-		 * For example in perl5:
-		 * /usr/lib/perl -> /usr/lib/perl5
-		 * */
-		if (st_buf.st_dev == st_buf_p.st_dev &&
-		    st_buf.st_ino == st_buf_p.st_ino) {
-			q = p;
+	if (head->index->pending > 0)
+		index_stat_pending(head);
+
+	/* *
+	 * In some ptest packages exists symlink in the ptest directory
+	 * causing to load/run twice the same ptest, 
+	 *
+	 * For example in perl5:
+	 * /usr/lib/perl -> /usr/lib/perl5
+	 * */
+	for (p = head->index->files[hash_file(st_buf.st_dev, st_buf.st_ino) &
+	     (head->index->size - 1)]; p != NULL; p = p->file_next) {
+		if (st_buf.st_dev == p->st_dev && st_buf.st_ino == p->st_ino)
 			break;
-		}
 	}
 
-	return q;
+	return p;
+}
+
+static struct ptest_list *
+list_append(struct ptest_list *head, struct ptest_list *n)
+{
+	struct ptest_list_index *idx;
+
+	idx = index_get(head);
+	if (idx == NULL)
+		return NULL;
+
+	/* Keep the load factor of the hashes under 1. */
+	if ((size_t) idx->length + 1 > idx->size &&
+	    index_resize(head, idx->size * 2) == -1)
+		return NULL;
+
+	n->prev = idx->tail;
+	n->next = NULL;
+	idx->tail->next = n;
+	idx->tail = n;
+	idx->length++;
+
+	if (n->st_state == 0)
+		idx->pending++;
+	index_insert(idx, n);
+
+	return n;
 }
 
 struct ptest_list *
 ptest_list_add(struct ptest_list *head, char *ptest, char *run_ptest)
 {
-	struct ptest_list *n, *p; 
+	struct ptest_list *n; 
 
 	VALIDATE_PTR_RNULL(head);
 	VALIDATE_PTR_RNULL(ptest);
@@ -179,14 +363,42 @@ ptest_list_add(struct ptest_list *head, char *ptest, char *run_ptest)
 
 	n->ptest = ptest;
 	n->run_ptest = run_ptest;
+	n->st_state = run_ptest != NULL ? 0 : -1;
 
-	n->prev = NULL;
-	n->next = NULL;
+	if (list_append(head, n) == NULL) {
+		/* The strings stay owned by the caller on failure. */
+		free(n);
+		return NULL;
+	}
 
-	for (p = head; p->next != NULL; p = p->next);
+	return n;
+}
+
+/* Like ptest_list_add() with the stat of run_ptest the caller already
+ * has, so the node doesn't need to be stat'ed again. */
+struct ptest_list *
+ptest_list_add_by_file(struct ptest_list *head, char *ptest, char *run_ptest,
+		struct stat st_buf)
+{
+	struct ptest_list *n; 
 
-	n->prev = p;
-	p->next = n;
+	VALIDATE_PTR_RNULL(head);
+	VALIDATE_PTR_RNULL(ptest);
+
+	n = ptest_list_alloc();
+	if (n == NULL)
+		return NULL;
+
+	n->ptest = ptest;
+	n->run_ptest = run_ptest;
+	n->st_dev = st_buf.st_dev;
+	n->st_ino = st_buf.st_ino;
+	n->st_state = 1;
+
+	if (list_append(head, n) == NULL) {
+		free(n);
+		return NULL;
+	}
 
 	return n;
 }
@@ -207,6 +419,15 @@ ptest_list_remove(struct ptest_list *head, char *ptest, int free)
 		r = p->next;
 
 		q->next = r;
+		if (r != NULL)
+			r->prev = q;
+		else
+			head->index->tail = q;
+
+		head->index->length--;
+		index_delete(head->index, p);
+		p->next = NULL;
+		p->prev = NULL;
 
 		if (free) {
 			ptest_list_free(p);
@@ -225,11 +446,70 @@ ptest_list_extend(struct ptest_list *head, struct ptest_list *extend)
 	VALIDATE_PTR_RNULL(head);
 	VALIDATE_PTR_RNULL(extend);
 
-	for (p = head; p->next != NULL; p = p->next);
-	q = extend->next;
-	p->next = q;
+	for (p = extend->next; p != NULL; p = q) {
+		q = p->next;
+		p->name_next = NULL;
+		p->file_next = NULL;
+		if (list_append(head, p) == NULL) {
+			/* Keep the rest in extend so it's not leaked. */
+			extend->next = p;
+			p->prev = extend;
+			return NULL;
+		}
+	}
 
-	free(extend);
+	extend->next = NULL;
+	ptest_list_free(extend);
 
 	return head;
 }
+
+static int (*ptest_list_cmp)(const struct ptest_list *, const struct ptest_list *);
+
+static int
+ptest_list_qsort_cmp(const void *a, const void *b)
+{
+	return ptest_list_cmp(*(struct ptest_list * const *) a,
+			*(struct ptest_list * const *) b);
+}
+
+int
+ptest_list_sort(struct ptest_list *head,
+		int (*cmp)(const struct ptest_list *, const struct ptest_list *))
+{
+	struct ptest_list **nodes;
+	struct ptest_list *p;
+	int i, n;
+
+	VALIDATE_PTR_RINT(head);
+	VALIDATE_PTR_RINT(cmp);
+
+	n = ptest_list_length(head);
+	if (n < 2)
+		return 0;
+
+	nodes = malloc((size_t) n * sizeof(struct ptest_list *));
+	CHECK_ALLOCATION(nodes, (size_t) n * sizeof(struct ptest_list *), 0);
+	if (nodes == NULL)
+		return -1;
+
+	i = 0;
+	for (p = head->next; p != NULL; p = p->next)
+		nodes[i++] = p;
+
+	ptest_list_cmp = cmp;
+	qsort(nodes, (size_t) n, sizeof(struct ptest_list *), ptest_list_qsort_cmp);
+
+	p = head;
+	for (i = 0; i < n; i++) {
+		p->next = nodes[i];
+		nodes[i]->prev = p;
+		p = nodes[i];
+	}
+	p->next = NULL;
+	head->index->tail = p;
+
+	free(nodes);
+
+	return 0;
+}
@@ -47,12 +47,30 @@
 
 #include <sys/stat.h>
 
+struct ptest_list_index;
+struct ptest_conf;
+
 struct ptest_list {
 	char *ptest;
 	char *run_ptest;
+	long duration; /* expected, in milliseconds, -1 if unknown */
+	struct ptest_conf *conf; /* ptest-runner.conf, see ptest_conf() */
 
 	struct ptest_list *next;
 	struct ptest_list *prev;
+
+	/* *
+	 * The head keeps an index of the list, the tail, the length and
+	 * hashes of the nodes by name and by run-ptest file, so adding,
+	 * searching and removing doesn't walk the list.
+	 * */
+	struct ptest_list_index *index;
+	struct ptest_list *name_next;
+	struct ptest_list *file_next;
+	dev_t st_dev;
+	ino_t st_ino;
+	int st_state; /* 0 not stat'ed yet, 1 st_dev/st_ino valid, -1 no file */
+	int padding1;
 };
 
 extern struct ptest_list *ptest_list_alloc(void);
@@ -63,7 +81,10 @@ extern int ptest_list_length(struct ptest_list *);
 extern struct ptest_list *ptest_list_search(struct ptest_list *, char *);
 extern struct ptest_list *ptest_list_search_by_file(struct ptest_list *, char *, struct stat);
 extern struct ptest_list *ptest_list_add(struct ptest_list *, char *, char *);
+extern struct ptest_list *ptest_list_add_by_file(struct ptest_list *, char *, char *, struct stat);
 extern struct ptest_list *ptest_list_remove(struct ptest_list *, char *, int);
 extern struct ptest_list *ptest_list_extend(struct ptest_list *, struct ptest_list *);
+extern int ptest_list_sort(struct ptest_list *,
+		int (*)(const struct ptest_list *, const struct ptest_list *));
 
 #endif // PTEST_RUNNER_LIST_H
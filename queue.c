@@ -0,0 +1,231 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "queue.h"
+#include "utils.h"
+
+static int
+open_subdir(int dfd, const char *name)
+{
+	if (mkdirat(dfd, name, 0755) == -1 && errno != EEXIST)
+		return -1;
+
+	return openat(dfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+struct ptest_queue *
+queue_open(const char *dir)
+{
+	struct ptest_queue *q;
+	char host[HOST_NAME_MAX + 1];
+	int saved_errno;
+	int dfd;
+
+	if (mkdir(dir, 0755) == -1 && errno != EEXIST)
+		return NULL;
+
+	dfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dfd == -1)
+		return NULL;
+
+	q = calloc(1, sizeof(struct ptest_queue));
+	CHECK_ALLOCATION(q, sizeof(struct ptest_queue), 0);
+	if (q == NULL) {
+		close(dfd);
+		return NULL;
+	}
+	q->claimed = q->done = -1;
+
+	do {
+		q->claimed = open_subdir(dfd, "claimed");
+		if (q->claimed == -1)
+			break;
+
+		q->done = open_subdir(dfd, "done");
+		if (q->done == -1)
+			break;
+
+		if (gethostname(host, sizeof(host)) == -1)
+			strcpy(host, "localhost");
+		host[sizeof(host) - 1] = '\0';
+		if (asprintf(&q->id, "%s:%d", host, (int) getpid()) == -1) {
+			q->id = NULL;
+			break;
+		}
+
+		close(dfd);
+		return q;
+	} while (0);
+
+	saved_errno = errno;
+	close(dfd);
+	queue_close(q);
+	errno = saved_errno;
+
+	return NULL;
+}
+
+void
+queue_close(struct ptest_queue *q)
+{
+	if (q == NULL)
+		return;
+
+	if (q->claimed != -1)
+		close(q->claimed);
+	if (q->done != -1)
+		close(q->done);
+	free(q->id);
+	free(q);
+}
+
+static int
+write_owner(struct ptest_queue *q, int fd)
+{
+	size_t len = strlen(q->id);
+
+	if (ftruncate(fd, 0) == -1 ||
+	    pwrite(fd, q->id, len, 0) != (ssize_t) len ||
+	    pwrite(fd, "\n", 1, (off_t) len) != 1)
+		return -1;
+
+	return 0;
+}
+
+/* *
+ * Returns a locked fd to keep open while the ptest runs, or -1 with
+ * errno EALREADY when the ptest already ran and EBUSY when another
+ * runner has it.
+ * */
+int
+queue_claim(struct ptest_queue *q, const char *ptest)
+{
+	struct stat st_buf;
+	char tmp[NAME_MAX + 1];
+	int saved_errno;
+	int fd;
+
+	if (fstatat(q->done, ptest, &st_buf, 0) == 0) {
+		errno = EALREADY;
+		return -1;
+	}
+
+	snprintf(tmp, sizeof(tmp), ".%s.%u", q->id, q->tmp_no++);
+	fd = openat(q->claimed, tmp, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd == -1)
+		return -1;
+
+	if (flock(fd, LOCK_EX) == -1 || write_owner(q, fd) == -1) {
+		unlinkat(q->claimed, tmp, 0);
+		close(fd);
+		return -1;
+	}
+
+	if (linkat(q->claimed, tmp, q->claimed, ptest, 0) == 0) {
+		unlinkat(q->claimed, tmp, 0);
+		return fd;
+	}
+
+	saved_errno = errno;
+	unlinkat(q->claimed, tmp, 0);
+	close(fd);
+	if (saved_errno != EEXIST) {
+		errno = saved_errno;
+		return -1;
+	}
+
+	/* Claimed before, see if its runner is still there. */
+	fd = openat(q->claimed, ptest, O_RDWR | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+
+	if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
+		close(fd);
+		errno = EBUSY;
+		return -1;
+	}
+
+	/* The result is written before the lock is released. */
+	if (fstatat(q->done, ptest, &st_buf, 0) == 0) {
+		close(fd);
+		errno = EALREADY;
+		return -1;
+	}
+
+	if (write_owner(q, fd) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* Records the result of a claimed ptest, the claim must be held. */
+int
+queue_done(struct ptest_queue *q, const char *ptest, int status,
+		int duration, int timeouted)
+{
+	char tmp[NAME_MAX + 1];
+	FILE *fp;
+	int fd;
+	int rc;
+
+	snprintf(tmp, sizeof(tmp), ".%s.%u", q->id, q->tmp_no++);
+	fd = openat(q->done, tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd == -1)
+		return -1;
+
+	fp = fdopen(fd, "w");
+	if (fp == NULL) {
+		close(fd);
+		unlinkat(q->done, tmp, 0);
+		return -1;
+	}
+
+	fprintf(fp, "runner=%s\nstatus=%d\nduration=%d\ntimeout=%d\n",
+			q->id, status, duration, timeouted);
+
+	rc = fflush(fp) == 0 && fdatasync(fd) == 0 ? 0 : -1;
+	if (fclose(fp) != 0)
+		rc = -1;
+
+	if (rc == 0)
+		rc = renameat(q->done, tmp, q->done, ptest);
+	if (rc == -1)
+		unlinkat(q->done, tmp, 0);
+
+	return rc;
+}
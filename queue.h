@@ -0,0 +1,52 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+
+#ifndef PTEST_RUNNER_QUEUE_H
+#define PTEST_RUNNER_QUEUE_H
+
+/* *
+ * Work queue shared by the runners pointed to the same directory, every
+ * runner goes through its own list claiming the ptests nobody else did.
+ *
+ * A claim is claimed/<ptest>, linked into place already flock()ed so
+ * the lock is held for as long as the ptest runs. A claim that isn't
+ * locked and has no result is left by a runner that died, the next
+ * runner able to lock it takes it over. The result is written to
+ * done/<ptest> before the lock is released.
+ * */
+struct ptest_queue {
+	int claimed;
+	int done;
+	unsigned int tmp_no;
+	int padding1;
+	char *id;
+};
+
+extern struct ptest_queue *queue_open(const char *);
+extern void queue_close(struct ptest_queue *);
+
+extern int queue_claim(struct ptest_queue *, const char *);
+extern int queue_done(struct ptest_queue *, const char *, int, int, int);
+
+#endif // PTEST_RUNNER_QUEUE_H
@@ -0,0 +1,222 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sampler.h"
+
+static ssize_t
+read_file(int dfd, const char *name, char *buf, size_t size)
+{
+	ssize_t n;
+	int fd;
+
+	fd = openat(dfd, name, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	n = read(fd, buf, size - 1);
+	close(fd);
+	if (n < 0)
+		return -1;
+	buf[n] = '\0';
+
+	return n;
+}
+
+/* Session of the process and its totals from <pid>/stat. */
+static int
+read_stat(int proc_dfd, const char *pid, pid_t *sid, struct sample *s)
+{
+	static long ticks, page_kib;
+	unsigned long utime, stime;
+	long cutime, cstime, threads, rss;
+	char path[64], buf[1024];
+	char *end;
+
+	if (ticks == 0) {
+		ticks = sysconf(_SC_CLK_TCK);
+		page_kib = sysconf(_SC_PAGESIZE) / 1024;
+	}
+
+	snprintf(path, sizeof(path), "%s/stat", pid);
+	if (read_file(proc_dfd, path, buf, sizeof(buf)) <= 0)
+		return -1;
+
+	/* The command may contain spaces and parentheses. */
+	end = strrchr(buf, ')');
+	if (end == NULL)
+		return -1;
+
+	/* state ppid pgrp session tty_nr tpgid flags minflt cminflt majflt
+	 * cmajflt utime stime cutime cstime priority nice num_threads
+	 * itrealvalue starttime vsize rss */
+	if (sscanf(end + 1, " %*c %*d %*d %d %*d %*d %*u %*u %*u %*u %*u %lu %lu"
+	    " %ld %ld %*d %*d %ld %*d %*u %*u %ld", sid, &utime, &stime,
+	    &cutime, &cstime, &threads, &rss) != 7)
+		return -1;
+
+	s->cpu_us += (long long) (utime + stime + (unsigned long) (cutime + cstime)) *
+		1000000 / ticks;
+	s->rss_kib += (long long) rss * page_kib;
+	s->threads += (unsigned int) threads;
+	s->processes++;
+
+	return 0;
+}
+
+/* Needs to be able to ptrace the process, skipped otherwise. */
+static void
+read_io(int proc_dfd, const char *pid, struct sample *s)
+{
+	char path[64], buf[512];
+	char *c;
+
+	snprintf(path, sizeof(path), "%s/io", pid);
+	if (read_file(proc_dfd, path, buf, sizeof(buf)) <= 0)
+		return;
+
+	c = strstr(buf, "\nread_bytes: ");
+	if (c != NULL)
+		s->read_bytes += strtoll(c + strlen("\nread_bytes: "), NULL, 10);
+	c = strstr(buf, "\nwrite_bytes: ");
+	if (c != NULL)
+		s->write_bytes += strtoll(c + strlen("\nwrite_bytes: "), NULL, 10);
+}
+
+/* Samples the sessions in sids, one pass over /proc for all of them. */
+void
+sampler_scan(const pid_t *sids, struct sample *samples, size_t n)
+{
+	struct sample s;
+	struct dirent *de;
+	pid_t sid;
+	size_t i;
+	DIR *d;
+
+	memset(samples, 0, n * sizeof(struct sample));
+
+	d = opendir("/proc");
+	if (d == NULL)
+		return;
+
+	while ((de = readdir(d)) != NULL) {
+		if (!isdigit((unsigned char) de->d_name[0]))
+			continue;
+
+		memset(&s, 0, sizeof(s));
+		if (read_stat(dirfd(d), de->d_name, &sid, &s) == -1)
+			continue;
+
+		for (i = 0; i < n; i++)
+			if (sids[i] == sid)
+				break;
+		if (i == n)
+			continue;
+
+		read_io(dirfd(d), de->d_name, &s);
+		samples[i].cpu_us += s.cpu_us;
+		samples[i].rss_kib += s.rss_kib;
+		samples[i].read_bytes += s.read_bytes;
+		samples[i].write_bytes += s.write_bytes;
+		samples[i].threads += s.threads;
+		samples[i].processes += s.processes;
+	}
+
+	closedir(d);
+}
+
+/* Samples the processes of the cgroup dfd, the CPU time comes from its
+ * cpu.stat so the processes gone aren't missed. */
+void
+sampler_read_cgroup(int dfd, struct sample *s)
+{
+	char buf[4096], pid[32];
+	int proc_dfd, fd;
+	pid_t sid;
+	FILE *fp;
+	char *c;
+
+	memset(s, 0, sizeof(struct sample));
+
+	proc_dfd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (proc_dfd == -1)
+		return;
+
+	fd = openat(dfd, "cgroup.procs", O_RDONLY | O_CLOEXEC);
+	fp = fd != -1 ? fdopen(fd, "r") : NULL;
+	if (fp != NULL) {
+		while (fgets(pid, sizeof(pid), fp) != NULL) {
+			pid[strcspn(pid, "\n")] = '\0';
+			if (read_stat(proc_dfd, pid, &sid, s) == 0)
+				read_io(proc_dfd, pid, s);
+		}
+		fclose(fp);
+	} else if (fd != -1)
+		close(fd);
+	close(proc_dfd);
+
+	if (read_file(dfd, "cpu.stat", buf, sizeof(buf)) > 0 &&
+	    strncmp(buf, "usage_usec ", strlen("usage_usec ")) == 0) {
+		c = buf + strlen("usage_usec ");
+		s->cpu_us = strtoll(c, NULL, 10);
+	}
+}
+
+void
+sampler_header(FILE *fp, const char *ptest, unsigned int interval)
+{
+	fprintf(fp, "# ptest %s interval %ums\n", ptest, interval);
+	fprintf(fp, "# ms cpu%% rss_kib read_kib write_kib threads processes\n");
+}
+
+/* CPU percentage used from prev to cur, taken us microseconds apart. It
+ * may go over 100 with more than one CPU. */
+double
+sampler_cpu(long long us, const struct sample *prev, const struct sample *cur)
+{
+	/* Processes that exited without being waited for take their CPU
+	 * time with them. */
+	if (us <= 0 || cur->cpu_us <= prev->cpu_us)
+		return 0;
+
+	return (double) (cur->cpu_us - prev->cpu_us) * 100 / (double) us;
+}
+
+/* A line for cur, prev was taken us microseconds before. */
+void
+sampler_write(FILE *fp, long ms, long long us, const struct sample *prev,
+		const struct sample *cur)
+{
+	fprintf(fp, "%ld %.1f %lld %lld %lld %u %u\n", ms,
+		sampler_cpu(us, prev, cur), cur->rss_kib,
+		cur->read_bytes / 1024, cur->write_bytes / 1024, cur->threads,
+		cur->processes);
+}
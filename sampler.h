@@ -0,0 +1,55 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+#ifndef PTEST_RUNNER_SAMPLER_H
+#define PTEST_RUNNER_SAMPLER_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+#define SAMPLER_DEFAULT_INTERVAL_MS 1000
+
+/* *
+ * Periodic samples of the processes of the running ptests, read from
+ * /proc/<pid>/stat and /proc/<pid>/io. The processes of a ptest are the
+ * ones in its cgroup or else the ones in its session, found with a
+ * single pass over /proc for every ptest sampled at once. Every sample
+ * is a line of the DIR/<ptest>.samples time series.
+ * */
+struct sample {
+	long long cpu_us; /* the processes alive and the ones they waited for */
+	long long rss_kib;
+	long long read_bytes; /* storage I/O */
+	long long write_bytes;
+	unsigned int threads;
+	unsigned int processes;
+};
+
+extern void sampler_scan(const pid_t *, struct sample *, size_t);
+extern void sampler_read_cgroup(int, struct sample *);
+extern double sampler_cpu(long long, const struct sample *, const struct sample *);
+extern void sampler_header(FILE *, const char *, unsigned int);
+extern void sampler_write(FILE *, long, long long, const struct sample *,
+		const struct sample *);
+
+#endif // PTEST_RUNNER_SAMPLER_H
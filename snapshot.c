@@ -0,0 +1,285 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "snapshot.h"
+
+struct snapshot_proc {
+	pid_t pid;
+	pid_t ppid;
+	pid_t sid;
+	char state;
+	char comm[64];
+	unsigned long utime; /* clock ticks */
+	unsigned long stime;
+};
+
+/* Reads a whole small file relative to the /proc/<pid> dfd, -1 on errors. */
+static ssize_t
+read_file(int dfd, const char *name, char *buf, size_t size)
+{
+	ssize_t n;
+	int fd;
+
+	fd = openat(dfd, name, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	n = read(fd, buf, size - 1);
+	close(fd);
+	if (n < 0)
+		return -1;
+	buf[n] = '\0';
+
+	return n;
+}
+
+static int
+read_proc(int dfd, struct snapshot_proc *p)
+{
+	char buf[1024];
+	char *start, *end;
+	int pgrp;
+
+	if (read_file(dfd, "stat", buf, sizeof(buf)) <= 0)
+		return -1;
+
+	/* The command may contain spaces and parentheses. */
+	start = strchr(buf, '(');
+	end = strrchr(buf, ')');
+	if (start == NULL || end == NULL || end < start)
+		return -1;
+	*end = '\0';
+	snprintf(p->comm, sizeof(p->comm), "%s", start + 1);
+
+	/* state ppid pgrp session tty_nr tpgid flags minflt cminflt majflt
+	 * cmajflt utime stime */
+	if (sscanf(end + 1, " %c %d %d %d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+	    &p->state, &p->ppid, &pgrp, &p->sid, &p->utime, &p->stime) != 6)
+		return -1;
+
+	return 0;
+}
+
+static void
+write_cmdline(int dfd, FILE *fp)
+{
+	char buf[SNAPSHOT_CMDLINE_MAX];
+	ssize_t n, i;
+
+	n = read_file(dfd, "cmdline", buf, sizeof(buf));
+	if (n <= 0)
+		return;
+
+	for (i = 0; i < n - 1; i++)
+		if (buf[i] == '\0')
+			buf[i] = ' ';
+	fprintf(fp, "  cmdline: %s\n", buf);
+}
+
+static void
+write_fds(int dfd, FILE *fp)
+{
+	char target[PATH_MAX];
+	struct dirent *de;
+	int fd_dfd, n = 0;
+	ssize_t len;
+	DIR *d;
+
+	fd_dfd = openat(dfd, "fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd_dfd == -1)
+		return;
+	d = fdopendir(fd_dfd);
+	if (d == NULL) {
+		close(fd_dfd);
+		return;
+	}
+
+	while ((de = readdir(d)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;
+		if (n++ == SNAPSHOT_FDS_MAX) {
+			fprintf(fp, "  fd: ...\n");
+			break;
+		}
+
+		len = readlinkat(fd_dfd, de->d_name, target, sizeof(target) - 1);
+		if (len == -1)
+			continue;
+		target[len] = '\0';
+		fprintf(fp, "  fd: %s -> %s\n", de->d_name, target);
+	}
+	closedir(d);
+}
+
+/* Only root can read the stack, it's skipped otherwise. */
+static void
+write_stack(int dfd, FILE *fp)
+{
+	char buf[4096];
+	char *line, *saveptr;
+
+	if (read_file(dfd, "stack", buf, sizeof(buf)) <= 0)
+		return;
+
+	for (line = strtok_r(buf, "\n", &saveptr); line != NULL;
+	     line = strtok_r(NULL, "\n", &saveptr))
+		fprintf(fp, "  stack: %s\n", line);
+}
+
+static void
+write_process(int dfd, const struct snapshot_proc *p, long ticks, FILE *fp)
+{
+	char wchan[128];
+
+	if (read_file(dfd, "wchan", wchan, sizeof(wchan)) <= 0 ||
+	    strcmp(wchan, "0") == 0)
+		strcpy(wchan, "-");
+
+	fprintf(fp, "PROCESS: %d ppid %d state %c wchan %s utime %.2fs stime %.2fs comm %s\n",
+		(int) p->pid, (int) p->ppid, p->state, wchan,
+		(double) p->utime / (double) ticks, (double) p->stime / (double) ticks,
+		p->comm);
+	write_cmdline(dfd, fp);
+	write_fds(dfd, fp);
+	write_stack(dfd, fp);
+}
+
+/* *
+ * /dev/kmsg gives a record per read, "prio,seq,usec,flags;message",
+ * the timestamps are in the CLOCK_MONOTONIC time base. Only the last
+ * SNAPSHOT_DMESG_MAX records since since are kept.
+ * */
+static void
+write_dmesg(const struct timespec *since, FILE *fp)
+{
+	unsigned long long start, usec;
+	char *ring[SNAPSHOT_DMESG_MAX];
+	char buf[8192];
+	unsigned long skipped = 0;
+	int fd, i, n = 0;
+	ssize_t len;
+	char *msg;
+
+	memset(ring, 0, sizeof(ring));
+	start = (unsigned long long) since->tv_sec * 1000000ULL +
+	    (unsigned long long) since->tv_nsec / 1000ULL;
+
+	fd = open("/dev/kmsg", O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd == -1) {
+		fprintf(fp, "DMESG: unavailable, %s\n", strerror(errno));
+		return;
+	}
+
+	for (;;) {
+		len = read(fd, buf, sizeof(buf) - 1);
+		if (len == -1 && errno == EPIPE)
+			continue; /* records overwritten while reading */
+		if (len <= 0)
+			break;
+		buf[len] = '\0';
+
+		msg = strchr(buf, ';');
+		if (msg == NULL ||
+		    sscanf(buf, "%*d,%*u,%llu", &usec) != 1 || usec < start)
+			continue;
+
+		if (ring[n % SNAPSHOT_DMESG_MAX] != NULL) {
+			free(ring[n % SNAPSHOT_DMESG_MAX]);
+			skipped++;
+		}
+		/* The continuation lines of the record start with a space. */
+		msg[strcspn(msg, "\n")] = '\0';
+		ring[n % SNAPSHOT_DMESG_MAX] = strdup(msg + 1);
+		n++;
+	}
+	close(fd);
+
+	fprintf(fp, "DMESG: %d messages since the ptest started", n);
+	if (skipped > 0)
+		fprintf(fp, ", first %lu skipped", skipped);
+	fprintf(fp, "\n");
+
+	for (i = n > SNAPSHOT_DMESG_MAX ? n - SNAPSHOT_DMESG_MAX : 0; i < n; i++) {
+		msg = ring[i % SNAPSHOT_DMESG_MAX];
+		if (msg != NULL)
+			fprintf(fp, "  %s\n", msg);
+		free(msg);
+	}
+}
+
+/* Writes the processes of session sid and the kernel messages since
+ * since, returns the number of processes. */
+int
+snapshot_write(pid_t sid, const struct timespec *since, FILE *fp)
+{
+	struct snapshot_proc p;
+	struct dirent *de;
+	long ticks;
+	int proc_dfd, dfd, n = 0;
+	DIR *d;
+
+	ticks = sysconf(_SC_CLK_TCK);
+	if (ticks <= 0)
+		ticks = 100;
+
+	fprintf(fp, "SNAPSHOT: session %d\n", (int) sid);
+
+	proc_dfd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	d = proc_dfd != -1 ? fdopendir(proc_dfd) : NULL;
+	if (d == NULL) {
+		if (proc_dfd != -1)
+			close(proc_dfd);
+		fprintf(fp, "ERROR: Unable to read /proc, %s\n", strerror(errno));
+	} else {
+		while ((de = readdir(d)) != NULL) {
+			if (de->d_name[0] < '0' || de->d_name[0] > '9')
+				continue;
+
+			dfd = openat(proc_dfd, de->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			if (dfd == -1)
+				continue;
+			if (read_proc(dfd, &p) == 0 && p.sid == sid) {
+				p.pid = (pid_t) atoi(de->d_name);
+				write_process(dfd, &p, ticks, fp);
+				n++;
+			}
+			close(dfd);
+		}
+		closedir(d);
+	}
+
+	write_dmesg(since, fp);
+	fprintf(fp, "END SNAPSHOT\n");
+
+	return n;
+}
@@ -0,0 +1,44 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+#ifndef PTEST_RUNNER_SNAPSHOT_H
+#define PTEST_RUNNER_SNAPSHOT_H
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/types.h>
+
+#define SNAPSHOT_CMDLINE_MAX 4096
+#define SNAPSHOT_FDS_MAX 64
+#define SNAPSHOT_DMESG_MAX 200
+
+/* *
+ * Native replacement for pstree and dmesg when a ptest times out. Every
+ * process in the session of the ptest is written as a PROCESS line with
+ * its state, wchan and CPU time, followed by its command line, open fds
+ * and kernel stack when readable. The kernel messages logged since the
+ * ptest started come last, up to SNAPSHOT_DMESG_MAX of them.
+ * */
+extern int snapshot_write(pid_t, const struct timespec *, FILE *);
+
+#endif // PTEST_RUNNER_SNAPSHOT_H
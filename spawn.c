@@ -0,0 +1,338 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <pty.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "spawn.h"
+
+#ifndef CLONE_PIDFD
+#define CLONE_PIDFD 0x00001000
+#endif
+
+#ifndef SYS_close_range
+#define SYS_close_range 436
+#endif
+
+#define SPAWN_ERROR(a, step) \
+	do { \
+		if ((a)->err_step == NULL) { \
+			(a)->err_step = step; \
+			(a)->err = errno; \
+		} \
+	} while (0)
+
+/* The child shares the memory with the runner until it calls execv(),
+ * like vfork(). */
+static char spawn_stack[SPAWN_STACK_SIZE] __attribute__ ((aligned (16)));
+
+/* Close all fds from first up to 'ulimit -n'
+ * i.e. do not close STDIN, STDOUT, STDERR.
+ * Only used when close_range() isn't available.
+ */ 
+static void
+close_fds(int first)
+{
+	struct rlimit curr_lim;
+	getrlimit(RLIMIT_NOFILE, &curr_lim);
+
+	int fd;
+	for (fd=first; fd < (int)curr_lim.rlim_cur; fd++) {
+		(void) close(fd);
+   	}
+}
+
+/* Opens the pty the ptest gets as controlling terminal, returns the
+ * master side or -1 on error. fp should be writable, likely stdout/err.
+ */
+int
+spawn_setup_pty(int *slave, FILE *fp)
+{
+	int pty_master = -1;
+	int pty_slave = -1;
+	char pty_name[256];
+	struct group *gptr;
+	gid_t gid;
+
+	*slave = -1;
+	if (openpty(&pty_master, &pty_slave, pty_name, NULL, NULL) < 0) {
+		fprintf(fp, "ERROR: openpty() failed with: %s.\n", strerror(errno));
+		return -1;
+	}
+
+	if ((gptr = getgrnam(pty_name)) != 0) {
+		gid = gptr->gr_gid;
+	} else {
+		/* If the tty group does not exist, don't change the
+		 * group on the slave pty, only the owner
+		 */
+		gid = (gid_t)-1;
+	}
+
+	/* chown/chmod the corresponding pty, if possible.
+	 * This will only work if the process has root permissions.
+	 */
+	if (chown(pty_name, getuid(), gid) != 0) {
+		fprintf(fp, "ERROR; chown() failed with: %s.\n", strerror(errno));
+	}
+
+	/* Makes the slave read/writeable for the user. */
+	if (chmod(pty_name, S_IRUSR|S_IWUSR) != 0) {
+		fprintf(fp, "ERROR: chmod() failed with: %s.\n", strerror(errno));
+	}
+
+	fcntl(pty_master, F_SETFD, FD_CLOEXEC);
+	fcntl(pty_slave, F_SETFD, FD_CLOEXEC);
+	*slave = pty_slave;
+
+	return pty_master;
+}
+
+/* Runs in the runner memory, only async-signal-safe calls and no
+ * stdio from here. */
+static int
+spawn_child(void *arg)
+{
+	struct spawn_args *a = arg;
+	char *const argv[2] = {(char *) a->path, NULL};
+	int first_fd = 3;
+
+	if (setsid() == -1)
+		SPAWN_ERROR(a, "setsid()");
+
+	/* Before execv() so every process of the ptest is in the group. */
+	if (a->cgroup_procs != -1 && write(a->cgroup_procs, "0", 1) != 1)
+		SPAWN_ERROR(a, "cgroup.procs");
+
+	if (a->fd_tty != -1) {
+		if (dup2(a->fd_tty, STDIN_FILENO) == -1)
+			SPAWN_ERROR(a, "dup2()");
+		else if (ioctl(STDIN_FILENO, TIOCSCTTY, NULL) == -1)
+			SPAWN_ERROR(a, "TIOCSCTTY");
+	} else
+		close(STDIN_FILENO);
+
+	if (chdir(a->dir) == -1)
+		SPAWN_ERROR(a, "chdir()");
+
+	dup2(a->fd_stdout, STDOUT_FILENO);
+	// XXX: Redirect stderr to stdout to avoid buffer ordering problems.
+	dup2(a->fd_stdout, STDERR_FILENO);
+
+	if (a->jobserver[0] != -1) {
+		if (dup2(a->jobserver[0], SPAWN_JOBSERVER_FD) == -1 ||
+		    dup2(a->jobserver[1], SPAWN_JOBSERVER_FD + 1) == -1)
+			SPAWN_ERROR(a, "dup2()");
+		first_fd = SPAWN_JOBSERVER_FD + 2;
+	}
+
+	if (syscall(SYS_close_range, first_fd, ~0U, 0) == -1)
+		close_fds(first_fd);
+
+	sigprocmask(SIG_SETMASK, a->sigmask, NULL);
+	if (a->search_path)
+		execvp(a->path, argv);
+	else
+		execv(a->path, argv);
+
+	SPAWN_ERROR(a, "execv()");
+	_exit(EXIT_FAILURE);
+}
+
+/* Starts the ptest in a new session with the pty as controlling
+ * terminal. The runner is suspended until the child calls execv() so
+ * no page tables are copied. Returns the pid and a pidfd when the
+ * kernel supports CLONE_PIDFD, -1 otherwise. */
+pid_t
+spawn_ptest(struct spawn_args *a, int *pidfd)
+{
+	sigset_t all, old;
+	pid_t pid;
+
+	*pidfd = -1;
+	a->err_step = NULL;
+	a->err = 0;
+
+	/* No signal handler may run in the child while it shares the
+	 * memory, it restores a->sigmask before execv(). */
+	sigfillset(&all);
+	sigprocmask(SIG_SETMASK, &all, &old);
+
+	pid = clone(spawn_child, spawn_stack + SPAWN_STACK_SIZE,
+		CLONE_VM | CLONE_VFORK | CLONE_PIDFD | SIGCHLD, a, pidfd);
+	if (pid == -1 && errno == EINVAL) {
+		*pidfd = -1;
+		pid = clone(spawn_child, spawn_stack + SPAWN_STACK_SIZE,
+			CLONE_VM | CLONE_VFORK | SIGCHLD, a);
+	}
+
+	sigprocmask(SIG_SETMASK, &old, NULL);
+
+	return pid;
+}
+
+/* Reads the fields of /proc/<pid>/stat needed to find leftovers. */
+static int
+read_stat(int dfd, const char *pid, char *comm, size_t size, char *state,
+		pid_t *ppid, pid_t *sid)
+{
+	char path[64], buf[512];
+	char *start, *end;
+	ssize_t n;
+	int fd;
+	int pgrp;
+
+	snprintf(path, sizeof(path), "%s/stat", pid);
+	fd = openat(dfd, path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return -1;
+	buf[n] = '\0';
+
+	/* The command may contain spaces and parentheses. */
+	start = strchr(buf, '(');
+	end = strrchr(buf, ')');
+	if (start == NULL || end == NULL || end < start)
+		return -1;
+	*end = '\0';
+	snprintf(comm, size, "%s", start + 1);
+
+	if (sscanf(end + 1, " %c %d %d %d", state, ppid, &pgrp, sid) != 4)
+		return -1;
+
+	return 0;
+}
+
+/* Whether sid is the session of a daemon reparented to the runner. */
+static int
+orphan_session(int dfd, pid_t sid, pid_t self)
+{
+	char name[16], comm[64];
+	char state;
+	pid_t ppid, psid;
+
+	if (sid <= 0)
+		return 0;
+	snprintf(name, sizeof(name), "%d", (int) sid);
+
+	return read_stat(dfd, name, comm, sizeof(comm), &state, &ppid, &psid) == 0 &&
+	    ppid == self;
+}
+
+/* *
+ * Kills what a ptest left behind once it exited, every process still in
+ * its session and, with orphans, the ones reparented to the runner as
+ * child subreaper and their sessions, that is the daemons that left the
+ * session. Only the orphans with SPAWN_NO_SESSION as sid. It's a single
+ * pass over /proc, the zombies among the runner children are reaped once
+ * it's done so the sessions they lead are still found. The caller checks
+ * again until it returns 0 so they're gone before the next ptest starts.
+ * The processes not in lo yet are printed on fp unless it's NULL and
+ * added to it, returns the ones still alive.
+ * */
+int
+spawn_kill_leftovers(pid_t sid, int orphans, struct spawn_leftovers *lo, FILE *fp)
+{
+	pid_t self = getpid();
+	struct dirent *de;
+	char comm[64];
+	char state;
+	pid_t pid, ppid, psid, *tmp;
+	pid_t *zombies = NULL;
+	int alive = 0, zombies_no = 0;
+	int dfd, i;
+	DIR *d;
+
+	dfd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dfd == -1)
+		return 0;
+	d = fdopendir(dfd);
+	if (d == NULL) {
+		close(dfd);
+		return 0;
+	}
+
+	while ((de = readdir(d)) != NULL) {
+		if (de->d_name[0] < '0' || de->d_name[0] > '9')
+			continue;
+		if (read_stat(dfd, de->d_name, comm, sizeof(comm), &state, &ppid, &psid) == -1)
+			continue;
+		pid = (pid_t) atoi(de->d_name);
+		if (pid == self || (psid != sid && !(orphans &&
+		    (ppid == self || orphan_session(dfd, psid, self)))))
+			continue;
+
+		if (state == 'Z') {
+			if (ppid != self)
+				continue;
+			tmp = realloc(zombies, sizeof(pid_t) * (size_t) (zombies_no + 1));
+			if (tmp != NULL) {
+				zombies = tmp;
+				zombies[zombies_no++] = pid;
+			}
+			continue;
+		}
+
+		alive++;
+		kill(pid, SIGKILL);
+
+		for (i = 0; i < lo->pids_no; i++)
+			if (lo->pids[i] == pid)
+				break;
+		if (i < lo->pids_no)
+			continue;
+
+		if (fp != NULL)
+			fprintf(fp, "LEFTOVER: %d (%s) killed\n", (int) pid, comm);
+		tmp = realloc(lo->pids, sizeof(pid_t) * (size_t) (lo->pids_no + 1));
+		if (tmp != NULL) {
+			lo->pids = tmp;
+			lo->pids[lo->pids_no++] = pid;
+		}
+	}
+	closedir(d);
+
+	for (i = 0; i < zombies_no; i++)
+		waitpid(zombies[i], NULL, WNOHANG);
+	free(zombies);
+
+	return alive;
+}
@@ -0,0 +1,64 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+#ifndef PTEST_RUNNER_SPAWN_H
+#define PTEST_RUNNER_SPAWN_H
+
+#include <signal.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#define SPAWN_STACK_SIZE (64 * 1024)
+#define SPAWN_JOBSERVER_FD 3	/* read end, the write end follows */
+#define SPAWN_LEFTOVER_WAIT_MS 1000	/* until the leftovers are given up */
+#define SPAWN_LEFTOVER_CHECK_MS 10
+#define SPAWN_NO_SESSION ((pid_t) -1)	/* only the orphans are killed */
+
+struct spawn_args {
+	const char *path;	/* run-ptest */
+	int search_path;	/* path is looked up in PATH */
+	const char *dir;	/* working directory */
+	int fd_stdout;		/* stdout and stderr of the child */
+	int fd_tty;		/* pty master, -1 leaves stdin closed */
+	int jobserver[2];	/* make jobserver pipe or -1, must be > 4 */
+	int cgroup_procs;	/* cgroup.procs the child moves to or -1 */
+	const sigset_t *sigmask;
+
+	/* Set by the child on failure. */
+	const char *err_step;
+	int err;
+	int padding2;
+};
+
+/* Leftovers of a ptest already reported. */
+struct spawn_leftovers {
+	pid_t *pids;
+	int pids_no;
+	int padding1;
+};
+
+extern int spawn_setup_pty(int *, FILE *);
+extern pid_t spawn_ptest(struct spawn_args *, int *);
+extern int spawn_kill_leftovers(pid_t, int, struct spawn_leftovers *, FILE *);
+
+#endif // PTEST_RUNNER_SPAWN_H
@@ -0,0 +1,104 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+#include <stdio.h>
+
+#include "stats.h"
+
+struct ptest_stats runner_stats;
+
+static double
+seconds(long long ns)
+{
+	return (double) ns / 1e9;
+}
+
+static long long
+tv_us(const struct timeval *tv)
+{
+	return (long long) tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+/* Per second of the run, 0 before it ran. */
+static double
+rate(double n, long long run_ns)
+{
+	return run_ns > 0 ? n / seconds(run_ns) : 0;
+}
+
+void
+stats_print(FILE *fp, const struct ptest_stats *s, const struct rusage *ru)
+{
+	fprintf(fp, "STATS: discovery %.3fs %lu ptests\n", seconds(s->discovery_ns),
+		s->ptests_found);
+	fprintf(fp, "STATS: spawn %lu mean %.3fms max %.3fms\n", s->spawns,
+		s->spawns > 0 ? (double) s->spawn_ns / 1e6 / (double) s->spawns : 0,
+		(double) s->spawn_max_ns / 1e6);
+	fprintf(fp, "STATS: forwarded %llu bytes in %lu reads, %.3f MiB/s\n",
+		s->bytes_forwarded, s->forwards,
+		rate((double) s->bytes_forwarded / (1024 * 1024), s->run_ns));
+	fprintf(fp, "STATS: wakeups %lu, %.1f/s\n", s->wakeups,
+		rate((double) s->wakeups, s->run_ns));
+	fprintf(fp, "STATS: epoll %lu iterations %lu events\n", s->iterations, s->events);
+	fprintf(fp, "STATS: snapshot %lu %.3fs collect %lu %.3fs\n", s->snapshots,
+		seconds(s->snapshot_ns), s->collects, seconds(s->collect_ns));
+	fprintf(fp, "STATS: samples %lu %.3fs\n", s->samples, seconds(s->sample_ns));
+	fprintf(fp, "STATS: run %.3fs user %.3fs sys %.3fs maxrss %ldKiB"
+		" minflt %ld majflt %ld nvcsw %ld nivcsw %ld\n", seconds(s->run_ns),
+		(double) tv_us(&ru->ru_utime) / 1e6, (double) tv_us(&ru->ru_stime) / 1e6,
+		ru->ru_maxrss, ru->ru_minflt, ru->ru_majflt, ru->ru_nvcsw, ru->ru_nivcsw);
+}
+
+/* A single object, the times in nanoseconds or microseconds as named. */
+int
+stats_write_json(FILE *fp, const struct ptest_stats *s, const struct rusage *ru)
+{
+	fprintf(fp, "{\n");
+	fprintf(fp, "\t\"discovery_ns\": %lld,\n", s->discovery_ns);
+	fprintf(fp, "\t\"ptests_found\": %lu,\n", s->ptests_found);
+	fprintf(fp, "\t\"spawns\": %lu,\n", s->spawns);
+	fprintf(fp, "\t\"spawn_ns\": %lld,\n", s->spawn_ns);
+	fprintf(fp, "\t\"spawn_max_ns\": %lld,\n", s->spawn_max_ns);
+	fprintf(fp, "\t\"bytes_forwarded\": %llu,\n", s->bytes_forwarded);
+	fprintf(fp, "\t\"forwards\": %lu,\n", s->forwards);
+	fprintf(fp, "\t\"wakeups\": %lu,\n", s->wakeups);
+	fprintf(fp, "\t\"iterations\": %lu,\n", s->iterations);
+	fprintf(fp, "\t\"events\": %lu,\n", s->events);
+	fprintf(fp, "\t\"snapshots\": %lu,\n", s->snapshots);
+	fprintf(fp, "\t\"snapshot_ns\": %lld,\n", s->snapshot_ns);
+	fprintf(fp, "\t\"collects\": %lu,\n", s->collects);
+	fprintf(fp, "\t\"collect_ns\": %lld,\n", s->collect_ns);
+	fprintf(fp, "\t\"samples\": %lu,\n", s->samples);
+	fprintf(fp, "\t\"sample_ns\": %lld,\n", s->sample_ns);
+	fprintf(fp, "\t\"run_ns\": %lld,\n", s->run_ns);
+	fprintf(fp, "\t\"user_us\": %lld,\n", tv_us(&ru->ru_utime));
+	fprintf(fp, "\t\"sys_us\": %lld,\n", tv_us(&ru->ru_stime));
+	fprintf(fp, "\t\"maxrss_kib\": %ld,\n", ru->ru_maxrss);
+	fprintf(fp, "\t\"minflt\": %ld,\n", ru->ru_minflt);
+	fprintf(fp, "\t\"majflt\": %ld,\n", ru->ru_majflt);
+	fprintf(fp, "\t\"nvcsw\": %ld,\n", ru->ru_nvcsw);
+	fprintf(fp, "\t\"nivcsw\": %ld\n", ru->ru_nivcsw);
+	fprintf(fp, "}\n");
+
+	return ferror(fp) ? -1 : 0;
+}
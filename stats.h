@@ -0,0 +1,63 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+#ifndef PTEST_RUNNER_STATS_H
+#define PTEST_RUNNER_STATS_H
+
+#include <stdio.h>
+#include <sys/resource.h>
+
+/* *
+ * What the runner itself costs, for --stats. The counters are process
+ * wide so the discovery and the event loop add to the same ones, they
+ * are printed as STATS lines when the run stops and can be written as a
+ * JSON object to track regressions between releases.
+ * */
+struct ptest_stats {
+	long long discovery_ns;
+	unsigned long ptests_found;
+	unsigned long spawns;
+	unsigned long padding1;
+	long long spawn_ns; /* fork to exec, summed */
+	long long spawn_max_ns;
+	unsigned long long bytes_forwarded;
+	unsigned long forwards; /* reads or splices that moved output */
+	unsigned long wakeups; /* output events of the ptests */
+	unsigned long iterations; /* epoll_wait() returns */
+	unsigned long events;
+	unsigned long snapshots;
+	unsigned long collects;
+	long long snapshot_ns;
+	long long collect_ns; /* the capture command, while the loop runs */
+	unsigned long samples;
+	unsigned long padding2;
+	long long sample_ns; /* CPU time */
+	long long run_ns;
+};
+
+extern struct ptest_stats runner_stats;
+
+extern void stats_print(FILE *, const struct ptest_stats *, const struct rusage *);
+extern int stats_write_json(FILE *, const struct ptest_stats *, const struct rusage *);
+
+#endif // PTEST_RUNNER_STATS_H
@@ -0,0 +1,337 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <check.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "admission.h"
+#include "conf.h"
+#include "ptest_list.h"
+#include "utils.h"
+
+extern Suite *admission_suite(void);
+
+START_TEST(test_conf_parse)
+{
+	struct ptest_conf conf;
+
+	conf_init(&conf);
+	ck_assert(conf.timeout == -1);
+	ck_assert(conf.cpu == 1);
+	ck_assert(conf_parse(&conf, "# comment\n") == 0);
+	ck_assert(conf_parse(&conf, "\n") == 0);
+	ck_assert(conf_parse(&conf, "memory = 512M # peak\n") == 0);
+	ck_assert(conf.memory == 512 * 1024);
+	ck_assert(conf_parse(&conf, "memory=2g") == 0);
+	ck_assert(conf.memory == 2 * 1024 * 1024);
+	ck_assert(conf_parse(&conf, "cpu = 4\n") == 0);
+	ck_assert(conf.cpu == 4);
+	ck_assert(conf_parse(&conf, "timeout = 0\n") == 0);
+	ck_assert(conf.timeout == 0);
+	ck_assert(conf_parse(&conf, "exclusive = yes\n") == 0);
+	ck_assert(conf.exclusive == 1);
+	ck_assert(conf_parse(&conf, "expected-duration = 90\n") == 0);
+	ck_assert(conf.expected_duration == 90000);
+	ck_assert(conf_parse(&conf, "locks = port-80, dbus\n") == 0);
+	ck_assert(conf.locks_no == 2);
+	ck_assert(strcmp(conf.locks[0], "port-80") == 0);
+	ck_assert(strcmp(conf.locks[1], "dbus") == 0);
+	ck_assert(conf_parse(&conf, "unknown = yes\n") == 0);
+
+	ck_assert(conf_parse(&conf, "memory\n") == -1);
+	ck_assert(conf_parse(&conf, "memory = lots\n") == -1);
+	ck_assert(conf_parse(&conf, "memory = 1MB\n") == -1);
+	ck_assert(conf_parse(&conf, "memory = 9223372036854775807G\n") == -1);
+	ck_assert(conf_parse(&conf, "memory = 9007199254740992G\n") == -1);
+	ck_assert(conf_parse(&conf, "cpu = -1\n") == -1);
+	ck_assert(conf_parse(&conf, "exclusive = maybe\n") == -1);
+	ck_assert(conf.exclusive == 1);
+
+	free(conf.locks[0]);
+	free(conf.locks[1]);
+	free(conf.locks);
+}
+END_TEST
+
+/* Lines that can't be understood are reported with their number, the
+ * ones around them still apply. */
+START_TEST(test_conf_read)
+{
+	char filename[] = "/tmp/ptest-conf-XXXXXX";
+	char expected[PATH_MAX];
+	struct ptest_conf conf;
+	char *buf;
+	size_t size;
+	FILE *fp;
+	int fd;
+
+	fd = mkstemp(filename);
+	ck_assert(fd != -1);
+	fp = fdopen(fd, "w");
+	ck_assert(fp != NULL);
+	fputs("cpu = 2\ntimeout = 3O\nmemory = 1M\nlocks\nmemory = 9007199254740992G\n", fp);
+	fclose(fp);
+
+	fp = open_memstream(&buf, &size);
+	ck_assert(fp != NULL);
+	conf_init(&conf);
+	ck_assert(conf_read(&conf, filename, fp) == 0);
+	fclose(fp);
+
+	ck_assert(conf.cpu == 2);
+	ck_assert(conf.timeout == -1);
+	ck_assert(conf.memory == 1024);
+	snprintf(expected, sizeof(expected),
+		"WARNING: %s:2: can't understand \"timeout = 3O\", ignored.\n"
+		"WARNING: %s:4: can't understand \"locks\", ignored.\n"
+		"WARNING: %s:5: can't understand \"memory = 9007199254740992G\", ignored.\n",
+		filename, filename, filename);
+	ck_assert(strcmp(buf, expected) == 0);
+	free(buf);
+
+	unlink(filename);
+	ck_assert(conf_read(&conf, filename, stderr) == -1);
+}
+END_TEST
+
+START_TEST(test_admission_check)
+{
+	unsigned int no_pressure[3] = { 0, 0, 0 };
+	struct ptest_conf one, two, locked, exclusive, half;
+	char *locks[] = { "db" };
+	struct admission a;
+	long available;
+
+	conf_init(&one);
+	conf_init(&two);
+	two.cpu = 2;
+	conf_init(&locked);
+	locked.locks = locks;
+	locked.locks_no = 1;
+	conf_init(&exclusive);
+	exclusive.exclusive = 1;
+
+	admission_init(&a, no_pressure, 0, 2);
+	admission_sample(&a, 0);
+	ck_assert(admission_check(&a, &one) == ADMISSION_OK);
+	admission_start(&a, &locked);
+
+	ck_assert(admission_check(&a, &two) == ADMISSION_CPU);
+	ck_assert(admission_check(&a, &locked) == ADMISSION_LOCK);
+	ck_assert(admission_check(&a, &exclusive) == ADMISSION_EXCLUSIVE);
+	ck_assert(!admission_global(&a, ADMISSION_EXCLUSIVE));
+	ck_assert(admission_check(&a, &one) == ADMISSION_OK);
+
+	/* Held until a ptest starts, counted once. */
+	admission_hold(&a, ADMISSION_CPU);
+	admission_hold(&a, ADMISSION_CPU);
+	ck_assert(a.stalls[ADMISSION_CPU] == 1);
+	admission_end(&a, &locked);
+	ck_assert(admission_check(&a, &two) == ADMISSION_OK);
+	ck_assert(admission_check(&a, &locked) == ADMISSION_OK);
+
+	admission_start(&a, &exclusive);
+	ck_assert(admission_check(&a, &one) == ADMISSION_EXCLUSIVE);
+	ck_assert(admission_global(&a, ADMISSION_EXCLUSIVE));
+	admission_end(&a, &exclusive);
+	admission_free(&a);
+
+	/* More than any machine has available. */
+	admission_init(&a, no_pressure, LONG_MAX / 4, 2);
+	admission_sample(&a, 0);
+	ck_assert(admission_check(&a, &one) == ADMISSION_MEMORY);
+	admission_free(&a);
+
+	/* The declared memory a running ptest already uses is out of
+	 * MemAvailable, it isn't reserved a second time. */
+	admission_init(&a, no_pressure, 1, 2);
+	admission_sample(&a, 0);
+	available = a.available;
+	ck_assert(available > 0);
+	a.min_available = available / 4;
+	conf_init(&half);
+	half.memory = available / 2;
+	ck_assert(admission_check(&a, &half) == ADMISSION_OK);
+	admission_start(&a, &half);
+	ck_assert(admission_check(&a, &half) == ADMISSION_MEMORY);
+	admission_sample(&a, half.memory);
+	ck_assert(admission_check(&a, &half) == ADMISSION_OK);
+	admission_end(&a, &half);
+	admission_free(&a);
+}
+END_TEST
+
+static void
+add_ptest(const char *dir, const char *name, const char *seconds,
+		const char *conf)
+{
+	char path[PATH_MAX];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	ck_assert(mkdir(path, 0755) == 0);
+	snprintf(path, sizeof(path), "%s/%s/ptest", dir, name);
+	ck_assert(mkdir(path, 0755) == 0);
+
+	snprintf(path, sizeof(path), "%s/%s/ptest/run-ptest", dir, name);
+	fp = fopen(path, "w");
+	ck_assert(fp != NULL);
+	fprintf(fp, "#!/bin/sh\nsleep %s\n", seconds);
+	fclose(fp);
+	ck_assert(chmod(path, 0755) == 0);
+
+	snprintf(path, sizeof(path), "%s/%s/ptest/" CONF_FILENAME, dir, name);
+	fp = fopen(path, "w");
+	ck_assert(fp != NULL);
+	fputs(conf, fp);
+	fclose(fp);
+}
+
+static char *
+run(const char *dir, int jobs, unsigned int timeout, int ptests)
+{
+	struct ptest_options opts;
+	struct ptest_list *head;
+	FILE *fp_stdout;
+	char *buf;
+	size_t size;
+
+	memset(&opts, 0, sizeof(opts));
+	opts.timeout = timeout;
+	opts.jobs = jobs;
+
+	fp_stdout = open_memstream(&buf, &size);
+	ck_assert(fp_stdout != NULL);
+	head = get_available_ptests(dir);
+	ck_assert(ptest_list_length(head) == ptests);
+	run_ptests(head, opts, "test_admission_run_ptests", fp_stdout, fp_stdout);
+	fclose(fp_stdout);
+	ptest_list_free_all(head);
+
+	return buf;
+}
+
+static void
+remove_dir(const char *dir)
+{
+	char cmd[PATH_MAX];
+
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+	ck_assert(system(cmd) == 0);
+}
+
+/* A ptest declaring every CPU doesn't run next to another one, c goes
+ * ahead of b and b waits for both. */
+START_TEST(test_admission_run_ptests)
+{
+	char dir[] = "/tmp/ptest-admission-XXXXXX";
+	char *buf;
+
+	ck_assert(mkdtemp(dir) != NULL);
+	add_ptest(dir, "a", "0.2", "cpu = 1\n");
+	add_ptest(dir, "b", "0.2", "cpu = 2\n");
+	add_ptest(dir, "c", "0.4", "cpu = 1\n");
+
+	buf = run(dir, 2, 5, 3);
+	ck_assert(strstr(buf, "STALLS: 1, cpu weight 1, held ") != NULL);
+	ck_assert(strstr(buf, "/b/ptest") != NULL);
+	ck_assert(strstr(buf, "/c/ptest") < strstr(buf, "/b/ptest"));
+
+	free(buf);
+	remove_dir(dir);
+}
+END_TEST
+
+/* b shares a lock with a, d runs alone and e has its own timeout. */
+/* b waits for a at the head of the queue, c and d don't start next to a
+ * meanwhile. */
+START_TEST(test_admission_exclusive)
+{
+	char dir[] = "/tmp/ptest-admission-XXXXXX";
+	char *buf;
+
+	ck_assert(mkdtemp(dir) != NULL);
+	add_ptest(dir, "a", "0.5", "");
+	add_ptest(dir, "b", "0.1", "exclusive = yes\n");
+	add_ptest(dir, "c", "0.1", "");
+	add_ptest(dir, "d", "0.1", "");
+
+	buf = run(dir, 2, 5, 4);
+	ck_assert(strstr(buf, "/d/ptest") != NULL);
+	ck_assert(strstr(buf, "/a/ptest") < strstr(buf, "/b/ptest"));
+	ck_assert(strstr(buf, "/b/ptest") < strstr(buf, "/c/ptest"));
+	ck_assert(strstr(buf, "/b/ptest") < strstr(buf, "/d/ptest"));
+
+	free(buf);
+	remove_dir(dir);
+}
+END_TEST
+
+START_TEST(test_admission_locks)
+{
+	char dir[] = "/tmp/ptest-admission-XXXXXX";
+	char *buf;
+
+	ck_assert(mkdtemp(dir) != NULL);
+	add_ptest(dir, "a", "0.2", "locks = db\n");
+	add_ptest(dir, "b", "0.2", "locks = net, db\n");
+	add_ptest(dir, "c", "0.2", "locks = net\n");
+	add_ptest(dir, "d", "0.2", "exclusive = yes\n");
+	add_ptest(dir, "e", "5", "timeout = 1\n");
+
+	buf = run(dir, 4, 30, 5);
+	ck_assert(strstr(buf, "STALLS: 2, exclusive 1, lock 1, held ") != NULL);
+	ck_assert(strstr(buf, "TIMEOUT: ") != NULL);
+
+	free(buf);
+	remove_dir(dir);
+}
+END_TEST
+
+Suite *
+admission_suite()
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("admission");
+	tc_core = tcase_create("Core");
+
+	tcase_add_test(tc_core, test_conf_parse);
+	tcase_add_test(tc_core, test_conf_read);
+	tcase_add_test(tc_core, test_admission_check);
+	tcase_add_test(tc_core, test_admission_run_ptests);
+	tcase_add_test(tc_core, test_admission_exclusive);
+	tcase_add_test(tc_core, test_admission_locks);
+
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -0,0 +1,225 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <check.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "ptest_list.h"
+#include "utils.h"
+
+extern Suite *cache_suite(void);
+
+#define CACHE_FILENAME "./test.cache"
+
+static char tree[] = "/tmp/ptest-cache-XXXXXX";
+
+static void
+tree_add(const char *package, int ptest)
+{
+	char path[PATH_MAX];
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", tree, package);
+	mkdir(path, 0755);
+	if (!ptest)
+		return;
+
+	snprintf(path, sizeof(path), "%s/%s/ptest", tree, package);
+	mkdir(path, 0755);
+	snprintf(path, sizeof(path), "%s/%s/ptest/run-ptest", tree, package);
+	fd = open(path, O_WRONLY | O_CREAT, 0755);
+	ck_assert(fd != -1);
+	close(fd);
+}
+
+/* Moves the mtimes to the past, otherwise the cache doesn't trust them. */
+static void
+tree_age(const char *package)
+{
+	struct timespec times[2] = { { 1000, 0 }, { 1000, 0 } };
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s/%s", tree, package);
+	utimensat(AT_FDCWD, path, times, 0);
+	snprintf(path, sizeof(path), "%s/%s/ptest", tree, package);
+	utimensat(AT_FDCWD, path, times, 0);
+}
+
+static struct ptest_list *
+discover(struct ptest_cache **c)
+{
+	char *dirs[] = { tree };
+	struct ptest_list *head;
+
+	*c = cache_open(CACHE_FILENAME);
+	ck_assert(*c != NULL);
+	get_available_ptests_dirs(dirs, 1, &head, *c);
+	ck_assert(head != NULL);
+
+	return head;
+}
+
+START_TEST(test_cache_open_write)
+{
+	struct ptest_cache *c;
+	struct cache_root *r;
+	struct cache_entry *e;
+	struct stat st_buf;
+	FILE *fp;
+
+	unlink(CACHE_FILENAME);
+	c = cache_open(CACHE_FILENAME);
+	ck_assert(c != NULL);
+	ck_assert(c->roots_no == 0);
+	ck_assert(cache_root_search(c, "/usr/lib") == NULL);
+
+	memset(&st_buf, 0, sizeof(st_buf));
+	st_buf.st_dev = 1;
+	st_buf.st_ino = 2;
+	st_buf.st_mtim.tv_sec = 3;
+	st_buf.st_mtim.tv_nsec = 4;
+	r = cache_root_alloc("/usr/lib", &st_buf, 5);
+	ck_assert(r != NULL);
+	e = cache_root_add(r, "bash");
+	ck_assert(e != NULL);
+	e->flags = CACHE_ENTRY_PTEST_DIR | CACHE_ENTRY_PTEST;
+	e->run_ptest_ino = 6;
+	ck_assert(cache_root_add(r, "python3") != NULL);
+	ck_assert(cache_root_set(c, r) == 0);
+	ck_assert(cache_write(c) == 0);
+	cache_close(c);
+
+	c = cache_open(CACHE_FILENAME);
+	ck_assert(c != NULL);
+	ck_assert(c->dirty == 0);
+	r = cache_root_search(c, "/usr/lib");
+	ck_assert(r != NULL);
+	ck_assert(r->dev == 1 && r->ino == 2);
+	ck_assert(r->mtime.tv_sec == 3 && r->mtime.tv_nsec == 4);
+	ck_assert(r->scanned == 5);
+	ck_assert(r->entries_no == 2);
+	ck_assert(strcmp(r->entries[0].name, "bash") == 0);
+	ck_assert(r->entries[0].flags == (CACHE_ENTRY_PTEST_DIR | CACHE_ENTRY_PTEST));
+	ck_assert(r->entries[0].run_ptest_ino == 6);
+	ck_assert(strcmp(r->entries[1].name, "python3") == 0);
+	ck_assert(r->entries[1].flags == 0);
+	cache_close(c);
+
+	/* An invalid file is an empty cache. */
+	fp = fopen(CACHE_FILENAME, "w");
+	ck_assert(fp != NULL);
+	fprintf(fp, "not a cache file\n");
+	fclose(fp);
+	c = cache_open(CACHE_FILENAME);
+	ck_assert(c != NULL);
+	ck_assert(c->roots_no == 0);
+	cache_close(c);
+
+	unlink(CACHE_FILENAME);
+}
+END_TEST
+
+START_TEST(test_cache_discovery)
+{
+	struct ptest_cache *c;
+	struct ptest_list *head;
+	char path[PATH_MAX];
+
+	ck_assert(mkdtemp(tree) != NULL);
+	tree_add("bash", 1);
+	tree_add("glibc", 1);
+	tree_add("python3", 0);
+	tree_age("bash");
+	tree_age("glibc");
+	tree_age("python3");
+	tree_age(".");
+	unlink(CACHE_FILENAME);
+
+	head = discover(&c);
+	ck_assert(ptest_list_length(head) == 2);
+	ck_assert(ptest_list_search(head, "bash") != NULL);
+	ck_assert(ptest_list_search(head, "glibc") != NULL);
+	ck_assert(c->dirty == 1);
+	ck_assert(cache_write(c) == 0);
+	cache_close(c);
+	ptest_list_free_all(head);
+
+	/* Nothing changed, the cache is used as is. */
+	head = discover(&c);
+	ck_assert(ptest_list_length(head) == 2);
+	ck_assert(ptest_list_search(head, "bash") != NULL);
+	ck_assert(ptest_list_search(head, "glibc") != NULL);
+	ck_assert(c->dirty == 0);
+	cache_close(c);
+	ptest_list_free_all(head);
+
+	/* A ptest installed in an existing directory. */
+	tree_add("python3", 1);
+	head = discover(&c);
+	ck_assert(ptest_list_length(head) == 3);
+	ck_assert(ptest_list_search(head, "python3") != NULL);
+	ck_assert(c->dirty == 1);
+	ck_assert(cache_write(c) == 0);
+	cache_close(c);
+	ptest_list_free_all(head);
+
+	/* And one removed. */
+	snprintf(path, sizeof(path), "%s/glibc/ptest/run-ptest", tree);
+	unlink(path);
+	head = discover(&c);
+	ck_assert(ptest_list_length(head) == 2);
+	ck_assert(ptest_list_search(head, "glibc") == NULL);
+	cache_close(c);
+	ptest_list_free_all(head);
+
+	unlink(CACHE_FILENAME);
+	snprintf(path, sizeof(path), "rm -rf %s", tree);
+	ck_assert(system(path) == 0);
+}
+END_TEST
+
+Suite *
+cache_suite()
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("cache");
+	tc_core = tcase_create("Core");
+
+	tcase_add_test(tc_core, test_cache_open_write);
+	tcase_add_test(tc_core, test_cache_discovery);
+
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
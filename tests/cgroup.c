@@ -0,0 +1,147 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <check.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <sys/wait.h>
+
+#include "cgroup.h"
+
+extern Suite *cgroup_suite(void);
+
+static void
+self_group(char *group, size_t size)
+{
+	char line[4096];
+	FILE *fp;
+
+	group[0] = '\0';
+	fp = fopen("/proc/self/cgroup", "r");
+	ck_assert(fp != NULL);
+	while (fgets(line, sizeof(line), fp) != NULL)
+		if (strncmp(line, "0::", 3) == 0) {
+			line[strcspn(line, "\n")] = '\0';
+			snprintf(group, size, "%s", line + 3);
+		}
+	fclose(fp);
+}
+
+/* The runner is in a leaf of its own while the groups are open. */
+START_TEST(test_cgroup_open_close)
+{
+	struct ptest_cgroups *cg;
+	char before[4096], during[4096], after[4096], expected[64];
+	size_t len;
+
+	self_group(before, sizeof(before));
+	cg = cgroup_open(0, 0, 0, stderr);
+	if (cg == NULL)
+		return;
+
+	self_group(during, sizeof(during));
+	snprintf(expected, sizeof(expected), "/ptest-runner.%d/runner", (int) getpid());
+	len = strlen(during);
+	ck_assert(len >= strlen(expected));
+	ck_assert(strcmp(during + len - strlen(expected), expected) == 0);
+
+	cgroup_close(cg);
+	self_group(after, sizeof(after));
+	ck_assert(strcmp(before, after) == 0);
+}
+END_TEST
+
+START_TEST(test_cgroup_kill)
+{
+	struct ptest_cgroups *cg;
+	struct cgroup_stat st;
+	unsigned long seq;
+	int dfd, procs_fd;
+	char expected[64];
+	char *buf;
+	size_t size;
+	FILE *fp;
+	pid_t pid;
+
+	/* Not every system delegates a cgroup v2 hierarchy. */
+	cg = cgroup_open(0, 0, 0, stderr);
+	if (cg == NULL)
+		return;
+
+	dfd = cgroup_create(cg, &seq, &procs_fd);
+	ck_assert(dfd != -1);
+
+	pid = fork();
+	ck_assert(pid != -1);
+	if (pid == 0) {
+		if (write(procs_fd, "0", 1) != 1)
+			_exit(1);
+		execl("/bin/sleep", "sleep", "5", (char *) NULL);
+		_exit(1);
+	}
+	close(procs_fd);
+	/* Let it exec. */
+	usleep(200 * 1000);
+
+	fp = open_memstream(&buf, &size);
+	ck_assert(fp != NULL);
+	ck_assert(cgroup_kill(dfd, fp) == 1);
+	fclose(fp);
+
+	snprintf(expected, sizeof(expected), "LEFTOVER: %d (sleep) killed\n", (int) pid);
+	ck_assert(strcmp(buf, expected) == 0);
+	free(buf);
+
+	ck_assert(waitpid(pid, NULL, 0) == pid);
+	ck_assert(!cgroup_populated(dfd));
+	ck_assert(cgroup_kill(dfd, NULL) == 0);
+
+	cgroup_stat(dfd, &st);
+	ck_assert(st.usage_us >= 0);
+
+	cgroup_remove(cg, dfd, seq);
+	cgroup_close(cg);
+}
+END_TEST
+
+Suite *
+cgroup_suite()
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("cgroup");
+	tc_core = tcase_create("Core");
+
+	tcase_add_test(tc_core, test_cgroup_open_close);
+	tcase_add_test(tc_core, test_cgroup_kill);
+
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
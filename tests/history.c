@@ -0,0 +1,194 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <check.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "history.h"
+
+extern Suite *history_suite(void);
+
+#define HISTORY_FILENAME "./test.history"
+
+static void
+write_header(uint32_t size, long length)
+{
+	struct history_header header;
+	FILE *fp;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, HISTORY_MAGIC, sizeof(header.magic));
+	header.version = HISTORY_VERSION;
+	header.size = size;
+
+	fp = fopen(HISTORY_FILENAME, "w");
+	ck_assert(fp != NULL);
+	ck_assert(fwrite(&header, sizeof(header), 1, fp) == 1);
+	ck_assert(ftruncate(fileno(fp), length) == 0);
+	fclose(fp);
+}
+
+START_TEST(test_history_open_close)
+{
+	struct ptest_history *h;
+	FILE *fp;
+
+	unlink(HISTORY_FILENAME);
+	h = history_open(HISTORY_FILENAME);
+	ck_assert(h != NULL);
+	ck_assert(history_search(h, "perl") == NULL);
+	history_close(h);
+
+	/* Reopen the created file. */
+	h = history_open(HISTORY_FILENAME);
+	ck_assert(h != NULL);
+	history_close(h);
+
+	fp = fopen(HISTORY_FILENAME, "w");
+	ck_assert(fp != NULL);
+	fprintf(fp, "not a history file, but long enough to have a header\n");
+	fclose(fp);
+	ck_assert(history_open(HISTORY_FILENAME) == NULL);
+	ck_assert(errno == EINVAL);
+
+	/* A broken table is discarded: no slots, a size that isn't a power
+	 * of two and a file shorter than the table. */
+	write_header(0, 4096);
+	h = history_open(HISTORY_FILENAME);
+	ck_assert(h != NULL);
+	ck_assert_int_eq(h->header->size, HISTORY_MIN_SIZE);
+	ck_assert(history_add(h, "perl", 1000, 0, 0) == 0);
+	history_close(h);
+
+	write_header(HISTORY_MIN_SIZE + 1, 1 << 20);
+	h = history_open(HISTORY_FILENAME);
+	ck_assert(h != NULL);
+	ck_assert_int_eq(h->header->size, HISTORY_MIN_SIZE);
+	history_close(h);
+
+	write_header(HISTORY_MIN_SIZE * 2, sizeof(struct history_header));
+	h = history_open(HISTORY_FILENAME);
+	ck_assert(h != NULL);
+	ck_assert_int_eq(h->header->size, HISTORY_MIN_SIZE);
+	ck_assert(history_search(h, "perl") == NULL);
+	history_close(h);
+
+	unlink(HISTORY_FILENAME);
+}
+END_TEST
+
+START_TEST(test_history_add)
+{
+	struct ptest_history *h;
+	struct history_entry *e;
+	const struct history_run *r;
+	unsigned int i;
+
+	unlink(HISTORY_FILENAME);
+	h = history_open(HISTORY_FILENAME);
+	ck_assert(h != NULL);
+
+	ck_assert(history_expected_duration(h, "glibc") == -1);
+	for (i = 1; i <= HISTORY_RUNS + 2; i++)
+		ck_assert(history_add(h, "glibc", i * 1000, 0, 0) == 0);
+	ck_assert(history_add(h, "hang", 300000, -1, 1) == 0);
+
+	e = history_search(h, "glibc");
+	ck_assert(e != NULL);
+	ck_assert_int_eq(e->runs, HISTORY_RUNS + 2);
+	r = history_last(e);
+	ck_assert_int_eq(r->duration, (HISTORY_RUNS + 2) * 1000);
+	/* Only the last HISTORY_RUNS are kept, 3..10 seconds. */
+	ck_assert_int_eq(history_expected_duration(h, "glibc"), 6500);
+
+	r = history_last(history_search(h, "hang"));
+	ck_assert(r != NULL && r->timeouted == 1 && r->status == -1);
+	history_close(h);
+
+	/* The runs survive reopening the file. */
+	h = history_open(HISTORY_FILENAME);
+	ck_assert(h != NULL);
+	ck_assert_int_eq(history_expected_duration(h, "hang"), 300000);
+	history_close(h);
+
+	unlink(HISTORY_FILENAME);
+}
+END_TEST
+
+START_TEST(test_history_grow)
+{
+	struct ptest_history *h, *h2;
+	char ptest[HISTORY_PTEST_MAX];
+	int i, n = HISTORY_MIN_SIZE * 4;
+
+	unlink(HISTORY_FILENAME);
+	h = history_open(HISTORY_FILENAME);
+	ck_assert(h != NULL);
+	h2 = history_open(HISTORY_FILENAME);
+	ck_assert(h2 != NULL);
+	ck_assert(history_add(h2, "first", 1, 0, 0) == 0);
+
+	for (i = 0; i < n; i++) {
+		snprintf(ptest, sizeof(ptest), "ptest%d", i);
+		ck_assert(history_add(h, ptest, (unsigned int) i, 0, 0) == 0);
+	}
+	ck_assert(h->header->size > HISTORY_MIN_SIZE);
+
+	/* A second runner sharing the file follows it to the grown table
+	 * and the runs it added before are still there. */
+	for (i = 0; i < n; i++) {
+		snprintf(ptest, sizeof(ptest), "ptest%d", i);
+		ck_assert_int_eq(history_expected_duration(h2, ptest), i);
+	}
+	ck_assert_int_eq(history_expected_duration(h2, "first"), 1);
+	ck_assert(history_add(h2, "last", 2, 0, 0) == 0);
+	ck_assert_int_eq(history_expected_duration(h, "last"), 2);
+
+	history_close(h2);
+	history_close(h);
+	unlink(HISTORY_FILENAME);
+}
+END_TEST
+
+Suite *
+history_suite()
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("history");
+	tc_core = tcase_create("Core");
+
+	tcase_add_test(tc_core, test_history_open_close);
+	tcase_add_test(tc_core, test_history_add);
+	tcase_add_test(tc_core, test_history_grow);
+
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
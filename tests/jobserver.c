@@ -0,0 +1,145 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <check.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "jobserver.h"
+#include "ptest_list.h"
+#include "utils.h"
+
+extern Suite *jobserver_suite(void);
+
+START_TEST(test_jobserver_tokens)
+{
+	struct ptest_jobserver *js;
+	char *makeflags = getenv("MAKEFLAGS");
+
+	if (makeflags != NULL)
+		makeflags = strdup(makeflags);
+	setenv("MAKEFLAGS", "-k", 1);
+	js = jobserver_open(3);
+	ck_assert(js != NULL);
+	ck_assert(strcmp(getenv("MAKEFLAGS"), "-k -j3 --jobserver-auth=3,4") == 0);
+	ck_assert(js->fds[0] > 4 && js->fds[1] > 4);
+
+	/* One job runs without a token. */
+	ck_assert(jobserver_acquire(js) == 1);
+	ck_assert(jobserver_acquire(js) == 1);
+	ck_assert(jobserver_acquire(js) == 0);
+	jobserver_release(js);
+	ck_assert(jobserver_acquire(js) == 1);
+
+	jobserver_close(js);
+	ck_assert(strcmp(getenv("MAKEFLAGS"), "-k") == 0);
+	if (makeflags != NULL)
+		setenv("MAKEFLAGS", makeflags, 1);
+	else
+		unsetenv("MAKEFLAGS");
+	free(makeflags);
+}
+END_TEST
+
+/* The ptests see the jobserver as fds 3 and 4, like make gives it. */
+START_TEST(test_jobserver_run_ptests)
+{
+	static const char script[] =
+		"#!/bin/sh\n"
+		"echo \"$MAKEFLAGS\"\n"
+		"head -c 1 <&3 && printf + >&4 && echo \" token\"\n";
+	char dir[] = "/tmp/ptest-jobserver-XXXXXX";
+	char path[PATH_MAX];
+	struct ptest_options opts;
+	struct ptest_list *head;
+	char *makeflags = getenv("MAKEFLAGS");
+	FILE *fp, *fp_stdout;
+	char *buf;
+	size_t size;
+
+	if (makeflags != NULL)
+		makeflags = strdup(makeflags);
+
+	ck_assert(mkdtemp(dir) != NULL);
+	snprintf(path, sizeof(path), "%s/make", dir);
+	ck_assert(mkdir(path, 0755) == 0);
+	snprintf(path, sizeof(path), "%s/make/ptest", dir);
+	ck_assert(mkdir(path, 0755) == 0);
+	snprintf(path, sizeof(path), "%s/make/ptest/run-ptest", dir);
+	fp = fopen(path, "w");
+	ck_assert(fp != NULL);
+	fputs(script, fp);
+	fclose(fp);
+	ck_assert(chmod(path, 0755) == 0);
+
+	memset(&opts, 0, sizeof(opts));
+	opts.timeout = 5;
+	opts.jobs = 2;
+	opts.jobserver = 1;
+
+	fp_stdout = open_memstream(&buf, &size);
+	ck_assert(fp_stdout != NULL);
+	head = get_available_ptests(dir);
+	ck_assert(ptest_list_length(head) == 1);
+	ck_assert(run_ptests(head, opts, "test_jobserver_run_ptests",
+			fp_stdout, fp_stdout) == 0);
+	fclose(fp_stdout);
+
+	ck_assert(strstr(buf, " -j2 --jobserver-auth=3,4\n") != NULL);
+	ck_assert(strstr(buf, "+ token\n") != NULL);
+	/* The MAKEFLAGS of the runner are restored. */
+	if (makeflags == NULL)
+		ck_assert(getenv("MAKEFLAGS") == NULL);
+	else
+		ck_assert(strcmp(getenv("MAKEFLAGS"), makeflags) == 0);
+	free(makeflags);
+
+	free(buf);
+	ptest_list_free_all(head);
+	snprintf(path, sizeof(path), "rm -rf %s", dir);
+	ck_assert(system(path) == 0);
+}
+END_TEST
+
+Suite *
+jobserver_suite()
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("jobserver");
+	tc_core = tcase_create("Core");
+
+	tcase_add_test(tc_core, test_jobserver_tokens);
+	tcase_add_test(tc_core, test_jobserver_run_ptests);
+
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -32,9 +32,29 @@ typedef Suite *(SuiteFunction)(void);
 
 extern Suite *ptest_list_suite(void);
 extern Suite *utils_suite(void);
+extern Suite *history_suite(void);
+extern Suite *cache_suite(void);
+extern Suite *queue_suite(void);
+extern Suite *jobserver_suite(void);
+extern Suite *admission_suite(void);
+extern Suite *snapshot_suite(void);
+extern Suite *cgroup_suite(void);
+extern Suite *sampler_suite(void);
+extern Suite *trace_suite(void);
+extern Suite *stats_suite(void);
 static SuiteFunction *suites[] = {
 	&ptest_list_suite,
 	&utils_suite,
+	&history_suite,
+	&cache_suite,
+	&queue_suite,
+	&jobserver_suite,
+	&admission_suite,
+	&snapshot_suite,
+	&cgroup_suite,
+	&sampler_suite,
+	&trace_suite,
+	&stats_suite,
 	NULL,
 };
 
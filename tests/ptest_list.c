@@ -26,6 +26,7 @@
 #include <stdio.h>
 #include <check.h>
 #include <errno.h>
+#include <sys/stat.h>
 
 #include "ptest_list.h"
 
@@ -145,6 +146,102 @@ START_TEST(test_remove)
 }
 END_TEST
 
+START_TEST(test_search_by_file)
+{
+	struct ptest_list *head = ptest_list_alloc();
+	struct stat st_buf, st_buf2;
+	struct ptest_list *p;
+
+	ck_assert(stat("./tests/data/python/ptest/run-ptest", &st_buf) == 0);
+	ck_assert(stat("./tests/data/glibc/ptest/run-ptest", &st_buf2) == 0);
+
+	ck_assert(ptest_list_search_by_file(head, "x", st_buf) == NULL);
+
+	/* Nodes added without a stat are found too. */
+	p = ptest_list_add(head, strdup("python"), strdup("./tests/data/python/ptest/run-ptest"));
+	ck_assert(p != NULL);
+	ck_assert(ptest_list_search_by_file(head,
+		"./tests/data/python3/ptest/run-ptest", st_buf) == p);
+	ck_assert(ptest_list_search_by_file(head,
+		"./tests/data/glibc/ptest/run-ptest", st_buf2) == NULL);
+
+	p = ptest_list_add_by_file(head, strdup("glibc"),
+		strdup("./tests/data/glibc/ptest/run-ptest"), st_buf2);
+	ck_assert(p != NULL);
+	ck_assert(ptest_list_search_by_file(head,
+		"./tests/data/glibc/ptest/run-ptest", st_buf2) == p);
+
+	ptest_list_remove(head, "glibc", 1);
+	ck_assert(ptest_list_search_by_file(head,
+		"./tests/data/glibc/ptest/run-ptest", st_buf2) == NULL);
+
+	ptest_list_free_all(head);
+}
+END_TEST
+
+START_TEST(test_extend)
+{
+	struct ptest_list *head = ptest_list_alloc();
+	struct ptest_list *extend = ptest_list_alloc();
+	struct ptest_list *p;
+	char ptest[32];
+	int i, n = 1000;
+
+	for (i = 0; i < n; i++) {
+		snprintf(ptest, sizeof(ptest), "ptest%d", i);
+		ck_assert(ptest_list_add(i % 2 ? extend : head, strdup(ptest), NULL) != NULL);
+	}
+
+	ck_assert(ptest_list_extend(head, extend) == head);
+	ck_assert_int_eq(ptest_list_length(head), n);
+
+	for (i = 0; i < n; i++) {
+		snprintf(ptest, sizeof(ptest), "ptest%d", i);
+		ck_assert(ptest_list_search(head, ptest) != NULL);
+	}
+
+	/* The tail follows removals and new nodes go after it. */
+	snprintf(ptest, sizeof(ptest), "ptest%d", n - 1);
+	ck_assert(ptest_list_remove(head, ptest, 1) == NULL);
+	ck_assert(ptest_list_add(head, strdup("last"), NULL) != NULL);
+	for (p = head->next; p->next != NULL; p = p->next)
+		ck_assert(p->next->prev == p);
+	ck_assert(strcmp(p->ptest, "last") == 0);
+	ck_assert_int_eq(ptest_list_length(head), n);
+
+	ptest_list_free_all(head);
+}
+END_TEST
+
+static int
+cmp_reverse(const struct ptest_list *a, const struct ptest_list *b)
+{
+	return strcmp(b->ptest, a->ptest);
+}
+
+START_TEST(test_sort)
+{
+	struct ptest_list *head = ptest_list_alloc();
+	struct ptest_list *p;
+	int i;
+
+	ck_assert(ptest_list_sort(NULL, cmp_reverse) == -1);
+	ck_assert(errno == EINVAL);
+
+	for (i = 0; i < ptests_num; i++)
+		ptest_list_add(head, strdup(ptest_names[i]), NULL);
+
+	ck_assert(ptest_list_sort(head, cmp_reverse) == 0);
+	ck_assert_int_eq(ptest_list_length(head), ptests_num);
+	for (p = head->next; p->next != NULL; p = p->next) {
+		ck_assert(p->next->prev == p);
+		ck_assert(strcmp(p->ptest, p->next->ptest) > 0);
+	}
+
+	ptest_list_free_all(head);
+}
+END_TEST
+
 Suite *
 ptest_list_suite()
 {
@@ -160,6 +257,9 @@ ptest_list_suite()
 	tcase_add_test(tc_core, test_length);
 	tcase_add_test(tc_core, test_search);
 	tcase_add_test(tc_core, test_remove);
+	tcase_add_test(tc_core, test_search_by_file);
+	tcase_add_test(tc_core, test_extend);
+	tcase_add_test(tc_core, test_sort);
 
 	suite_add_tcase(s, tc_core);
 
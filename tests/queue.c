@@ -0,0 +1,95 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <check.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "queue.h"
+
+extern Suite *queue_suite(void);
+
+#define QUEUE_DIR "./test.queue"
+
+START_TEST(test_queue_claim)
+{
+	struct ptest_queue *q, *q2;
+	struct stat st_buf;
+	int fd, fd2;
+
+	ck_assert(system("rm -rf " QUEUE_DIR) == 0);
+	q = queue_open(QUEUE_DIR);
+	ck_assert(q != NULL);
+	q2 = queue_open(QUEUE_DIR);
+	ck_assert(q2 != NULL);
+
+	fd = queue_claim(q, "bash");
+	ck_assert(fd != -1);
+
+	/* Held by the first runner. */
+	ck_assert(queue_claim(q2, "bash") == -1);
+	ck_assert(errno == EBUSY);
+
+	ck_assert(queue_done(q, "bash", 0, 1, 0) == 0);
+	close(fd);
+	ck_assert(stat(QUEUE_DIR "/done/bash", &st_buf) == 0);
+	ck_assert(queue_claim(q2, "bash") == -1);
+	ck_assert(errno == EALREADY);
+
+	/* A runner going away without a result leaves the ptest to others. */
+	fd = queue_claim(q, "glibc");
+	ck_assert(fd != -1);
+	close(fd);
+	fd2 = queue_claim(q2, "glibc");
+	ck_assert(fd2 != -1);
+	ck_assert(queue_claim(q, "glibc") == -1);
+	ck_assert(errno == EBUSY);
+	close(fd2);
+
+	queue_close(q2);
+	queue_close(q);
+	ck_assert(system("rm -rf " QUEUE_DIR) == 0);
+}
+END_TEST
+
+Suite *
+queue_suite()
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("queue");
+	tc_core = tcase_create("Core");
+
+	tcase_add_test(tc_core, test_queue_claim);
+
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
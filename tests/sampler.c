@@ -0,0 +1,104 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <check.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <sys/wait.h>
+
+#include "sampler.h"
+
+extern Suite *sampler_suite(void);
+
+START_TEST(test_sampler_scan)
+{
+	struct sample samples[2];
+	pid_t sids[2];
+	pid_t pid;
+
+	pid = fork();
+	ck_assert(pid != -1);
+	if (pid == 0) {
+		setsid();
+		execl("/bin/sh", "sh", "-c", "while :; do :; done", (char *) NULL);
+		_exit(1);
+	}
+	/* Let it spin. */
+	usleep(300 * 1000);
+
+	sids[0] = pid;
+	sids[1] = -1;
+	sampler_scan(sids, samples, 2);
+
+	ck_assert(samples[0].processes == 1);
+	ck_assert(samples[0].threads == 1);
+	ck_assert(samples[0].rss_kib > 0);
+	ck_assert(samples[0].cpu_us > 0);
+	ck_assert(samples[1].processes == 0);
+
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+}
+END_TEST
+
+START_TEST(test_sampler_write)
+{
+	struct sample prev = { 1000000, 100, 0, 0, 1, 1 };
+	struct sample cur = { 1500000, 2048, 4096, 8192, 3, 2 };
+	char *buf;
+	size_t size;
+	FILE *fp;
+
+	fp = open_memstream(&buf, &size);
+	ck_assert(fp != NULL);
+	sampler_write(fp, 2000, 1000000, &prev, &cur);
+	/* Less CPU time than before, a process exited. */
+	sampler_write(fp, 3000, 1000000, &cur, &prev);
+	fclose(fp);
+
+	ck_assert(strcmp(buf, "2000 50.0 2048 4 8 3 2\n"
+		"3000 0.0 100 0 0 1 1\n") == 0);
+	free(buf);
+}
+END_TEST
+
+Suite *
+sampler_suite()
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("sampler");
+	tc_core = tcase_create("Core");
+
+	tcase_add_test(tc_core, test_sampler_scan);
+	tcase_add_test(tc_core, test_sampler_write);
+
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -0,0 +1,91 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <check.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/wait.h>
+
+#include "snapshot.h"
+
+extern Suite *snapshot_suite(void);
+
+START_TEST(test_snapshot_write)
+{
+	struct timespec since;
+	char expected[64];
+	char *buf;
+	size_t size;
+	FILE *fp;
+	pid_t pid;
+
+	clock_gettime(CLOCK_MONOTONIC, &since);
+	pid = fork();
+	ck_assert(pid != -1);
+	if (pid == 0) {
+		setsid();
+		execl("/bin/sleep", "sleep", "5", (char *) NULL);
+		_exit(1);
+	}
+	/* Let it exec. */
+	usleep(200 * 1000);
+
+	fp = open_memstream(&buf, &size);
+	ck_assert(fp != NULL);
+	ck_assert(snapshot_write(pid, &since, fp) == 1);
+	fclose(fp);
+
+	snprintf(expected, sizeof(expected), "PROCESS: %d ppid %d state ",
+		(int) pid, (int) getpid());
+	ck_assert(strstr(buf, expected) != NULL);
+	ck_assert(strstr(buf, "  cmdline: sleep 5\n") != NULL);
+	ck_assert(strstr(buf, "  fd: 0 -> ") != NULL);
+	ck_assert(strstr(buf, "\nDMESG: ") != NULL);
+	ck_assert(strstr(buf, "END SNAPSHOT\n") != NULL);
+
+	free(buf);
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+}
+END_TEST
+
+Suite *
+snapshot_suite()
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("snapshot");
+	tc_core = tcase_create("Core");
+
+	tcase_add_test(tc_core, test_snapshot_write);
+
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
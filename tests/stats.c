@@ -0,0 +1,95 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <check.h>
+
+#include "stats.h"
+
+extern Suite *stats_suite(void);
+
+START_TEST(test_stats_print)
+{
+	struct ptest_stats s;
+	struct rusage ru;
+	char *buf;
+	size_t size;
+	FILE *fp;
+
+	memset(&s, 0, sizeof(s));
+	memset(&ru, 0, sizeof(ru));
+	s.discovery_ns = 12000000;
+	s.ptests_found = 3;
+	s.spawns = 2;
+	s.spawn_ns = 3000000;
+	s.spawn_max_ns = 2000000;
+	s.bytes_forwarded = 2 * 1024 * 1024;
+	s.forwards = 4;
+	s.wakeups = 10;
+	s.run_ns = 2000000000;
+	ru.ru_utime.tv_usec = 500000;
+	ru.ru_maxrss = 4096;
+
+	fp = open_memstream(&buf, &size);
+	ck_assert(fp != NULL);
+	stats_print(fp, &s, &ru);
+	fclose(fp);
+
+	ck_assert(strstr(buf, "STATS: discovery 0.012s 3 ptests\n") != NULL);
+	ck_assert(strstr(buf, "STATS: spawn 2 mean 1.500ms max 2.000ms\n") != NULL);
+	ck_assert(strstr(buf, "STATS: forwarded 2097152 bytes in 4 reads, 1.000 MiB/s\n") != NULL);
+	ck_assert(strstr(buf, "STATS: wakeups 10, 5.0/s\n") != NULL);
+	ck_assert(strstr(buf, "STATS: run 2.000s user 0.500s sys 0.000s maxrss 4096KiB") != NULL);
+	free(buf);
+
+	fp = open_memstream(&buf, &size);
+	ck_assert(fp != NULL);
+	ck_assert(stats_write_json(fp, &s, &ru) == 0);
+	fclose(fp);
+
+	ck_assert(strncmp(buf, "{\n", 2) == 0);
+	ck_assert(strstr(buf, "\t\"discovery_ns\": 12000000,\n") != NULL);
+	ck_assert(strstr(buf, "\t\"bytes_forwarded\": 2097152,\n") != NULL);
+	ck_assert(strstr(buf, "\t\"user_us\": 500000,\n") != NULL);
+	ck_assert(strstr(buf, "\t\"nivcsw\": 0\n}\n") != NULL);
+	free(buf);
+}
+END_TEST
+
+Suite *
+stats_suite()
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("stats");
+	tc_core = tcase_create("Core");
+
+	tcase_add_test(tc_core, test_stats_print);
+
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
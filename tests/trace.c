@@ -0,0 +1,99 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <check.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+extern Suite *trace_suite(void);
+
+START_TEST(test_trace_events)
+{
+	char filename[] = "/tmp/ptest-trace-XXXXXX";
+	struct timespec start;
+	char buf[4096];
+	size_t n;
+	FILE *fp;
+	int fd;
+
+	fd = mkstemp(filename);
+	ck_assert(fd != -1);
+	close(fd);
+
+	/* Nothing is written before the trace is open. */
+	ck_assert(!trace_enabled());
+	trace_instant(1, "runner", "lost");
+
+	ck_assert(trace_open(filename) == 0);
+	ck_assert(trace_enabled());
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	trace_lane(TRACE_LANE_JOB(0), "job 1");
+	trace_spanf(TRACE_LANE_JOB(0), "ptest", "a \"quoted\"\tname", &start,
+		"\"status\":%d", 1);
+	trace_instant(TRACE_LANE_JOB(0), "runner", "timeout");
+	trace_instantf(TRACE_LANE_JOB(0), "runner", "SIGTERM", "\"grace\":%u", 5u);
+	trace_counter("bash", "\"cpu_pct\":%.1f", 12.5);
+	trace_close();
+	ck_assert(!trace_enabled());
+
+	fp = fopen(filename, "r");
+	ck_assert(fp != NULL);
+	n = fread(buf, 1, sizeof(buf) - 1, fp);
+	buf[n] = '\0';
+	fclose(fp);
+	unlink(filename);
+
+	ck_assert(strncmp(buf, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", 40) == 0);
+	ck_assert(strstr(buf, "\"name\":\"thread_name\",\"args\":{\"name\":\"job 1\"}}") != NULL);
+	ck_assert(strstr(buf, "\"ph\":\"X\"") != NULL);
+	ck_assert(strstr(buf, "\"name\":\"a \\\"quoted\\\"\\u0009name\",\"dur\":") != NULL);
+	ck_assert(strstr(buf, "\"args\":{\"status\":1}}") != NULL);
+	ck_assert(strstr(buf, "\"name\":\"timeout\",\"s\":\"t\"}") != NULL);
+	ck_assert(strstr(buf, "\"name\":\"SIGTERM\",\"s\":\"t\",\"args\":{\"grace\":5}}") != NULL);
+	ck_assert(strstr(buf, "\"ph\":\"C\"") != NULL);
+	ck_assert(strstr(buf, "\"args\":{\"cpu_pct\":12.5}}") != NULL);
+	ck_assert(strstr(buf, "lost") == NULL);
+	ck_assert(strcmp(buf + n - 4, "\n]}\n") == 0);
+}
+END_TEST
+
+Suite *
+trace_suite()
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("trace");
+	tc_core = tcase_create("Core");
+
+	tcase_add_test(tc_core, test_trace_events);
+
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
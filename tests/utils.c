@@ -27,9 +27,20 @@
 #include <stdio.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <limits.h>
+#include <time.h>
+
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 
 #include <check.h>
 
+#include "history.h"
 #include "ptest_list.h"
 #include "utils.h"
 
@@ -37,6 +48,10 @@ Suite *utils_suite(void);
 
 #define PRINT_PTEST_BUF_SIZE 8192
 
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
 static char *opts_directory = NULL;
 
 void set_opts_dir(char * od) {
@@ -90,6 +105,30 @@ START_TEST(test_get_available_ptests)
 }
 END_TEST
 
+START_TEST(test_get_available_ptests_dirs)
+{
+	char *dirs[] = { opts_directory, "/nonexistent", opts_directory };
+	struct ptest_list *heads[3];
+	struct ptest_list *n;
+
+	get_available_ptests_dirs(dirs, 3, heads, NULL);
+
+	ck_assert(heads[1] == NULL);
+	ck_assert(ptest_list_length(heads[0]) == ptests_found_length);
+	ck_assert(ptest_list_length(heads[2]) == ptests_found_length);
+
+	/* Same order as scandir() with alphasort(). */
+	n = heads[0]->next;
+	while (n != NULL && n->next != NULL) {
+		ck_assert(strcoll(n->ptest, n->next->ptest) < 0);
+		n = n->next;
+	}
+
+	ptest_list_free_all(heads[0]);
+	ptest_list_free_all(heads[2]);
+}
+END_TEST
+
 START_TEST(test_print_ptests)
 {
 	struct ptest_list *head;
@@ -164,6 +203,111 @@ START_TEST(test_filter_ptests)
 }
 END_TEST
 
+static void
+check_order(struct ptest_list *head, char **order)
+{
+	struct ptest_list *p;
+	int i = 0;
+
+	PTEST_LIST_ITERATE_START(head, p)
+		ck_assert(order[i] != NULL);
+		ck_assert(strcmp(p->ptest, order[i]) == 0);
+		i++;
+	PTEST_LIST_ITERATE_END
+	ck_assert(order[i] == NULL);
+}
+
+START_TEST(test_sort_ptests)
+{
+	struct ptest_list *head = get_available_ptests(opts_directory);
+	struct ptest_options opts = EmptyOpts;
+	struct ptest_history *h;
+	char *longest_first[] = {
+		"glibc", "python", "gcc", "bash", "fail", "hang", NULL,
+	};
+	char *shortest_first[] = {
+		"gcc", "python", "glibc", "bash", "fail", "hang", NULL,
+	};
+
+	unlink("./test.history");
+	h = history_open("./test.history");
+	ck_assert(h != NULL);
+	history_add(h, "glibc", 5000, 0, 0);
+	history_add(h, "gcc", 1000, 0, 0);
+	history_add(h, "python", 2000, 0, 0);
+	history_add(h, "python", 4000, 0, 0);
+	history_close(h);
+
+	/* Without history the discovery order is kept. */
+	opts.order = PTEST_ORDER_LONGEST_FIRST;
+	ck_assert(sort_ptests(head, opts) == 0);
+	check_order(head, ptests_found);
+
+	opts.history_filename = "./test.history";
+	ck_assert(sort_ptests(head, opts) == 0);
+	check_order(head, longest_first);
+
+	opts.order = PTEST_ORDER_SHORTEST_FIRST;
+	ck_assert(sort_ptests(head, opts) == 0);
+	check_order(head, shortest_first);
+
+	ptest_list_free_all(head);
+	unlink("./test.history");
+}
+END_TEST
+
+START_TEST(test_shard_ptests)
+{
+	struct ptest_list *shards[3];
+	struct ptest_options opts = EmptyOpts;
+	struct ptest_history *h;
+	int count, i, j, found;
+
+	unlink("./test.history");
+	h = history_open("./test.history");
+	ck_assert(h != NULL);
+	history_add(h, "glibc", 5000, 0, 0);
+	history_add(h, "python", 3000, 0, 0);
+	history_add(h, "gcc", 1000, 0, 0);
+	history_close(h);
+
+	/* Every ptest ends in exactly one shard, with and without history. */
+	for (count = 1; count <= 3; count++) {
+		opts.history_filename = count == 2 ? "./test.history" : NULL;
+		opts.shard_count = count;
+		for (j = 0; j < count; j++) {
+			shards[j] = get_available_ptests(opts_directory);
+			opts.shard_index = j;
+			ck_assert(shard_ptests(shards[j], opts) == 0);
+		}
+
+		for (i = 0; ptests_found[i] != NULL; i++) {
+			found = 0;
+			for (j = 0; j < count; j++)
+				found += ptest_list_search(shards[j], ptests_found[i]) != NULL;
+			ck_assert(found == 1);
+		}
+
+		if (count == 2) {
+			/* Longest first to the shard with less work. */
+			ck_assert(ptest_list_search(shards[0], "glibc") != NULL);
+			ck_assert(ptest_list_search(shards[1], "python") != NULL);
+			ck_assert(ptest_list_search(shards[1], "gcc") != NULL);
+		}
+
+		for (j = 0; j < count; j++)
+			ptest_list_free_all(shards[j]);
+	}
+
+	shards[0] = ptest_list_alloc();
+	opts.shard_index = 3;
+	ck_assert(shard_ptests(shards[0], opts) == -1);
+	ptest_list_free_all(shards[0]);
+
+	unlink("./test.history");
+}
+END_TEST
+
 START_TEST(test_run_ptests)
 {
 	struct ptest_list *head;
@@ -198,6 +342,176 @@ START_TEST(test_run_ptests)
 }
 END_TEST
 
+START_TEST(test_run_parallel_ptests)
+{
+	struct ptest_list *head;
+	struct ptest_options opts = EmptyOpts;
+	opts.timeout = 5;
+	opts.jobs = 3;
+	int rc;
+
+	char *buf_stdout;
+	size_t size_stdout = PRINT_PTEST_BUF_SIZE;
+	FILE *fp_stdout;
+	char *buf_stderr;
+	size_t size_stderr = PRINT_PTEST_BUF_SIZE;
+	FILE *fp_stderr;
+
+	char line_buf[PRINT_PTEST_BUF_SIZE];
+	char begin[PRINT_PTEST_BUF_SIZE];
+	int begins = 0, ends = 0;
+
+	fp_stdout = open_memstream(&buf_stdout, &size_stdout);
+	ck_assert(fp_stdout != NULL);
+	fp_stderr = open_memstream(&buf_stderr, &size_stderr);
+	ck_assert(fp_stderr != NULL);
+
+	head = get_available_ptests(opts_directory);
+	ptest_list_remove(head, "hang", 1);
+
+	rc = run_ptests(head, opts, "test_run_parallel_ptests", fp_stdout, fp_stderr);
+	ck_assert(rc == 1);
+
+	/* Output of concurrent ptests must not be interleaved. */
+	begin[0] = '\0';
+	while (fgets(line_buf, PRINT_PTEST_BUF_SIZE, fp_stdout) != NULL) {
+		if (find_word(line_buf, "BEGIN: ")) {
+			ck_assert(begin[0] == '\0');
+			strcpy(begin, line_buf + strlen("BEGIN: "));
+			begins++;
+		} else if (find_word(line_buf, "END: ")) {
+			ck_assert(strcmp(begin, line_buf + strlen("END: ")) == 0);
+			begin[0] = '\0';
+			ends++;
+		}
+	}
+	ck_assert_int_eq(begins, ptest_list_length(head));
+	ck_assert_int_eq(ends, ptest_list_length(head));
+	ptest_list_free_all(head);
+
+	fclose(fp_stdout);
+	free(buf_stdout);
+	fclose(fp_stderr);
+	free(buf_stderr);
+}
+END_TEST
+
+START_TEST(test_run_ptests_log_dir)
+{
+	struct ptest_list *head;
+	struct ptest_options opts = EmptyOpts;
+	char *ptests[] = {"gcc", "fail"};
+	int rc;
+
+	char *buf_stdout;
+	size_t size_stdout = PRINT_PTEST_BUF_SIZE;
+	FILE *fp_stdout;
+	char *buf_stderr;
+	size_t size_stderr = PRINT_PTEST_BUF_SIZE;
+	FILE *fp_stderr;
+
+	char line_buf[PRINT_PTEST_BUF_SIZE];
+	FILE *fp;
+
+	fp_stdout = open_memstream(&buf_stdout, &size_stdout);
+	ck_assert(fp_stdout != NULL);
+	fp_stderr = open_memstream(&buf_stderr, &size_stderr);
+	ck_assert(fp_stderr != NULL);
+
+	head = get_available_ptests(opts_directory);
+	struct ptest_list *filtered = filter_ptests(head, ptests, 2);
+	ck_assert(filtered != NULL);
+
+	opts.timeout = 5;
+	opts.log_dir = "./test-logs";
+	rc = run_ptests(filtered, opts, "test_run_ptests_log_dir", fp_stdout, fp_stderr);
+	ck_assert(rc == 1);
+
+	/* The summary stays in stdout, the output goes to the log. */
+	while (fgets(line_buf, PRINT_PTEST_BUF_SIZE, fp_stdout) != NULL)
+		ck_assert(strcmp(line_buf, "gcc\n") != 0);
+
+	fp = fopen("./test-logs/gcc.log", "r");
+	ck_assert(fp != NULL);
+	ck_assert(fgets(line_buf, PRINT_PTEST_BUF_SIZE, fp) != NULL);
+	ck_assert(strcmp(line_buf, "gcc\n") == 0);
+	fclose(fp);
+
+	ck_assert(unlink("./test-logs/gcc.log") == 0);
+	ck_assert(unlink("./test-logs/fail.log") == 0);
+	rmdir("./test-logs");
+
+	ptest_list_free_all(filtered);
+	ptest_list_free_all(head);
+
+	fclose(fp_stdout);
+	free(buf_stdout);
+	fclose(fp_stderr);
+	free(buf_stderr);
+}
+END_TEST
+
+START_TEST(test_run_ptests_queue)
+{
+	struct ptest_list *head;
+	struct ptest_options opts = EmptyOpts;
+	char *ptests[] = {"gcc", "fail"};
+	struct stat st_buf;
+	int rc;
+
+	char *buf_stdout;
+	size_t size_stdout = PRINT_PTEST_BUF_SIZE;
+	FILE *fp_stdout;
+	char *buf_stderr;
+	size_t size_stderr = PRINT_PTEST_BUF_SIZE;
+	FILE *fp_stderr;
+
+	fp_stdout = open_memstream(&buf_stdout, &size_stdout);
+	ck_assert(fp_stdout != NULL);
+	fp_stderr = open_memstream(&buf_stderr, &size_stderr);
+	ck_assert(fp_stderr != NULL);
+
+	head = get_available_ptests(opts_directory);
+	struct ptest_list *filtered = filter_ptests(head, ptests, 2);
+	ck_assert(filtered != NULL);
+
+	ck_assert(system("rm -rf ./test-queue") == 0);
+	opts.timeout = 5;
+	opts.queue_dir = "./test-queue";
+	rc = run_ptests(filtered, opts, "test_run_ptests_queue", fp_stdout, fp_stderr);
+	ck_assert(rc == 1);
+	ck_assert(stat("./test-queue/done/gcc", &st_buf) == 0);
+	ck_assert(stat("./test-queue/done/fail", &st_buf) == 0);
+
+	/* A second runner finds nothing left to do and says so. */
+	rc = run_ptests(filtered, opts, "test_run_ptests_queue", fp_stdout, fp_stderr);
+	ck_assert(rc == 0);
+	fflush(fp_stdout);
+	fflush(fp_stderr);
+	ck_assert(strstr(buf_stdout, "STOP: test_run_ptests_queue\nSTART") != NULL);
+	ck_assert(strstr(buf_stdout, "\nQUEUE: 2 already done, skipped: ") != NULL);
+	ck_assert(strstr(buf_stderr, "WARNING: Every ptest is already done in the"
+		" queue ./test-queue") != NULL);
+
+	/* A queue that can't be opened leaves no XML file behind. */
+	opts.queue_dir = "./test-queue/done/gcc/queue";
+	opts.xml_filename = "./test-queue/queue.xml";
+	rc = run_ptests(filtered, opts, "test_run_ptests_queue", fp_stdout, fp_stderr);
+	ck_assert(rc == -1);
+	ck_assert(stat("./test-queue/queue.xml", &st_buf) == -1 && errno == ENOENT);
+
+	ck_assert(system("rm -rf ./test-queue") == 0);
+
+	ptest_list_free_all(filtered);
+	ptest_list_free_all(head);
+
+	fclose(fp_stdout);
+	free(buf_stdout);
+	fclose(fp_stderr);
+	free(buf_stderr);
+}
+END_TEST
+
 static void
 search_for_timeout_and_duration(const int rp, FILE *fp_stdout)
 {
@@ -230,6 +544,509 @@ START_TEST(test_run_timeout_duration_ptest)
 }
 END_TEST
 
+static char *
+run_hang(const struct ptest_options opts)
+{
+	struct ptest_list *head, *filtered;
+	char *progname = "hang";
+	char *buf;
+	size_t size;
+	FILE *fp;
+
+	head = get_available_ptests(opts_directory);
+	filtered = filter_ptests(head, &progname, 1);
+	ck_assert(ptest_list_length(filtered) == 1);
+
+	fp = open_memstream(&buf, &size);
+	ck_assert(fp != NULL);
+	ck_assert(run_ptests(filtered, opts, progname, fp, fp) == 1);
+	fclose(fp);
+
+	ptest_list_free_all(filtered);
+	ptest_list_free_all(head);
+
+	return buf;
+}
+
+/* hang prints nothing after it starts, only the limit of the run or
+ * of the whole suite stop it without -t. */
+START_TEST(test_run_max_duration_budget)
+{
+	struct ptest_options opts = EmptyOpts;
+	char xml[] = "/tmp/ptest-xml-XXXXXX";
+	char line[PRINT_PTEST_BUF_SIZE];
+	long long sec, nsec, maxrss;
+	double user, sys;
+	int found = 0, dot = 0, end = 0, n = 0;
+	char *buf, *c;
+	FILE *fp;
+
+	opts.max_duration = 1;
+	buf = run_hang(opts);
+	ck_assert(strstr(buf, "/hang/ptest (max-duration)") != NULL);
+	free(buf);
+
+	close(mkstemp(xml));
+	opts.max_duration = 0;
+	opts.budget = 1;
+	opts.xml_filename = xml;
+	buf = run_hang(opts);
+	ck_assert(strstr(buf, "/hang/ptest (budget)") != NULL);
+	/* The budget counts from the start of the run, the wall time of the
+	 * ptest depends on how long starting it took, only its format is
+	 * checked. */
+	c = strstr(buf, "\nUSAGE: wall ");
+	ck_assert(c != NULL);
+	ck_assert(sscanf(c, "\nUSAGE: wall %lld.%n%9lld%ns user %lfs sys %lfs maxrss %lldKiB%n",
+		&sec, &dot, &nsec, &end, &user, &sys, &maxrss, &n) == 5);
+	ck_assert(end - dot == 9);
+	ck_assert(sec >= 0 && user >= 0 && sys >= 0 && maxrss > 0);
+	ck_assert(strncmp(c + n, " minflt ", strlen(" minflt ")) == 0);
+	free(buf);
+
+	fp = fopen(xml, "r");
+	ck_assert(fp != NULL);
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		found |= strstr(line, "<failure type='budget'/>") != NULL;
+		found |= (strstr(line, "<property name='maxrss_kib' value='") != NULL) << 1;
+	}
+	fclose(fp);
+	ck_assert(found == 3);
+	unlink(xml);
+}
+END_TEST
+
+static void
+write_ptest(const char *dir, const char *name, const char *script)
+{
+	char path[PATH_MAX];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	ck_assert(mkdir(path, 0755) == 0);
+	snprintf(path, sizeof(path), "%s/%s/ptest", dir, name);
+	ck_assert(mkdir(path, 0755) == 0);
+	snprintf(path, sizeof(path), "%s/%s/ptest/run-ptest", dir, name);
+	fp = fopen(path, "w");
+	ck_assert(fp != NULL);
+	fputs(script, fp);
+	fclose(fp);
+	ck_assert(chmod(path, 0755) == 0);
+}
+
+/* term cleans up on SIGTERM within the grace period, daemon leaves a
+ * process in its own session behind. */
+START_TEST(test_run_grace_leftovers)
+{
+	char dir[] = "/tmp/ptest-grace-XXXXXX";
+	struct ptest_options opts = EmptyOpts;
+	struct ptest_list *head;
+	char cmd[PATH_MAX];
+	char *buf;
+	size_t size;
+	FILE *fp;
+
+	ck_assert(mkdtemp(dir) != NULL);
+	write_ptest(dir, "term", "#!/bin/sh\n"
+		"trap 'echo cleaned up; exit 1' TERM\n"
+		"echo started\n"
+		"while true; do sleep 0.1; done\n");
+	write_ptest(dir, "daemon", "#!/bin/sh\n"
+		"setsid sleep 60 < /dev/null > /dev/null 2>&1 &\n"
+		"sleep 0.5\n");
+
+	fp = open_memstream(&buf, &size);
+	ck_assert(fp != NULL);
+	head = get_available_ptests(dir);
+	ck_assert(ptest_list_length(head) == 2);
+	opts.timeout = 1;
+	opts.grace = 5;
+	ck_assert(run_ptests(head, opts, "test_run_grace_leftovers", fp, fp) == 1);
+	fclose(fp);
+
+	ck_assert(strstr(buf, "cleaned up\n") != NULL);
+	ck_assert(strstr(buf, " (sleep) killed\n") != NULL);
+
+	free(buf);
+	ptest_list_free_all(head);
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+	ck_assert(system(cmd) == 0);
+}
+END_TEST
+
+/* *
+ * stubborn ignores SIGTERM, it's killed once the grace period is over,
+ * background exits leaving a process in its session that the runner
+ * kills and reports.
+ * */
+START_TEST(test_run_grace_escalation)
+{
+	char dir[] = "/tmp/ptest-escalation-XXXXXX";
+	struct ptest_options opts = EmptyOpts;
+	struct ptest_list *head;
+	struct timespec start, end;
+	char cmd[PATH_MAX], comm[16];
+	long ms;
+	char *buf, *c;
+	size_t size;
+	int pid;
+	FILE *fp;
+
+	ck_assert(mkdtemp(dir) != NULL);
+	write_ptest(dir, "stubborn", "#!/bin/sh\n"
+		"trap '' TERM\n"
+		"echo started\n"
+		"sleep 30\n"
+		"echo survived\n");
+	write_ptest(dir, "background", "#!/bin/sh\n"
+		"(trap '' HUP; exec sleep 30) < /dev/null > /dev/null 2>&1 &\n"
+		"while [ \"$(cat /proc/$!/comm)\" != sleep ]; do sleep 0.01; done\n"
+		"echo started\n");
+
+	fp = open_memstream(&buf, &size);
+	ck_assert(fp != NULL);
+	head = get_available_ptests(dir);
+	ck_assert(ptest_list_length(head) == 2);
+	opts.timeout = 1;
+	opts.grace = 1;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ck_assert(run_ptests(head, opts, "test_run_grace_escalation", fp, fp) == 1);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	fclose(fp);
+
+	/* The timeout and then the whole grace period, not the sleep. */
+	ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+	ck_assert(ms >= 2000);
+	ck_assert(ms < 10000);
+	ck_assert(strstr(buf, "/stubborn/ptest\n") != NULL);
+	ck_assert(strstr(buf, "TIMEOUT: ") != NULL);
+	ck_assert(strstr(buf, "survived") == NULL);
+
+	c = strstr(buf, "LEFTOVER: ");
+	ck_assert(c != NULL);
+	ck_assert(sscanf(c, "LEFTOVER: %d (%15[^)]) killed\n", &pid, comm) == 2);
+	ck_assert(pid > 0);
+	ck_assert(strcmp(comm, "sleep") == 0);
+	ck_assert(kill(pid, 0) == -1 && errno == ESRCH);
+
+	free(buf);
+	ptest_list_free_all(head);
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+	ck_assert(system(cmd) == 0);
+}
+END_TEST
+
+/* The capture runs while hang is stopped and is cut after a second. */
+START_TEST(test_run_collect_timeout)
+{
+	char dir[] = "/tmp/ptest-collect-XXXXXX";
+	struct ptest_options opts = EmptyOpts;
+	char path[PATH_MAX];
+	char *old_path;
+	char *buf;
+	FILE *fp;
+
+	ck_assert(mkdtemp(dir) != NULL);
+	snprintf(path, sizeof(path), "%s/ptest-runner-collect-system-data", dir);
+	fp = fopen(path, "w");
+	ck_assert(fp != NULL);
+	fputs("#!/bin/sh\necho collected\nsleep 60\n", fp);
+	fclose(fp);
+	ck_assert(chmod(path, 0755) == 0);
+
+	old_path = strdup(getenv("PATH"));
+	snprintf(path, sizeof(path), "%s:%s", dir, old_path);
+	setenv("PATH", path, 1);
+
+	opts.timeout = 1;
+	opts.collect_timeout = 1;
+	buf = run_hang(opts);
+	ck_assert(strstr(buf, "SNAPSHOT: session ") != NULL);
+	ck_assert(strstr(buf, "/hang/ptest/run-ptest\n") != NULL);
+	ck_assert(strstr(buf, "collected\n") != NULL);
+	ck_assert(strstr(buf, "ERROR: System state capture took longer than 1s\n") != NULL);
+	ck_assert(strstr(buf, "TIMEOUT: ") != NULL);
+	free(buf);
+
+	setenv("PATH", old_path, 1);
+	free(old_path);
+	snprintf(path, sizeof(path), "rm -rf %s", dir);
+	ck_assert(system(path) == 0);
+}
+END_TEST
+
+/* slow is sampled every 100ms while it runs. */
+START_TEST(test_run_samples)
+{
+	char dir[] = "/tmp/ptest-samples-XXXXXX";
+	struct ptest_options opts = EmptyOpts;
+	struct ptest_list *head;
+	char path[PATH_MAX];
+	char line[256];
+	char *buf;
+	size_t size;
+	int lines = 0;
+	FILE *fp;
+
+	ck_assert(mkdtemp(dir) != NULL);
+	write_ptest(dir, "slow", "#!/bin/sh\n"
+		"sleep 0.5\n");
+
+	fp = open_memstream(&buf, &size);
+	ck_assert(fp != NULL);
+	head = get_available_ptests(dir);
+	snprintf(path, sizeof(path), "%s/samples", dir);
+	opts.timeout = 5;
+	opts.samples_dir = path;
+	opts.sample_interval = 100;
+	ck_assert(run_ptests(head, opts, "test_run_samples", fp, fp) == 0);
+	fclose(fp);
+	ck_assert(strstr(buf, "SAMPLES: ") != NULL);
+	free(buf);
+
+	snprintf(path, sizeof(path), "%s/samples/slow.samples", dir);
+	fp = fopen(path, "r");
+	ck_assert(fp != NULL);
+	ck_assert(fgets(line, sizeof(line), fp) != NULL);
+	ck_assert(strcmp(line, "# ptest slow interval 100ms\n") == 0);
+	ck_assert(fgets(line, sizeof(line), fp) != NULL);
+	while (fgets(line, sizeof(line), fp) != NULL)
+		lines++;
+	fclose(fp);
+	ck_assert(lines >= 3);
+
+	ptest_list_free_all(head);
+	snprintf(path, sizeof(path), "rm -rf %s", dir);
+	ck_assert(system(path) == 0);
+}
+END_TEST
+
+START_TEST(test_run_stats)
+{
+	char filename[] = "/tmp/ptest-stats-XXXXXX";
+	struct ptest_options opts = EmptyOpts;
+	struct ptest_list *head;
+	char json[4096];
+	char *buf;
+	size_t size, n;
+	FILE *fp;
+	int fd;
+
+	fd = mkstemp(filename);
+	ck_assert(fd != -1);
+	close(fd);
+
+	fp = open_memstream(&buf, &size);
+	ck_assert(fp != NULL);
+	head = get_available_ptests(opts_directory);
+	ptest_list_remove(head, "hang", 1);
+	ptest_list_remove(head, "fail", 1);
+	opts.timeout = 5;
+	opts.stats = 1;
+	opts.stats_filename = filename;
+	ck_assert(run_ptests(head, opts, "test_run_stats", fp, fp) == 0);
+	fclose(fp);
+
+	ck_assert(strstr(buf, "STATS: spawn ") != NULL);
+	ck_assert(strstr(buf, "STATS: forwarded ") != NULL);
+	ck_assert(strstr(buf, "STATS: epoll ") != NULL);
+	ck_assert(strstr(buf, "STATS: run ") != NULL);
+	ck_assert(strstr(buf, "STATS: run ") < strstr(buf, "STOP: test_run_stats"));
+	free(buf);
+
+	fp = fopen(filename, "r");
+	ck_assert(fp != NULL);
+	n = fread(json, 1, sizeof(json) - 1, fp);
+	json[n] = '\0';
+	fclose(fp);
+	unlink(filename);
+	ck_assert(strstr(json, "\"spawns\": ") != NULL);
+	ck_assert(strstr(json, "\"maxrss_kib\": ") != NULL);
+
+	ptest_list_free_all(head);
+}
+END_TEST
+
+/* Makes pidfd_open() fail with ENOSYS for the caller and its children. */
+static int
+block_pidfd_open(void)
+{
+	struct sock_filter filter[] = {
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr)),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_pidfd_open, 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ERRNO | ENOSYS),
+		BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+	};
+	struct sock_fprog prog = {
+		.len = sizeof(filter) / sizeof(filter[0]),
+		.filter = filter,
+	};
+
+	if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == -1)
+		return -1;
+
+	return prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog);
+}
+
+/* As on kernels before 5.3 the ptests are reaped from a signalfd, the
+ * filter only applies to a child of the test. */
+START_TEST(test_run_sigchld_fallback)
+{
+	char filename[] = "/tmp/ptest-sigchld-XXXXXX";
+	struct ptest_options opts = EmptyOpts;
+	struct ptest_list *head;
+	char line[PRINT_PTEST_BUF_SIZE];
+	int status, ends = 0;
+	pid_t pid;
+	FILE *fp;
+	int fd;
+
+	fd = mkstemp(filename);
+	ck_assert(fd != -1);
+
+	head = get_available_ptests(opts_directory);
+	ptest_list_remove(head, "hang", 1);
+	ptest_list_remove(head, "fail", 1);
+	opts.timeout = 5;
+	opts.jobs = 2;
+
+	pid = fork();
+	ck_assert(pid != -1);
+	if (pid == 0) {
+		if (block_pidfd_open() == -1 || (fp = fdopen(fd, "w")) == NULL)
+			_exit(77);
+		status = run_ptests(head, opts, "test_run_sigchld_fallback", fp, fp);
+		fclose(fp);
+		_exit(status == 0 ? 0 : 1);
+	}
+	close(fd);
+	ck_assert(waitpid(pid, &status, 0) == pid);
+	ck_assert(WIFEXITED(status));
+
+	/* Without seccomp there's no way to reach the fallback. */
+	if (WEXITSTATUS(status) != 77) {
+		ck_assert_int_eq(WEXITSTATUS(status), 0);
+		fp = fopen(filename, "r");
+		ck_assert(fp != NULL);
+		while (fgets(line, sizeof(line), fp) != NULL)
+			ends += find_word(line, "END: ");
+		fclose(fp);
+		ck_assert_int_eq(ends, ptest_list_length(head));
+	}
+
+	unlink(filename);
+	ptest_list_free_all(head);
+}
+END_TEST
+
+/* *
+ * daemon leaves a process in its own session holding the output pipe,
+ * it writes long after daemon exited. The ptest still ends when its
+ * child does and the late output doesn't land after its END, while
+ * chatty keeps writing next to it. The process didn't run alone, it's
+ * killed once chatty ends as well but isn't put on chatty.
+ * */
+START_TEST(test_run_grandchild_output)
+{
+	char dir[] = "/tmp/ptest-grandchild-XXXXXX";
+	struct ptest_options opts = EmptyOpts;
+	struct ptest_list *head;
+	struct timespec start, end;
+	char line[PRINT_PTEST_BUF_SIZE];
+	char cmd[PATH_MAX];
+	int inside = 0, ends = 0, leftovers = 0;
+	char *buf;
+	size_t size;
+	FILE *fp;
+
+	ck_assert(mkdtemp(dir) != NULL);
+	write_ptest(dir, "daemon", "#!/bin/sh\n"
+		"setsid sh -c 'sleep 3; echo late' &\n"
+		"while [ \"$(cat /proc/$!/comm)\" != sh ]; do sleep 0.01; done\n"
+		"echo early\n");
+	write_ptest(dir, "chatty", "#!/bin/sh\n"
+		"for i in 1 2 3 4 5 6 7 8 9 10; do echo chatty $i; sleep 0.05; done\n");
+
+	fp = open_memstream(&buf, &size);
+	ck_assert(fp != NULL);
+	head = get_available_ptests(dir);
+	ck_assert(ptest_list_length(head) == 2);
+	opts.timeout = 5;
+	opts.jobs = 2;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ck_assert(run_ptests(head, opts, "test_run_grandchild_output", fp, fp) == 0);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	fclose(fp);
+
+	ck_assert(end.tv_sec - start.tv_sec < 2);
+	ck_assert(strstr(buf, "early\n") != NULL);
+	ck_assert(strstr(buf, "chatty 10\n") != NULL);
+	ck_assert(strstr(buf, "late") == NULL);
+
+	/* Out of a BEGIN and its END only the times and START/STOP. */
+	fp = fmemopen(buf, size, "r");
+	ck_assert(fp != NULL);
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (find_word(line, "BEGIN: ")) {
+			ck_assert(!inside);
+			inside = 1;
+		} else if (find_word(line, "END: ")) {
+			ck_assert(inside);
+			inside = 0;
+			ends++;
+		} else if (find_word(line, "LEFTOVER: ")) {
+			ck_assert(!inside);
+			leftovers++;
+		} else if (!inside) {
+			ck_assert(find_word(line, "20") || find_word(line, "START: ") ||
+				find_word(line, "STOP: "));
+		}
+	}
+	fclose(fp);
+	ck_assert_int_eq(ends, 2);
+	ck_assert(leftovers >= 1);
+
+	free(buf);
+	ptest_list_free_all(head);
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+	ck_assert(system(cmd) == 0);
+}
+END_TEST
+
+/* -t 0 disables the inactivity timeout, quiet prints nothing for longer
+ * than a second. */
+START_TEST(test_run_no_timeout)
+{
+	char dir[] = "/tmp/ptest-no-timeout-XXXXXX";
+	struct ptest_options opts = EmptyOpts;
+	struct ptest_list *head;
+	char cmd[PATH_MAX];
+	char *buf;
+	size_t size;
+	FILE *fp;
+
+	ck_assert(mkdtemp(dir) != NULL);
+	write_ptest(dir, "quiet", "#!/bin/sh\n"
+		"sleep 1.5\n"
+		"echo done\n");
+
+	fp = open_memstream(&buf, &size);
+	ck_assert(fp != NULL);
+	head = get_available_ptests(dir);
+	opts.timeout = 0;
+	ck_assert(run_ptests(head, opts, "test_run_no_timeout", fp, fp) == 0);
+	fclose(fp);
+
+	ck_assert(strstr(buf, "done\n") != NULL);
+	ck_assert(strstr(buf, "TIMEOUT: ") == NULL);
+
+	free(buf);
+	ptest_list_free_all(head);
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+	ck_assert(system(cmd) == 0);
+}
+END_TEST
+
 static void
 search_for_fail(const int rp, FILE *fp_stdout)
 {
@@ -280,8 +1097,8 @@ START_TEST(test_xml_pass)
 	FILE *xp;
 	xp = xml_create(2, "./test.xml");
 	ck_assert(xp != NULL);
-	xml_add_case(xp, 0,"test1", 0, 5);
-	xml_add_case(xp, 1,"test2", 1, 10);
+	xml_add_case(xp, 0,"test1", 0, 5, NULL, NULL);
+	xml_add_case(xp, 1,"test2", 1, 10, NULL, NULL);
 	xml_finish(xp);
 
 	FILE *fp, *fr;
@@ -314,10 +1131,25 @@ utils_suite(void)
 	tc_core = tcase_create("Core");
 
 	tcase_add_test(tc_core, test_get_available_ptests);
+	tcase_add_test(tc_core, test_get_available_ptests_dirs);
 	tcase_add_test(tc_core, test_print_ptests);
 	tcase_add_test(tc_core, test_filter_ptests);
+	tcase_add_test(tc_core, test_sort_ptests);
+	tcase_add_test(tc_core, test_shard_ptests);
 	tcase_add_test(tc_core, test_run_ptests);
+	tcase_add_test(tc_core, test_run_parallel_ptests);
+	tcase_add_test(tc_core, test_run_ptests_log_dir);
+	tcase_add_test(tc_core, test_run_ptests_queue);
 	tcase_add_test(tc_core, test_run_timeout_duration_ptest);
+	tcase_add_test(tc_core, test_run_max_duration_budget);
+	tcase_add_test(tc_core, test_run_grace_leftovers);
+	tcase_add_test(tc_core, test_run_grace_escalation);
+	tcase_add_test(tc_core, test_run_collect_timeout);
+	tcase_add_test(tc_core, test_run_samples);
+	tcase_add_test(tc_core, test_run_stats);
+	tcase_add_test(tc_core, test_run_sigchld_fallback);
+	tcase_add_test(tc_core, test_run_grandchild_output);
+	tcase_add_test(tc_core, test_run_no_timeout);
 	tcase_add_test(tc_core, test_run_fail_ptest);
 	tcase_add_test(tc_core, test_xml_pass);
 	tcase_add_test(tc_core, test_xml_fail);
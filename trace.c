@@ -0,0 +1,237 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+#define _GNU_SOURCE
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <sys/syscall.h>
+
+#include "trace.h"
+
+static FILE *trace_fp;
+static struct timespec trace_origin;
+static unsigned long trace_events;
+static int trace_pid;
+
+/* Microseconds since the trace was opened. */
+static long long
+trace_ts(const struct timespec *t)
+{
+	return (t->tv_sec - trace_origin.tv_sec) * 1000000LL +
+		(t->tv_nsec - trace_origin.tv_nsec) / 1000;
+}
+
+static void
+write_string(const char *s)
+{
+	fputc('"', trace_fp);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(trace_fp, "\\%c", *s);
+		else if ((unsigned char) *s < 0x20)
+			fprintf(trace_fp, "\\u%04x", (unsigned char) *s);
+		else
+			fputc(*s, trace_fp);
+	}
+	fputc('"', trace_fp);
+}
+
+static void
+begin_event(const char *ph, int tid, const char *cat, const char *name,
+		const struct timespec *ts)
+{
+	fprintf(trace_fp, "%s\n{\"ph\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%lld",
+		trace_events++ ? "," : "", ph, trace_pid, tid, trace_ts(ts));
+	if (cat != NULL)
+		fprintf(trace_fp, ",\"cat\":\"%s\"", cat);
+	fprintf(trace_fp, ",\"name\":");
+	write_string(name);
+}
+
+/* No args object when args is NULL. */
+static void
+end_event(const char *args, va_list *ap)
+{
+	if (args != NULL) {
+		fprintf(trace_fp, ",\"args\":{");
+		vfprintf(trace_fp, args, *ap);
+		fputc('}', trace_fp);
+	}
+	fputc('}', trace_fp);
+}
+
+static void
+write_metadata(int tid, const char *what, const char *name)
+{
+	fprintf(trace_fp, "%s\n{\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"name\":\"%s\","
+		"\"args\":{\"name\":", trace_events++ ? "," : "", trace_pid, tid, what);
+	write_string(name);
+	fprintf(trace_fp, "}}");
+}
+
+int
+trace_open(const char *filename)
+{
+	trace_fp = fopen(filename, "we");
+	if (trace_fp == NULL)
+		return -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &trace_origin);
+	trace_pid = (int) getpid();
+	trace_events = 0;
+
+	fprintf(trace_fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+	write_metadata(trace_tid(), "process_name", "ptest-runner");
+	trace_lane(trace_tid(), "runner");
+
+	return 0;
+}
+
+void
+trace_close(void)
+{
+	if (trace_fp == NULL)
+		return;
+
+	fprintf(trace_fp, "\n]}\n");
+	fclose(trace_fp);
+	trace_fp = NULL;
+}
+
+int
+trace_enabled(void)
+{
+	return trace_fp != NULL;
+}
+
+int
+trace_tid(void)
+{
+	return (int) syscall(SYS_gettid);
+}
+
+void
+trace_lane(int tid, const char *name)
+{
+	if (trace_fp == NULL)
+		return;
+
+	flockfile(trace_fp);
+	write_metadata(tid, "thread_name", name);
+	funlockfile(trace_fp);
+}
+
+/* A complete event from start to now. */
+static void
+span_event(int tid, const char *cat, const char *name, const struct timespec *start,
+		const char *args, va_list *ap)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	flockfile(trace_fp);
+	begin_event("X", tid, cat, name, start);
+	fprintf(trace_fp, ",\"dur\":%lld", trace_ts(&now) - trace_ts(start));
+	end_event(args, ap);
+	funlockfile(trace_fp);
+}
+
+static void
+instant_event(int tid, const char *cat, const char *name, const char *args, va_list *ap)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	flockfile(trace_fp);
+	begin_event("i", tid, cat, name, &now);
+	fprintf(trace_fp, ",\"s\":\"t\"");
+	end_event(args, ap);
+	funlockfile(trace_fp);
+}
+
+void
+trace_span(int tid, const char *cat, const char *name, const struct timespec *start)
+{
+	if (trace_fp == NULL)
+		return;
+
+	span_event(tid, cat, name, start, NULL, NULL);
+}
+
+void
+trace_spanf(int tid, const char *cat, const char *name, const struct timespec *start,
+		const char *args, ...)
+{
+	va_list ap;
+
+	if (trace_fp == NULL)
+		return;
+
+	va_start(ap, args);
+	span_event(tid, cat, name, start, args, &ap);
+	va_end(ap);
+}
+
+void
+trace_instant(int tid, const char *cat, const char *name)
+{
+	if (trace_fp == NULL)
+		return;
+
+	instant_event(tid, cat, name, NULL, NULL);
+}
+
+void
+trace_instantf(int tid, const char *cat, const char *name, const char *args, ...)
+{
+	va_list ap;
+
+	if (trace_fp == NULL)
+		return;
+
+	va_start(ap, args);
+	instant_event(tid, cat, name, args, &ap);
+	va_end(ap);
+}
+
+/* Every member of args is a series of the name counter track. */
+void
+trace_counter(const char *name, const char *args, ...)
+{
+	struct timespec now;
+	va_list ap;
+
+	if (trace_fp == NULL)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	flockfile(trace_fp);
+	begin_event("C", trace_pid, NULL, name, &now);
+	va_start(ap, args);
+	end_event(args, &ap);
+	va_end(ap);
+	funlockfile(trace_fp);
+}
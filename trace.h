@@ -0,0 +1,55 @@
+/**
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * AUTHORS
+ * 	Aníbal Limón <anibal.limon@intel.com>
+ */
+
+#ifndef PTEST_RUNNER_TRACE_H
+#define PTEST_RUNNER_TRACE_H
+
+#include <time.h>
+
+/* Lanes of the job slots, away from the thread ids of the runner. */
+#define TRACE_LANE_JOB(i) ((1 << 30) + (i))
+
+/* *
+ * Chrome trace event JSON of a whole run, for Perfetto or
+ * chrome://tracing. The runner, the discovery threads and every job slot
+ * are lanes with complete events for the phases and the ptests, instant
+ * events for the timeouts and counter tracks for the samples. The args
+ * of trace_spanf(), trace_instantf() and trace_counter() are a printf
+ * format of the members of the args object. Nothing is written without
+ * trace_open() and events may come from any thread.
+ * */
+extern int trace_open(const char *);
+extern void trace_close(void);
+extern int trace_enabled(void);
+extern int trace_tid(void);
+extern void trace_lane(int, const char *);
+extern void trace_span(int, const char *, const char *, const struct timespec *);
+extern void trace_spanf(int, const char *, const char *, const struct timespec *,
+		const char *, ...) __attribute__ ((format (printf, 5, 6)));
+extern void trace_instant(int, const char *, const char *);
+extern void trace_instantf(int, const char *, const char *, const char *, ...)
+		__attribute__ ((format (printf, 4, 5)));
+extern void trace_counter(const char *, const char *, ...)
+		__attribute__ ((format (printf, 2, 3)));
+
+#endif // PTEST_RUNNER_TRACE_H
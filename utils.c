@@ -29,41 +29,185 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <grp.h>
 #include <libgen.h>
-#include <poll.h>
-#include <pty.h>
 #include <signal.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <time.h>
 #include <unistd.h>
-#include <pthread.h>
 
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
-#include <sys/resource.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 
+#include "cache.h"
+#include "admission.h"
+#include "cgroup.h"
+#include "conf.h"
+#include "history.h"
+#include "jobserver.h"
 #include "ptest_list.h"
+#include "queue.h"
+#include "sampler.h"
+#include "snapshot.h"
+#include "spawn.h"
+#include "stats.h"
+#include "trace.h"
 #include "utils.h"
 
 #define GET_STIME_BUF_SIZE 1024
-#define WAIT_CHILD_BUF_MAX_SIZE 1024
-
-#define UNUSED(x) (void)(x)
+#define FORWARD_BUF_MIN_SIZE 4096
+#define FORWARD_BUF_MAX_SIZE (1024 * 1024)
+#define FORWARD_PIPE_SIZE (1024 * 1024)
+#define ENGINE_MAX_EVENTS 64
+#define ADMISSION_INTERVAL_MS 500
+#define COLLECT_COMMAND "ptest-runner-collect-system-data"
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+/* *
+ * Output of a child pipe is moved with splice() when the destination
+ * has a file descriptor that supports it, otherwise it's copied through
+ * a buffer that grows while the reads keep filling it.
+ * */
+struct ptest_forward {
+	int splice;
+	int flush;
+	char *buf;
+	size_t buf_size;
+};
+
+struct ptest_job {
+	struct ptest_list *p;
+	char *ptest_dir;
 
-static struct {
 	int fds[2];
 	FILE *fps[2];
-
-	unsigned int timeout;
-	int timeouted;
+	struct ptest_forward fw[2];
+
+	unsigned int timeout; /* seconds without output */
+	unsigned int max_duration; /* seconds */
+	enum ptest_timeout timeouted;
+	int terminating; /* SIGTERM sent, SIGKILL when the timer expires */
+	int cleaning; /* reaped, its leftovers are killed on the timer */
+	int status; /* exit code once reaped */
+	int alone; /* nothing ran next to it, the orphans are its own */
+	int padding1;
 	pid_t pid;
+	int pidfd;
+	int timerfd;
+	int queue_fd; /* claim held in the queue, -1 without a queue */
+	int token; /* jobserver token taken for the ptest */
+	pid_t collect_pid; /* capturing the system state, 0 when not */
+	int collect_fd;
+	int cgroup_dfd; /* -1 outside a cgroup */
+	unsigned long cgroup_seq;
+	const struct ptest_conf *conf;
+
+	struct timespec forked;
+	struct timespec started;
+	struct timespec last_output;
+	struct timespec collect_started;
+	struct timespec reaped;
+	time_t sttime;
+	struct spawn_leftovers leftovers;
+
+	/* Memory stream (parallel runs) or log file the output goes to. */
+	FILE *log;
+	char *log_buf;
+	char *buf;
+	size_t buf_size;
+
+	struct ptest_usage usage; /* set when reaped */
+
+	/* Time series of the resources it uses, NULL without --samples. */
+	FILE *samples;
+	struct sample sample;
+	struct timespec sampled;
+
+	/* Processes and kernel messages when it timed out. */
+	char *snapshot;
+	size_t snapshot_size;
+};
+
+/* *
+ * Single threaded event loop running the ptests, every job registers
+ * its output pipes, a pidfd signaled when the child exits and a timerfd
+ * armed for the nearest of its timeouts. Kernels without pidfd_open()
+ * use a signalfd for SIGCHLD instead.
+ * */
+enum {
+	EVENT_STDOUT = 0,
+	EVENT_STDERR,
+	EVENT_EXIT,
+	EVENT_TIMER,
+	EVENT_SIGCHLD,
+	EVENT_JOBSERVER,
+	EVENT_ADMISSION,
+	EVENT_COLLECT,
+	EVENT_SAMPLE,
+};
+
+#define EVENT_DATA(job, type) (((uint64_t) (job) << 8) | (type))
+#define EVENT_JOB(data) ((int) ((data) >> 8))
+#define EVENT_TYPE(data) ((int) ((data) & 0xff))
+
+#define JOB_LANE(e, job) TRACE_LANE_JOB((int) ((job) - (e)->jobs))
+
+struct ptest_engine {
+	int epfd;
+	int sigfd;
+	struct ptest_job *jobs;
+	int jobs_no;
+	int running;
+	int buffered;
+	int rc;
+	int ran; /* ptests started by this runner */
+
+	/* Ptests not started yet in order, NULL once taken. The ones other
+	 * runners claimed in the queue are tried once more at the end. */
+	struct ptest_list **pending;
+	int pending_first;
+	int pending_no;
+	struct ptest_list **busy;
+	int busy_no;
+	int rescanned;
+	struct ptest_list **done; /* with a result in the queue, skipped */
+	int done_no;
 	int padding1;
-} _child_reader;
+
+	const struct ptest_options *opts;
+	FILE *fp;
+	FILE *fp_stderr;
+	FILE *xh;
+	struct ptest_history *hh;
+	struct ptest_queue *queue;
+	struct ptest_jobserver *js;
+	struct ptest_cgroups *cg;
+	int js_implicit; /* the job that needs no token is taken */
+	int js_waiting; /* the jobserver fd is watched for a token */
+	struct admission adm;
+	int adm_timerfd; /* checks again while starting is held */
+	int subreaper; /* PR_GET_CHILD_SUBREAPER before the run */
+	int sample_timerfd; /* periodic with --samples, -1 otherwise */
+	pid_t *sample_sids;
+	struct sample *sample_buf;
+	unsigned long samples; /* ticks sampled and the CPU time they took */
+	long long sample_ns;
+	struct timespec started;
+	sigset_t sigmask;
+};
 
 static inline char *
 get_stime(char *stime, size_t size, time_t t)
@@ -88,19 +232,186 @@ check_allocation1(void *p, size_t size, char *file, int line, int exit_on_null)
 }
 
 
-struct ptest_list *
-get_available_ptests(const char *dir)
+static int
+name_cmp(const void *a, const void *b)
 {
-	struct ptest_list *head;
+	return strcoll(*(char * const *) a, *(char * const *) b);
+}
+
+/* Names of the entries in dfd that may hold a ptest, sorted like
+ * alphasort() does. Returns the number of names or -1. */
+static int
+read_ptest_names(int dfd, char ***namelist)
+{
+	DIR *d;
+	struct dirent *de;
+	char **names = NULL;
+	int n = 0, size = 0;
+	int saved_errno;
+	int fd;
+
+	fd = dup(dfd);
+	if (fd == -1)
+		return -1;
+
+	d = fdopendir(fd);
+	if (d == NULL) {
+		close(fd);
+		return -1;
+	}
+
+	errno = 0;
+	while ((de = readdir(d)) != NULL) {
+		if (strcmp(de->d_name, ".") == 0 ||
+		    strcmp(de->d_name, "..") == 0)
+			continue;
+
+		/* Skip what can't be a directory without a stat. */
+		if (de->d_type != DT_DIR && de->d_type != DT_LNK &&
+		    de->d_type != DT_UNKNOWN)
+			continue;
+
+		if (n == size) {
+			char **tmp;
+
+			size = size ? size * 2 : 256;
+			tmp = realloc(names, sizeof(char *) * (size_t) size);
+			CHECK_ALLOCATION(tmp, sizeof(char *) * (size_t) size, 0);
+			if (tmp == NULL)
+				break;
+			names = tmp;
+		}
+
+		names[n] = strdup(de->d_name);
+		CHECK_ALLOCATION(names[n], strlen(de->d_name), 0);
+		if (names[n] == NULL)
+			break;
+		n++;
+		errno = 0;
+	}
+
+	saved_errno = errno;
+	closedir(d);
+
+	if (saved_errno != 0) {
+		while (n > 0)
+			free(names[--n]);
+		free(names);
+		errno = saved_errno;
+		return -1;
+	}
+
+	if (n > 1)
+		qsort(names, (size_t) n, sizeof(char *), name_cmp);
+
+	*namelist = names;
+	return n;
+}
+
+#define RUN_PTEST_PATH_MAX (NAME_MAX + sizeof("/ptest/run-ptest"))
+
+/* *
+ * Looks for <name>/ptest/run-ptest recording what was found in update,
+ * the entry cached for name is reused when <name> and <name>/ptest are
+ * unchanged. Returns 1 for a ptest, 0 otherwise and -1 on errors.
+ * */
+static int
+probe_ptest(int dfd, const char *name, const struct cache_root *cached,
+		const struct cache_entry *ce, struct cache_root *update,
+		struct stat *st_run, int *changed)
+{
+	struct cache_entry *e;
+	struct stat st_buf, st_ptest;
+	char path[RUN_PTEST_PATH_MAX];
+	char *e_name;
+
+	if (fstatat(dfd, name, &st_buf, 0) == -1 || !S_ISDIR(st_buf.st_mode)) {
+		*changed |= ce != NULL;
+		return 0;
+	}
+
+	e = cache_root_add(update, name);
+	if (e == NULL)
+		return -1;
+
+	snprintf(path, sizeof(path), "%s/ptest", name);
+	if (ce != NULL && cache_stat_valid(cached, ce->dev, ce->ino,
+	    &ce->mtime, &st_buf)) {
+		if (!(ce->flags & CACHE_ENTRY_PTEST_DIR) ||
+		    (fstatat(dfd, path, &st_ptest, 0) == 0 &&
+		     cache_stat_valid(cached, ce->ptest_dev, ce->ptest_ino,
+		     &ce->ptest_mtime, &st_ptest))) {
+			e_name = e->name;
+			*e = *ce;
+			e->name = e_name;
+			goto found;
+		}
+	}
+
+	*changed = 1;
+	e->dev = st_buf.st_dev;
+	e->ino = st_buf.st_ino;
+	e->mtime = st_buf.st_mtim;
+
+	if (fstatat(dfd, path, &st_buf, 0) == -1 || !S_ISDIR(st_buf.st_mode))
+		return 0;
+	e->flags |= CACHE_ENTRY_PTEST_DIR;
+	e->ptest_dev = st_buf.st_dev;
+	e->ptest_ino = st_buf.st_ino;
+	e->ptest_mtime = st_buf.st_mtim;
+
+	snprintf(path, sizeof(path), "%s/ptest/run-ptest", name);
+	if (fstatat(dfd, path, &st_buf, 0) == -1 || !S_ISREG(st_buf.st_mode))
+		return 0;
+	e->flags |= CACHE_ENTRY_PTEST;
+	e->run_ptest_dev = st_buf.st_dev;
+	e->run_ptest_ino = st_buf.st_ino;
+
+found:
+	if (!(e->flags & CACHE_ENTRY_PTEST))
+		return 0;
+
+	memset(st_run, 0, sizeof(struct stat));
+	st_run->st_dev = e->run_ptest_dev;
+	st_run->st_ino = e->run_ptest_ino;
+	st_run->st_mode = S_IFREG;
+
+	return 1;
+}
+
+/* *
+ * Lookups are done relative to the directory fd so every stat only
+ * resolves <name>/ptest/run-ptest, the absolute path is built for the
+ * ptests found.
+ *
+ * With a cache the directory isn't read when its mtime didn't change,
+ * the names come from the cache and only what changed is looked up
+ * again. *update is set to the new cache of the directory, or NULL when
+ * it's the same.
+ * */
+static struct ptest_list *
+discover_ptests(const char *dir, const struct ptest_cache *cache,
+		struct cache_root **update)
+{
+	struct ptest_list *head, *p;
 	struct stat st_buf;
 
 	int n, i;
-	struct dirent **namelist;
+	size_t c;
+	char **names = NULL;
+	const struct cache_root *cached = NULL;
+	struct cache_root *root = NULL;
+	int changed = 0;
+	int dfd;
 	int fail;
 	int saved_errno = -1; /* Initalize to invalid errno. */
 	char realdir[PATH_MAX];
 
-	realpath(dir, realdir);
+	if (update != NULL)
+		*update = NULL;
+
+	if (realpath(dir, realdir) == NULL)
+		return NULL;
 
 	do
 	{
@@ -109,70 +420,103 @@ get_available_ptests(const char *dir)
 		if (head == NULL)
 			break;
 
-		if (stat(realdir, &st_buf) == -1) {
+		dfd = open(realdir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (dfd == -1) {
+			if (errno == ENOTDIR)
+				errno = EINVAL;
 			PTEST_LIST_FREE_CLEAN(head);
 			break;
 		}
 
-		if (!S_ISDIR(st_buf.st_mode)) {
-			PTEST_LIST_FREE_CLEAN(head);
-			errno = EINVAL;
-			break;
-		}
+		if (cache != NULL) {
+			if (fstat(dfd, &st_buf) == -1) {
+				saved_errno = errno;
+				close(dfd);
+				PTEST_LIST_FREE_CLEAN(head);
+				errno = saved_errno;
+				break;
+			}
 
-		n = scandir(realdir, &namelist, NULL, alphasort);
-		if (n == -1) {
-			PTEST_LIST_FREE_CLEAN(head);
-			break;
+			cached = cache_root_search((struct ptest_cache *) cache, realdir);
+			root = cache_root_alloc(realdir, &st_buf, time(NULL));
+			if (root == NULL) {
+				close(dfd);
+				PTEST_LIST_FREE_CLEAN(head);
+				errno = ENOMEM;
+				break;
+			}
 		}
 
+		if (cached != NULL && cache_stat_valid(cached, cached->dev,
+		    cached->ino, &cached->mtime, &st_buf)) {
+			n = (int) cached->entries_no;
+		} else {
+			n = read_ptest_names(dfd, &names);
+			if (n == -1) {
+				saved_errno = errno;
+				close(dfd);
+				cache_root_free(root);
+				PTEST_LIST_FREE_CLEAN(head);
+				errno = saved_errno;
+				break;
+			}
+			changed = 1;
+		}
 
 		fail = 0;
+		c = 0;
 		for (i = 0; i < n; i++) {
+			const struct cache_entry *ce = NULL;
+			const char *name;
 			char *run_ptest;
+			char *d_name;
+			char path[RUN_PTEST_PATH_MAX];
+			int found;
 
-			char *d_name = strdup(namelist[i]->d_name);
-			CHECK_ALLOCATION(d_name, sizeof(namelist[i]->d_name), 0);
-			if (d_name == NULL) {
-				fail = 1;
-				saved_errno = errno;
-				break;
-			}
-
-			if (strcmp(d_name, ".") == 0 ||
-			    strcmp(d_name, "..") == 0) {
-				free(d_name);
-				continue;
+			if (names == NULL) {
+				ce = &cached->entries[i];
+				name = ce->name;
+			} else {
+				name = names[i];
+				/* Both are in the same order, walk them together. */
+				while (cached != NULL && c < cached->entries_no &&
+				    strcoll(cached->entries[c].name, name) < 0)
+					c++;
+				if (cached != NULL && c < cached->entries_no &&
+				    strcmp(cached->entries[c].name, name) == 0)
+					ce = &cached->entries[c];
 			}
 
-			if (asprintf(&run_ptest, "%s/%s/ptest/run-ptest",
-			    realdir, d_name) == -1)  {
-				fail = 1;
-				saved_errno = errno;
-				free(d_name);
-				break;
+			snprintf(path, sizeof(path), "%s/ptest/run-ptest", name);
+			if (root != NULL) {
+				found = probe_ptest(dfd, name, cached, ce, root,
+						&st_buf, &changed);
+				if (found == -1) {
+					fail = 1;
+					saved_errno = errno;
+					break;
+				}
+			} else {
+				found = fstatat(dfd, path, &st_buf, 0) == 0 &&
+				    S_ISREG(st_buf.st_mode);
 			}
-
-			if (stat(run_ptest, &st_buf) == -1) {
-				free(run_ptest);
-				free(d_name);
+			if (!found)
 				continue;
-			}
 
-			if (!S_ISREG(st_buf.st_mode)) {
-				free(run_ptest);
-				free(d_name);
+			if (ptest_list_search_by_file(head, path, st_buf))
 				continue;
-			}
 
-			if (ptest_list_search_by_file(head, run_ptest, st_buf)) {
-				free(run_ptest);
+			d_name = strdup(name);
+			CHECK_ALLOCATION(d_name, strlen(name), 0);
+			if (d_name == NULL ||
+			    asprintf(&run_ptest, "%s/%s", realdir, path) == -1) {
+				fail = 1;
+				saved_errno = errno;
 				free(d_name);
-				continue;
+				break;
 			}
 
-			struct ptest_list *p = ptest_list_add(head,
-				d_name, run_ptest);
+			p = ptest_list_add_by_file(head, d_name, run_ptest, st_buf);
 			CHECK_ALLOCATION(p, sizeof(struct ptest_list *), 0);
 			if (p == NULL) {
 				fail = 1;
@@ -183,20 +527,141 @@ get_available_ptests(const char *dir)
 			}
 		}
 
-		for (i = 0 ; i < n; i++)
-			free(namelist[i]);
-		free(namelist);
+		if (names != NULL) {
+			for (i = 0; i < n; i++)
+				free(names[i]);
+			free(names);
+		}
+		close(dfd);
 
 		if (fail) {
+			cache_root_free(root);
 			PTEST_LIST_FREE_ALL_CLEAN(head);
 			errno = saved_errno;
 			break;
 		}
+
+		if (changed && update != NULL)
+			*update = root;
+		else
+			cache_root_free(root);
+
+		PTEST_LIST_ITERATE_START(head, p)
+			ptest_conf(p);
+		PTEST_LIST_ITERATE_END
 	} while (0);
 
 	return head;
 }
 
+struct ptest_list *
+get_available_ptests(const char *dir)
+{
+	struct ptest_list *head;
+	struct timespec start;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	head = discover_ptests(dir, NULL, NULL);
+	trace_spanf(trace_tid(), "runner", dir, &start, "\"ptests\":%d",
+		head != NULL ? ptest_list_length(head) : 0);
+
+	return head;
+}
+
+struct discovery {
+	const char *dir;
+	const struct ptest_cache *cache;
+	struct ptest_list *head;
+	struct cache_root *update;
+};
+
+static void *
+discovery_thread(void *arg)
+{
+	struct discovery *d = arg;
+	struct timespec start;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	d->head = discover_ptests(d->dir, d->cache, &d->update);
+	trace_lane(trace_tid(), "discovery");
+	trace_spanf(trace_tid(), "runner", d->dir, &start, "\"ptests\":%d",
+		d->head != NULL ? ptest_list_length(d->head) : 0);
+
+	return NULL;
+}
+
+static void
+count_discovery(const struct timespec *start, struct ptest_list **heads, int dirs_no)
+{
+	struct timespec now;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	runner_stats.discovery_ns += (now.tv_sec - start->tv_sec) * 1000000000LL +
+		(now.tv_nsec - start->tv_nsec);
+	for (i = 0; i < dirs_no; i++)
+		if (heads[i] != NULL)
+			runner_stats.ptests_found += (unsigned long) ptest_list_length(heads[i]);
+}
+
+/* *
+ * Scans every directory in its own thread, heads[i] is the result of
+ * get_available_ptests(dirs[i]). With a cache, it's used to skip the
+ * scans and updated with what changed.
+ * */
+void
+get_available_ptests_dirs(char **dirs, int dirs_no, struct ptest_list **heads,
+		struct ptest_cache *cache)
+{
+	struct discovery *d;
+	struct timespec start;
+	pthread_t *threads;
+	int *started;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	d = calloc((size_t) dirs_no, sizeof(struct discovery));
+	CHECK_ALLOCATION(d, (size_t) dirs_no * sizeof(struct discovery), 0);
+	if (d == NULL) {
+		for (i = 0; i < dirs_no; i++)
+			heads[i] = get_available_ptests(dirs[i]);
+		count_discovery(&start, heads, dirs_no);
+		return;
+	}
+
+	for (i = 0; i < dirs_no; i++) {
+		d[i].dir = dirs[i];
+		d[i].cache = cache;
+	}
+
+	threads = calloc((size_t) dirs_no, sizeof(pthread_t));
+	started = calloc((size_t) dirs_no, sizeof(int));
+	if (dirs_no > 1 && threads != NULL && started != NULL) {
+		for (i = 0; i < dirs_no; i++)
+			started[i] = pthread_create(&threads[i], NULL,
+					discovery_thread, &d[i]) == 0;
+	}
+
+	/* Whatever couldn't get a thread is scanned here. */
+	for (i = 0; i < dirs_no; i++) {
+		if (started != NULL && started[i])
+			pthread_join(threads[i], NULL);
+		else
+			discovery_thread(&d[i]);
+		heads[i] = d[i].head;
+	}
+
+	for (i = 0; i < dirs_no; i++) {
+		if (d[i].update != NULL && cache_root_set(cache, d[i].update) == -1)
+			cache_root_free(d[i].update);
+	}
+
+	free(d);
+	free(threads);
+	free(started);
+	count_discovery(&start, heads, dirs_no);
+}
+
 int
 print_ptests(struct ptest_list *head, FILE *fp)
 {
@@ -216,7 +681,7 @@ print_ptests(struct ptest_list *head, FILE *fp)
 struct ptest_list *
 filter_ptests(struct ptest_list *head, char **ptests, int ptest_num)
 {
-	struct ptest_list *head_new = NULL, *n;
+	struct ptest_list *head_new = NULL, *n, *p;
 	int fail = 0, i, saved_errno = 0;
 
 	do {
@@ -248,11 +713,16 @@ filter_ptests(struct ptest_list *head, char **ptests, int ptest_num)
 				break;
 			}
 
-			if (ptest_list_add(head_new, ptest, run_ptest) == NULL) {
+			p = ptest_list_add(head_new, ptest, run_ptest);
+			if (p == NULL) {
 				saved_errno = errno;
 				fail = 1;
 				break;
 			}
+
+			/* Read once, at discovery. */
+			if (n->conf != NULL)
+				p->conf = conf_dup(n->conf);
 		}
 
 		if (fail) {
@@ -264,300 +734,1751 @@ filter_ptests(struct ptest_list *head, char **ptests, int ptest_num)
 	return head_new;
 }
 
-/* Close all fds from 3 up to 'ulimit -n'
- * i.e. do not close STDIN, STDOUT, STDERR.
- * Typically called in in a child process after forking
- * but before exec as a good policy especially for security.
- */ 
-static void
-close_fds(void)
+/* Fills the expected duration of every ptest from the history or else
+ * from its ptest-runner.conf, returns 1 when the history file could be
+ * read. */
+static int
+load_durations(struct ptest_list *head, const struct ptest_options opts)
 {
-	struct rlimit curr_lim;
-	getrlimit(RLIMIT_NOFILE, &curr_lim);
+	struct ptest_history *hh = NULL;
+	struct ptest_list *p;
 
-	int fd;
-	for (fd=3; fd < (int)curr_lim.rlim_cur; fd++) {
-		(void) close(fd);
-   	}
-}
+	if (opts.history_filename)
+		hh = history_open(opts.history_filename);
 
-static void
-collect_system_state(FILE* fout)
-{
-	char *cmd = "ptest-runner-collect-system-data";
+	PTEST_LIST_ITERATE_START(head, p)
+		p->duration = hh != NULL ? history_expected_duration(hh, p->ptest) : -1;
+		if (p->duration == -1)
+			p->duration = ptest_conf(p)->expected_duration;
+	PTEST_LIST_ITERATE_END
 
-	char buf[1024];
-	FILE *fp;
+	history_close(hh);
 
-	if ((fp = popen(cmd, "r")) == NULL) {
-		fprintf(fout, "Error opening pipe!\n");
-	}
+	return hh != NULL;
+}
 
-	while (fgets(buf, 1024, fp) != NULL) {
-		fprintf(fout, "%s", buf);
+/* Ptests with a duration go first, the ones without it keep the
+ * alphabetical order at the end. */
+static int
+cmp_duration(const struct ptest_list *a, const struct ptest_list *b)
+{
+	if (a->duration != b->duration) {
+		if (a->duration == -1)
+			return 1;
+		if (b->duration == -1)
+			return -1;
 	}
 
-	if(pclose(fp))  {
-		fprintf(fout, "Command not found or exited with error status\n");
-	}
+	return strcmp(a->ptest, b->ptest);
 }
 
-static void *
-read_child(void *arg)
+static int
+cmp_longest_first(const struct ptest_list *a, const struct ptest_list *b)
 {
-	struct pollfd pfds[2];
-	int r;
+	if (a->duration != -1 && b->duration != -1 && a->duration != b->duration)
+		return a->duration > b->duration ? -1 : 1;
+
+	return cmp_duration(a, b);
+}
 
-	UNUSED(arg);
+static int
+cmp_shortest_first(const struct ptest_list *a, const struct ptest_list *b)
+{
+	if (a->duration != -1 && b->duration != -1 && a->duration != b->duration)
+		return a->duration < b->duration ? -1 : 1;
 
-	pfds[0].fd = _child_reader.fds[0];
-	pfds[0].events = POLLIN;
-	pfds[1].fd = _child_reader.fds[1];
-	pfds[1].events = POLLIN;
+	return cmp_duration(a, b);
+}
 
-	do {
-		r = poll(pfds, 2, _child_reader.timeout*1000);
-		if (r > 0) {
-			char buf[WAIT_CHILD_BUF_MAX_SIZE];
-			ssize_t n;
-
-			if (pfds[0].revents != 0) {
-				n = read(_child_reader.fds[0], buf, WAIT_CHILD_BUF_MAX_SIZE);
-				if (n > 0)
-					fwrite(buf, (size_t)n, 1, _child_reader.fps[0]);
-			}
+/* Sorts the ptests by the durations recorded in the history file. */
+int
+sort_ptests(struct ptest_list *head, const struct ptest_options opts)
+{
+	int rc;
 
-			if (pfds[1].revents != 0) {
-				n = read(_child_reader.fds[1], buf, WAIT_CHILD_BUF_MAX_SIZE);
-				if (n > 0)
-					fwrite(buf, (size_t)n, 1, _child_reader.fps[1]);
-			}
+	if (head == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (opts.order == PTEST_ORDER_DEFAULT)
+		return 0;
 
-		} else if (r == 0) {
-			// no output from the test after a timeout; the test is stuck, so collect
-			// as much data from the system as possible and kill the test
-			collect_system_state(_child_reader.fps[0]);
-			_child_reader.timeouted = 1;
-			kill(-_child_reader.pid, SIGKILL);
-                }
+	load_durations(head, opts);
 
-		fflush(_child_reader.fps[0]);
-		fflush(_child_reader.fps[1]);
-	} while (1);
+	if (opts.order == PTEST_ORDER_LONGEST_FIRST)
+		rc = ptest_list_sort(head, cmp_longest_first);
+	else
+		rc = ptest_list_sort(head, cmp_shortest_first);
 
-	return NULL;
+	return rc;
 }
 
-static inline void
-run_child(char *run_ptest, int fd_stdout, int fd_stderr)
+static uint32_t
+shard_hash(const char *ptest)
 {
-	char *const argv[2] = {run_ptest, NULL};
-	chdir(dirname(strdup(run_ptest)));
-
-	dup2(fd_stdout, STDOUT_FILENO);
-	// XXX: Redirect stderr to stdout to avoid buffer ordering problems.
-	dup2(fd_stdout, STDERR_FILENO);
-
-	/* since it isn't use by the child, close(fd_stderr) ? */
-	close(fd_stderr); /* try using to see if this fixes bash run-read. rwm todo */
-	close_fds();
+	uint32_t h = 2166136261u;
 
-	execv(run_ptest, argv);
+	for (; *ptest; ptest++) {
+		h ^= (unsigned char) *ptest;
+		h *= 16777619u;
+	}
 
-	/* exit(1); not needed? */
+	return h;
 }
 
-static inline int
-wait_child(pid_t pid)
+static int
+cmp_shard(const void *a, const void *b)
 {
-	int status = -1;
+	const struct ptest_list *pa = *(struct ptest_list * const *) a;
+	const struct ptest_list *pb = *(struct ptest_list * const *) b;
 
-	waitpid(pid, &status, 0);
-	if (WIFEXITED(status))
-		status = WEXITSTATUS(status);
+	if (pa->duration != pb->duration)
+		return pa->duration > pb->duration ? -1 : 1;
 
-	return status;
+	return strcmp(pa->ptest, pb->ptest);
 }
 
-/* Returns an integer file descriptor.
- * If it returns < 0, an error has occurred.
- * Otherwise, it has returned the slave pty file descriptor.
- * fp should be writable, likely stdout/err.
- */
-static int
-setup_slave_pty(FILE *fp) { 
-	int pty_master = -1;
-	int pty_slave = -1;
-	char pty_name[256];
-	struct group *gptr;
-	gid_t gid;
-	int slave = -1;
+/* *
+ * Keeps the ptests of shard opts.shard_index out of opts.shard_count.
+ * Every runner given the same list and history computes the same
+ * shards: the ptests with history are assigned longest first to the
+ * shard with less work so far, the rest by a hash of their name.
+ * */
+int
+shard_ptests(struct ptest_list *head, const struct ptest_options opts)
+{
+	struct ptest_list **nodes;
+	struct ptest_list *p;
+	long *loads;
+	int *shards;
+	int n, known, i, j;
 
-	if (openpty(&pty_master, &pty_slave, pty_name, NULL, NULL) < 0) {
-		fprintf(fp, "ERROR: openpty() failed with: %s.\n", strerror(errno));
+	if (head == NULL || opts.shard_count < 1 ||
+	    opts.shard_index < 0 || opts.shard_index >= opts.shard_count) {
+		errno = EINVAL;
 		return -1;
 	}
 
-	if ((gptr = getgrnam(pty_name)) != 0) {
-		gid = gptr->gr_gid;
-	} else {
-		/* If the tty group does not exist, don't change the
-		 * group on the slave pty, only the owner
-		 */
-		gid = (gid_t)-1;
-	}
+	if (opts.shard_count == 1)
+		return 0;
 
-	/* chown/chmod the corresponding pty, if possible.
-	 * This will only work if the process has root permissions.
-	 */
-	if (chown(pty_name, getuid(), gid) != 0) {
-		fprintf(fp, "ERROR; chown() failed with: %s.\n", strerror(errno));
+	n = ptest_list_length(head);
+	if (n == 0)
+		return 0;
+
+	nodes = malloc(sizeof(struct ptest_list *) * (size_t) n);
+	shards = malloc(sizeof(int) * (size_t) n);
+	loads = calloc((size_t) opts.shard_count, sizeof(long));
+	if (nodes == NULL || shards == NULL || loads == NULL) {
+		free(nodes);
+		free(shards);
+		free(loads);
+		errno = ENOMEM;
+		return -1;
 	}
 
-	/* Makes the slave read/writeable for the user. */
-	if (chmod(pty_name, S_IRUSR|S_IWUSR) != 0) {
-		fprintf(fp, "ERROR: chmod() failed with: %s.\n", strerror(errno));
+	load_durations(head, opts);
+
+	i = 0;
+	known = 0;
+	PTEST_LIST_ITERATE_START(head, p)
+		if (p->duration != -1)
+			known++;
+		nodes[i++] = p;
+	PTEST_LIST_ITERATE_END
+
+	/* Known durations first, longest to shortest. */
+	qsort(nodes, (size_t) n, sizeof(struct ptest_list *), cmp_shard);
+
+	for (i = 0; i < n; i++) {
+		if (i > 0 && strcmp(nodes[i]->ptest, nodes[i - 1]->ptest) == 0) {
+			/* Same name from another directory, keep them together
+			 * since they're removed by name. */
+			shards[i] = shards[i - 1];
+		} else if (i < known) {
+			int shard = 0;
+
+			for (j = 1; j < opts.shard_count; j++) {
+				if (loads[j] < loads[shard])
+					shard = j;
+			}
+			loads[shard] += nodes[i]->duration;
+			shards[i] = shard;
+		} else
+			shards[i] = (int) (shard_hash(nodes[i]->ptest) %
+					(uint32_t) opts.shard_count);
 	}
 
-	if ((slave = open(pty_name, O_RDWR)) == -1) {
-		fprintf(fp, "ERROR: open() failed with: %s.\n", strerror(errno));
+	for (i = 0; i < n; i++) {
+		if (shards[i] != opts.shard_index)
+			ptest_list_remove(head, nodes[i]->ptest, 1);
 	}
-	return (slave);
-}
 
+	free(nodes);
+	free(shards);
+	free(loads);
 
-int
-run_ptests(struct ptest_list *head, const struct ptest_options opts,
-		const char *progname, FILE *fp, FILE *fp_stderr)
-{
-	int rc = 0;
-	FILE *xh = NULL;
+	return 0;
+}
 
-	struct ptest_list *p;
-	char stime[GET_STIME_BUF_SIZE];
+static inline void
+count_forwarded(ssize_t n)
+{
+	if (n > 0) {
+		runner_stats.bytes_forwarded += (unsigned long long) n;
+		runner_stats.forwards++;
+	}
+}
 
-	pid_t child;
-	int pipefd_stdout[2];
-	int pipefd_stderr[2];
-	time_t sttime, entime;
-	time_t duration;
-	int slave;
-	int pgid = -1;
-	pthread_t tid;
+/* Forwards the available output of fd to fp, returns the number of
+ * bytes forwarded, 0 on EOF and -1 on error. */
+static ssize_t
+forward_output(struct ptest_forward *fw, int fd, FILE *fp)
+{
+	ssize_t n;
+	int out;
+
+	if (fw->splice && (out = fileno(fp)) != -1) {
+		/* Keep the order with what was written through stdio. */
+		fflush(fp);
+
+		/* Never blocks on the pipe, even when it was left blocking
+		 * and a daemon of the ptest still holds its write end. */
+		n = splice(fd, NULL, out, NULL, FORWARD_BUF_MAX_SIZE,
+			SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (n >= 0 || errno == EINTR) {
+			count_forwarded(n);
+			return n;
+		}
 
-	if (opts.xml_filename) {
-		xh = xml_create(ptest_list_length(head), opts.xml_filename);
-		if (!xh)
-			exit(EXIT_FAILURE);
+		/* EAGAIN is an empty pipe or a full output pipe, read() tells
+		 * them apart and fwrite() waits for the output. Any other error
+		 * is i.e. O_APPEND files, ttys or sockets on old kernels. */
+		if (errno != EAGAIN)
+			fw->splice = 0;
 	}
 
-	do
-	{
-		if ((rc = pipe(pipefd_stdout)) == -1)
-			break;
+	if (fw->buf == NULL) {
+		fw->buf_size = FORWARD_BUF_MIN_SIZE;
+		fw->buf = malloc(fw->buf_size);
+		CHECK_ALLOCATION(fw->buf, fw->buf_size, 1);
+	}
 
-		if ((rc = pipe(pipefd_stderr)) == -1) {
-			close(pipefd_stdout[0]);
-			close(pipefd_stdout[1]);
-			break;
+	n = read(fd, fw->buf, fw->buf_size);
+	count_forwarded(n);
+	if (n > 0) {
+		fwrite(fw->buf, (size_t)n, 1, fp);
+		if (fw->flush)
+			fflush(fp);
+
+		if ((size_t) n == fw->buf_size && fw->buf_size < FORWARD_BUF_MAX_SIZE) {
+			char *buf = realloc(fw->buf, fw->buf_size * 2);
+			if (buf != NULL) {
+				fw->buf = buf;
+				fw->buf_size *= 2;
+			}
 		}
+	}
 
-		if (isatty(0) && ioctl(0, TIOCNOTTY) == -1) {
-			fprintf(fp, "ERROR: Unable to detach from controlling tty, %s\n", strerror(errno));
-		}
+	return n;
+}
 
-		_child_reader.fds[0] = pipefd_stdout[0];
-		_child_reader.fds[1] = pipefd_stderr[0];
-		_child_reader.fps[0] = fp;
-		_child_reader.fps[1] = fp_stderr;
-		_child_reader.timeout = opts.timeout;
-		_child_reader.timeouted = 0;
-		rc = pthread_create(&tid, NULL, read_child, NULL);
-		if (rc != 0) {
-			fprintf(fp, "ERROR: Failed to create reader thread, %s\n", strerror(errno));
-			close(pipefd_stdout[0]);
-			close(pipefd_stdout[1]);
-			break;
-		}
+static inline long
+elapsed_ms(const struct timespec *since)
+{
+	struct timespec now;
 
-		fprintf(fp, "START: %s\n", progname);
-		PTEST_LIST_ITERATE_START(head, p)
-			char *ptest_dir = strdup(p->run_ptest);
-			if (ptest_dir == NULL) {
-				rc = -1;
-				break;
-			}
-			dirname(ptest_dir);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) * 1000 +
+		(now.tv_nsec - since->tv_nsec) / 1000000;
+}
 
-			if ((pgid = getpgid(0)) == -1) {
-				fprintf(fp, "ERROR: getpgid() failed, %s\n", strerror(errno));
-			}
+static long long
+elapsed_ns(const struct timespec *since)
+{
+	struct timespec now;
 
-			child = fork();
-			if (child == -1) {
-				fprintf(fp, "ERROR: Fork %s\n", strerror(errno));
-				rc = -1;
-				break;
-			} else if (child == 0) {
-				close(0);
-				if ((slave = setup_slave_pty(fp)) < 0) {
-					fprintf(fp, "ERROR: could not setup pty (%d).", slave);
-				}
-				if (setpgid(0,pgid) == -1) {
-					fprintf(fp, "ERROR: setpgid() failed, %s\n", strerror(errno));
-				}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long) (now.tv_sec - since->tv_sec) * 1000000000LL +
+		(now.tv_nsec - since->tv_nsec);
+}
 
-				if (setsid() ==  -1) {
-					fprintf(fp, "ERROR: setsid() failed, %s\n", strerror(errno));
-				}
+static void
+arm_timer(struct ptest_job *job, long ms)
+{
+	struct itimerspec its;
 
-				if (ioctl(0, TIOCSCTTY, NULL) == -1) {
-					fprintf(fp, "ERROR: Unable to attach to controlling tty, %s\n", strerror(errno));
-				}
+	memset(&its, 0, sizeof(struct itimerspec));
+	its.it_value.tv_sec = ms / 1000;
+	its.it_value.tv_nsec = (ms % 1000) * 1000000;
+	timerfd_settime(job->timerfd, 0, &its, NULL);
+}
 
-				run_child(p->run_ptest, pipefd_stdout[1], pipefd_stderr[1]);
+static void
+handle_output(struct ptest_engine *e, struct ptest_job *job, int i)
+{
+	ssize_t n;
+
+	runner_stats.wakeups++;
+	n = forward_output(&job->fw[i], job->fds[i], job->fps[i]);
+	if (n > 0)
+		clock_gettime(CLOCK_MONOTONIC, &job->last_output);
+	else if (n == 0 || (errno != EAGAIN && errno != EINTR))
+		epoll_ctl(e->epfd, EPOLL_CTL_DEL, job->fds[i], NULL);
+}
 
-			} else {
-				int status;
+static const char *const timeout_names[] = {
+	NULL,
+	"timeout",
+	"max-duration",
+	"budget",
+};
 
-				_child_reader.pid = child;
-				if (setpgid(child, pgid) == -1) {
-					fprintf(fp, "ERROR: setpgid() failed, %s\n", strerror(errno));
-				}
+static void
+nearest(long *ms, enum ptest_timeout *kind, long left, enum ptest_timeout k)
+{
+	if (*kind == PTEST_TIMEOUT_NONE || left < *ms) {
+		*ms = left;
+		*kind = k;
+	}
+}
 
-				sttime = time(NULL);
-				fprintf(fp, "%s\n", get_stime(stime, GET_STIME_BUF_SIZE, sttime));
-				fprintf(fp, "BEGIN: %s\n", ptest_dir);
+/* *
+ * Milliseconds until the first of the job timeouts expires, 0 or less
+ * when one did. kind is PTEST_TIMEOUT_NONE when the job has none.
+ * */
+static long
+job_deadline(struct ptest_engine *e, struct ptest_job *job,
+		enum ptest_timeout *kind)
+{
+	long ms = 0;
+
+	*kind = PTEST_TIMEOUT_NONE;
+	if (job->timeout > 0)
+		nearest(&ms, kind, (long) job->timeout * 1000 - elapsed_ms(&job->last_output),
+			PTEST_TIMEOUT_INACTIVITY);
+	if (job->max_duration > 0)
+		nearest(&ms, kind, (long) job->max_duration * 1000 - elapsed_ms(&job->started),
+			PTEST_TIMEOUT_DURATION);
+	if (e->opts->budget > 0)
+		nearest(&ms, kind, (long) e->opts->budget * 1000 - elapsed_ms(&e->started),
+			PTEST_TIMEOUT_BUDGET);
+
+	return ms;
+}
 
+/* A zero timer would be disarmed. */
+static void
+arm_deadline(struct ptest_engine *e, struct ptest_job *job)
+{
+	enum ptest_timeout kind;
+	long ms;
 
-				status = wait_child(child);
+	ms = job_deadline(e, job, &kind);
+	if (kind != PTEST_TIMEOUT_NONE)
+		arm_timer(job, ms > 0 ? ms : 1);
+}
 
-				entime = time(NULL);
-				duration = entime - sttime;
+/* STATS lines and with a file the same as JSON. */
+static void
+report_stats(const struct ptest_options *opts, FILE *fp, FILE *fp_stderr)
+{
+	struct rusage ru;
+	FILE *json;
 
-				if (status) {
-					fprintf(fp, "\nERROR: Exit status is %d\n", status);
-					rc += 1;
-				}
-				fprintf(fp, "DURATION: %d\n", (int) duration);
-				if (_child_reader.timeouted)
-					fprintf(fp, "TIMEOUT: %s\n", ptest_dir);
+	getrusage(RUSAGE_SELF, &ru);
+	stats_print(fp, &runner_stats, &ru);
+
+	if (opts->stats_filename == NULL)
+		return;
+
+	json = fopen(opts->stats_filename, "we");
+	if (json == NULL || stats_write_json(json, &runner_stats, &ru) == -1)
+		fprintf(fp_stderr, "Stats file %s could not be written, %s.\n",
+			opts->stats_filename, strerror(errno));
+	if (json != NULL)
+		fclose(json);
+}
+
+/* Kills what's left in the cgroup of the job and removes it, the
+ * accounting is read into usage unless it's NULL. A group that isn't
+ * empty yet is left behind. */
+static void
+release_cgroup(struct ptest_engine *e, struct ptest_job *job,
+		struct ptest_usage *usage)
+{
+	if (job->cgroup_dfd == -1)
+		return;
+
+	cgroup_kill(job->cgroup_dfd, NULL);
+	if (usage != NULL) {
+		cgroup_stat(job->cgroup_dfd, &usage->cg);
+		usage->cgroup = 1;
+	}
+	cgroup_remove(e->cg, job->cgroup_dfd, job->cgroup_seq);
+	job->cgroup_dfd = -1;
+}
+
+static int
+watch_fd(struct ptest_engine *e, int fd, uint64_t data)
+{
+	struct epoll_event ev;
+
+	ev.events = EPOLLIN;
+	ev.data.u64 = data;
+
+	return epoll_ctl(e->epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/* The ptest gets the grace period to clean up after SIGTERM. */
+static void
+terminate_job(struct ptest_engine *e, struct ptest_job *job)
+{
+	if (e->opts->grace > 0 && kill(-job->pid, SIGTERM) == 0) {
+		kill(-job->pid, SIGCONT);
+		job->terminating = 1;
+		arm_timer(job, (long) e->opts->grace * 1000);
+		trace_instant(JOB_LANE(e, job), "runner", "SIGTERM");
+	} else {
+		kill(-job->pid, SIGKILL);
+		trace_instant(JOB_LANE(e, job), "runner", "SIGKILL");
+	}
+}
+
+/* *
+ * The system state is captured while the timed out ptest is stopped, by
+ * COLLECT_COMMAND run like a ptest in its own session. The event loop
+ * forwards its output to the output of the ptest and the job timer
+ * bounds it to --collect-timeout.
+ * */
+static int
+start_collect(struct ptest_engine *e, int idx)
+{
+	struct ptest_job *job = &e->jobs[idx];
+	struct spawn_args args;
+	int pipefd[2];
+	int pidfd;
+	pid_t child;
+
+	if (pipe2(pipefd, O_CLOEXEC) == -1)
+		return -1;
+
+	memset(&args, 0, sizeof(struct spawn_args));
+	args.path = COLLECT_COMMAND;
+	args.search_path = 1;
+	args.dir = "/";
+	args.fd_stdout = pipefd[1];
+	args.fd_tty = -1;
+	args.jobserver[0] = args.jobserver[1] = -1;
+	args.cgroup_procs = -1;
+	args.sigmask = &e->sigmask;
+
+	kill(-job->pid, SIGSTOP);
+	child = spawn_ptest(&args, &pidfd);
+	close(pipefd[1]);
+	if (pidfd != -1)
+		close(pidfd);
+
+	if (child != -1 && args.err_step != NULL) {
+		waitpid(child, NULL, 0);
+		errno = args.err;
+		child = -1;
+	}
+
+	if (child == -1 || watch_fd(e, pipefd[0], EVENT_DATA(idx, EVENT_COLLECT)) == -1) {
+		if (child != -1) {
+			kill(-child, SIGKILL);
+			waitpid(child, NULL, 0);
+		}
+		close(pipefd[0]);
+		return -1;
+	}
+
+	job->collect_pid = child;
+	job->collect_fd = pipefd[0];
+	clock_gettime(CLOCK_MONOTONIC, &job->collect_started);
+	arm_timer(job, (long) e->opts->collect_timeout * 1000);
+
+	return 0;
+}
+
+/* Taken before SIGSTOP so the wchan and stacks show where it hangs. */
+static void
+take_snapshot(struct ptest_job *job)
+{
+	FILE *fp;
+
+	fp = open_memstream(&job->snapshot, &job->snapshot_size);
+	if (fp == NULL) {
+		snapshot_write(job->pid, &job->started, job->fps[0]);
+		return;
+	}
+	snapshot_write(job->pid, &job->started, fp);
+	fclose(fp);
+
+	fwrite(job->snapshot, job->snapshot_size, 1, job->fps[0]);
+	fflush(job->fps[0]);
+}
+
+/* Whatever the capture started is killed as well. */
+static void
+stop_collect(struct ptest_engine *e, struct ptest_job *job)
+{
+	if (job->collect_pid == 0)
+		return;
+
+	trace_span(JOB_LANE(e, job), "runner", "collect", &job->collect_started);
+	runner_stats.collects++;
+	runner_stats.collect_ns += elapsed_ns(&job->collect_started);
+
+	kill(-job->collect_pid, SIGKILL);
+	waitpid(job->collect_pid, NULL, 0);
+	close(job->collect_fd);
+	job->collect_pid = 0;
+	job->collect_fd = -1;
+}
+
+static void
+handle_collect(struct ptest_engine *e, struct ptest_job *job)
+{
+	char buf[4096];
+	ssize_t n;
+
+	/* Stopped earlier in this batch of events. */
+	if (job->collect_pid == 0)
+		return;
+
+	n = read(job->collect_fd, buf, sizeof(buf));
+	if (n > 0) {
+		fwrite(buf, (size_t) n, 1, job->fps[0]);
+		fflush(job->fps[0]);
+		return;
+	}
+	if (n == -1 && (errno == EAGAIN || errno == EINTR))
+		return;
+
+	stop_collect(e, job);
+	terminate_job(e, job);
+}
+
+/* *
+ * A single timer per job covers the inactivity, duration and budget
+ * timeouts. It isn't moved on every output, when it expires it's armed
+ * again for the nearest timeout left if none expired meanwhile.
+ * */
+static void
+handle_timer(struct ptest_engine *e, struct ptest_job *job)
+{
+	uint64_t expirations;
+	enum ptest_timeout kind;
+	struct timespec now;
+
+	if (read(job->timerfd, &expirations, sizeof(expirations)) == -1)
+		return;
+
+	if (job->terminating) {
+		kill(-job->pid, SIGKILL);
+		trace_instant(JOB_LANE(e, job), "runner", "SIGKILL");
+		return;
+	}
+
+	if (job->collect_pid != 0) {
+		fprintf(job->fps[0], "ERROR: System state capture took longer than %us\n",
+			e->opts->collect_timeout);
+		stop_collect(e, job);
+		terminate_job(e, job);
+		return;
+	}
+
+	if (job_deadline(e, job, &kind) > 0) {
+		arm_deadline(e, job);
+		return;
+	}
+	if (kind == PTEST_TIMEOUT_NONE)
+		return;
+
+	// no output from the test after a timeout; the test is stuck, so collect
+	// as much data from the system as possible and kill the test
+	job->timeouted = kind;
+	trace_instant(JOB_LANE(e, job), "runner", timeout_names[kind]);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	take_snapshot(job);
+	trace_span(JOB_LANE(e, job), "runner", "snapshot", &now);
+	runner_stats.snapshots++;
+	runner_stats.snapshot_ns += elapsed_ns(&now);
+	if (e->opts->collect_timeout > 0) {
+		if (start_collect(e, (int) (job - e->jobs)) == 0)
+			return;
+		fprintf(job->fps[0], "ERROR: Unable to capture the system state, %s\n",
+			strerror(errno));
+	}
+
+	terminate_job(e, job);
+}
+
+/* Forwards whatever the child left in the pipes once it exited. */
+static void
+drain_child(struct ptest_job *job)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		fcntl(job->fds[i], F_SETFL, O_NONBLOCK);
+		while (forward_output(&job->fw[i], job->fds[i], job->fps[i]) > 0);
+	}
+}
+
+/* Returns the pid when the child was reaped, 0 while it is still
+ * running, status receives the exit code. */
+static inline pid_t
+wait_child(pid_t pid, int *status, struct rusage *rusage)
+{
+	pid_t r;
+
+	*status = -1;
+	r = wait4(pid, status, WNOHANG, rusage);
+	if (r > 0 && WIFEXITED(*status))
+		*status = WEXITSTATUS(*status);
+
+	return r;
+}
+
+/* The output goes to DIR/<ptest>.log with -o DIR, or to a memory
+ * stream in parallel runs so the logs of concurrent ptests aren't
+ * interleaved. Neither is flushed on every write. */
+static int
+open_job_log(struct ptest_job *job, const struct ptest_options *opts, int buffered)
+{
+	char *filename;
+
+	if (opts->log_dir) {
+		if (asprintf(&filename, "%s/%s.log", opts->log_dir, job->p->ptest) == -1)
+			return -1;
+
+		job->log = fopen(filename, "we");
+		free(filename);
+		if (job->log == NULL)
+			return -1;
+
+		job->log_buf = malloc(FORWARD_BUF_MAX_SIZE);
+		if (job->log_buf != NULL)
+			setvbuf(job->log, job->log_buf, _IOFBF, FORWARD_BUF_MAX_SIZE);
+
+		job->fps[1] = job->log;
+		job->fw[1].flush = 0;
+	} else if (buffered) {
+		job->log = open_memstream(&job->buf, &job->buf_size);
+		if (job->log == NULL)
+			return -1;
+	} else
+		return 0;
+
+	job->fps[0] = job->log;
+	job->fw[0].flush = 0;
+
+	return 0;
+}
+
+/* With sync the log file is on disk when it returns. */
+static void
+close_job_log(struct ptest_job *job, int sync)
+{
+	if (job->log == NULL)
+		return;
+
+	if (sync) {
+		fflush(job->log);
+		fdatasync(fileno(job->log));
+	}
+
+	fclose(job->log);
+	job->log = NULL;
+
+	free(job->log_buf);
+	job->log_buf = NULL;
+}
+
+static void
+free_job(struct ptest_job *job)
+{
+	int i;
+
+	close_job_log(job, 0);
+	if (job->samples != NULL)
+		fclose(job->samples);
+	for (i = 0; i < 2; i++)
+		if (job->fds[i] != -1)
+			close(job->fds[i]);
+	if (job->pidfd != -1)
+		close(job->pidfd);
+	if (job->timerfd != -1)
+		close(job->timerfd);
+	if (job->queue_fd != -1)
+		close(job->queue_fd);
+	free(job->ptest_dir);
+	free(job->buf);
+	free(job->fw[0].buf);
+	free(job->fw[1].buf);
+	free(job->snapshot);
+	free(job->leftovers.pids);
+
+	memset(job, 0, sizeof(struct ptest_job));
+}
+
+static int
+open_job_samples(struct ptest_engine *e, struct ptest_job *job)
+{
+	char *filename;
+
+	if (asprintf(&filename, "%s/%s.samples", e->opts->samples_dir, job->p->ptest) == -1)
+		return -1;
+
+	job->samples = fopen(filename, "we");
+	free(filename);
+	if (job->samples == NULL)
+		return -1;
+
+	sampler_header(job->samples, job->p->ptest, e->opts->sample_interval);
+
+	return 0;
+}
+
+/* *
+ * Samples every running ptest, the ones in a cgroup from its procs and
+ * the others from a single pass over /proc. The CPU time it takes is
+ * accounted so the overhead is reported at the end of the run.
+ * */
+static void
+handle_sample_timer(struct ptest_engine *e)
+{
+	struct timespec cpu_start, cpu_end, now;
+	struct ptest_job *job;
+	uint64_t expirations;
+	struct sample cur;
+	long long us;
+	int i, n = 0, k;
+
+	if (read(e->sample_timerfd, &expirations, sizeof(expirations)) == -1)
+		return;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+
+	for (i = 0; i < e->jobs_no; i++) {
+		job = &e->jobs[i];
+		if (job->pid != 0 && job->samples != NULL && job->cgroup_dfd == -1)
+			e->sample_sids[n++] = job->pid;
+	}
+	if (n > 0)
+		sampler_scan(e->sample_sids, e->sample_buf, (size_t) n);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (i = 0, k = 0; i < e->jobs_no; i++) {
+		job = &e->jobs[i];
+		if (job->pid == 0 || job->samples == NULL)
+			continue;
+
+		if (job->cgroup_dfd != -1)
+			sampler_read_cgroup(job->cgroup_dfd, &cur);
+		else
+			cur = e->sample_buf[k++];
+
+		us = (now.tv_sec - job->sampled.tv_sec) * 1000000LL +
+			(now.tv_nsec - job->sampled.tv_nsec) / 1000;
+		sampler_write(job->samples, elapsed_ms(&job->started), us,
+			&job->sample, &cur);
+		trace_counter(job->p->ptest, "\"cpu_pct\":%.1f,\"rss_kib\":%lld,\"threads\":%u",
+			sampler_cpu(us, &job->sample, &cur), cur.rss_kib, cur.threads);
+		job->sample = cur;
+		job->sampled = now;
+	}
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+	e->sample_ns += (cpu_end.tv_sec - cpu_start.tv_sec) * 1000000000LL +
+		(cpu_end.tv_nsec - cpu_start.tv_nsec);
+	e->samples++;
+}
+
+/* Starts the ptest in the given job slot, when the output is buffered
+ * (parallel runs) the BEGIN line is printed with the rest of the report
+ * once the ptest ends. */
+static int
+start_job(struct ptest_engine *e, int idx, struct ptest_list *p)
+{
+	struct ptest_job *job = &e->jobs[idx];
+	FILE *fp = e->fp;
+	int pipefd_stdout[2];
+	int pipefd_stderr[2];
+	char stime[GET_STIME_BUF_SIZE];
+	struct spawn_args args;
+	int slave = -1;
+	pid_t child;
+	int i;
+
+	job->fds[0] = job->fds[1] = -1;
+	job->pidfd = job->timerfd = job->queue_fd = job->collect_fd = -1;
+	job->cgroup_dfd = -1;
+
+	job->ptest_dir = strdup(p->run_ptest);
+	if (job->ptest_dir == NULL)
+		return -1;
+	dirname(job->ptest_dir);
+
+	if (pipe2(pipefd_stdout, O_CLOEXEC) == -1) {
+		free_job(job);
+		return -1;
+	}
+
+	if (pipe2(pipefd_stderr, O_CLOEXEC) == -1) {
+		close(pipefd_stdout[0]);
+		close(pipefd_stdout[1]);
+		free_job(job);
+		return -1;
+	}
+
+	/* Less wake ups for the ptests with a lot of output. */
+	fcntl(pipefd_stdout[0], F_SETPIPE_SZ, FORWARD_PIPE_SIZE);
+
+	job->p = p;
+	job->fds[0] = pipefd_stdout[0];
+	job->fds[1] = pipefd_stderr[0];
+	job->fps[0] = fp;
+	job->fps[1] = e->fp_stderr;
+	job->fw[0].splice = 1;
+	job->fw[1].splice = 1;
+	job->fw[0].flush = 1;
+	job->fw[1].flush = 1;
+	job->conf = ptest_conf(p);
+	job->timeout = job->conf->timeout >= 0 ?
+	    (unsigned int) job->conf->timeout : e->opts->timeout;
+	job->max_duration = job->conf->max_duration >= 0 ?
+	    (unsigned int) job->conf->max_duration : e->opts->max_duration;
+	job->timeouted = PTEST_TIMEOUT_NONE;
+	job->terminating = 0;
+
+	if (open_job_log(job, e->opts, e->buffered) == -1) {
+		fprintf(fp, "ERROR: Unable to open the log of %s, %s\n", p->ptest, strerror(errno));
+		close(pipefd_stdout[1]);
+		close(pipefd_stderr[1]);
+		free_job(job);
+		return -1;
+	}
+
+	/* A ptest that can't be sampled still runs. */
+	if (e->opts->samples_dir && open_job_samples(e, job) == -1)
+		fprintf(fp, "WARNING: Unable to open the samples of %s, %s\n",
+			p->ptest, strerror(errno));
+
+	job->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (job->timerfd == -1 ||
+	    watch_fd(e, job->timerfd, EVENT_DATA(idx, EVENT_TIMER)) == -1 ||
+	    watch_fd(e, job->fds[0], EVENT_DATA(idx, EVENT_STDOUT)) == -1 ||
+	    watch_fd(e, job->fds[1], EVENT_DATA(idx, EVENT_STDERR)) == -1) {
+		fprintf(fp, "ERROR: Unable to watch %s, %s\n", p->ptest, strerror(errno));
+		close(pipefd_stdout[1]);
+		close(pipefd_stderr[1]);
+		free_job(job);
+		return -1;
+	}
+
+	args.path = p->run_ptest;
+	args.search_path = 0;
+	args.dir = job->ptest_dir;
+	args.fd_stdout = pipefd_stdout[1];
+	args.jobserver[0] = e->js != NULL ? e->js->fds[0] : -1;
+	args.jobserver[1] = e->js != NULL ? e->js->fds[1] : -1;
+	args.sigmask = &e->sigmask;
+	if ((args.fd_tty = spawn_setup_pty(&slave, fp)) < 0) {
+		fprintf(fp, "ERROR: could not setup pty (%d).", args.fd_tty);
+	}
+
+	args.cgroup_procs = -1;
+	if (e->cg != NULL) {
+		job->cgroup_dfd = cgroup_create(e->cg, &job->cgroup_seq, &args.cgroup_procs);
+		if (job->cgroup_dfd == -1)
+			fprintf(fp, "WARNING: Unable to create the cgroup of %s, %s\n",
+				p->ptest, strerror(errno));
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &job->forked);
+	child = spawn_ptest(&args, &job->pidfd);
+	trace_span(JOB_LANE(e, job), "runner", "spawn", &job->forked);
+	if (child != -1) {
+		/* The child has exec'd or failed when the vfork returns. */
+		long long ns = elapsed_ns(&job->forked);
+
+		runner_stats.spawns++;
+		runner_stats.spawn_ns += ns;
+		if (ns > runner_stats.spawn_max_ns)
+			runner_stats.spawn_max_ns = ns;
+	}
+
+	if (args.cgroup_procs != -1)
+		close(args.cgroup_procs);
+	close(pipefd_stdout[1]);
+	close(pipefd_stderr[1]);
+	if (args.fd_tty != -1) {
+		close(args.fd_tty);
+		close(slave);
+	}
+
+	if (child == -1) {
+		fprintf(fp, "ERROR: Fork %s\n", strerror(errno));
+		release_cgroup(e, job, NULL);
+		free_job(job);
+		return -1;
+	}
+	job->pid = child;
+
+	/* The child isn't reaped yet so its pid can't be reused. */
+	if (e->sigfd == -1) {
+		if (job->pidfd == -1)
+			job->pidfd = (int) syscall(SYS_pidfd_open, child, 0);
+		if (job->pidfd == -1 ||
+		    watch_fd(e, job->pidfd, EVENT_DATA(idx, EVENT_EXIT)) == -1) {
+			fprintf(fp, "ERROR: Unable to watch %s exit, %s\n", p->ptest, strerror(errno));
+			kill(-child, SIGKILL);
+			waitpid(child, NULL, 0);
+			release_cgroup(e, job, NULL);
+			free_job(job);
+			return -1;
+		}
+	}
+
+	job->sttime = time(NULL);
+	clock_gettime(CLOCK_MONOTONIC, &job->started);
+	job->last_output = job->started;
+	job->sampled = job->started;
+	arm_deadline(e, job);
+
+	if (!e->buffered) {
+		fprintf(fp, "%s\n", get_stime(stime, GET_STIME_BUF_SIZE, job->sttime));
+		fprintf(fp, "BEGIN: %s\n", job->ptest_dir);
+	}
+
+	/* The child failed before or at execv() and exits right away. */
+	if (args.err_step != NULL)
+		fprintf(job->fps[0], "ERROR: %s failed, %s\n", args.err_step, strerror(args.err));
+
+	fflush(fp);
+	job->alone = e->running == 0;
+	for (i = 0; i < e->jobs_no; i++)
+		if (e->jobs[i].pid != 0 && &e->jobs[i] != job)
+			e->jobs[i].alone = 0;
+	e->running++;
+
+	return 0;
+}
+
+/* *
+ * With a jobserver the first ptest runs on the slot every make client
+ * has for free and every other one takes a token. When there's none the
+ * jobserver is watched once so the loop tries again when one is back.
+ * Returns -1 without a slot.
+ * */
+static int
+take_slot(struct ptest_engine *e, int *token)
+{
+	struct epoll_event ev;
+
+	*token = 0;
+	if (e->js == NULL)
+		return 0;
+
+	if (!e->js_implicit) {
+		e->js_implicit = 1;
+		return 0;
+	}
+
+	if (jobserver_acquire(e->js)) {
+		*token = 1;
+		return 0;
+	}
+
+	if (!e->js_waiting) {
+		ev.events = EPOLLIN | EPOLLONESHOT;
+		ev.data.u64 = EVENT_DATA(0, EVENT_JOBSERVER);
+		if (epoll_ctl(e->epfd, EPOLL_CTL_MOD, e->js->fd_read, &ev) == 0)
+			e->js_waiting = 1;
+	}
+
+	return -1;
+}
+
+static void
+give_slot(struct ptest_engine *e, int token)
+{
+	if (e->js == NULL)
+		return;
+
+	if (token)
+		jobserver_release(e->js);
+	else
+		e->js_implicit = 0;
+}
+
+static double
+tv_seconds(const struct timeval *tv)
+{
+	return (double) tv->tv_sec + (double) tv->tv_usec / 1e6;
+}
+
+static void
+print_ptest_usage(FILE *fp, const struct ptest_usage *u)
+{
+	const struct rusage *ru = &u->rusage;
+
+	fprintf(fp, "USAGE: wall %lld.%09llds user %.3fs sys %.3fs maxrss %ldKiB"
+		" minflt %ld majflt %ld nvcsw %ld nivcsw %ld inblock %ld oublock %ld\n",
+		u->wall_ns / 1000000000LL, u->wall_ns % 1000000000LL,
+		tv_seconds(&ru->ru_utime), tv_seconds(&ru->ru_stime), ru->ru_maxrss,
+		ru->ru_minflt, ru->ru_majflt, ru->ru_nvcsw, ru->ru_nivcsw,
+		ru->ru_inblock, ru->ru_oublock);
+}
+
+/* The figures of the controllers that aren't enabled are left out. */
+static void
+print_cgroup_usage(FILE *fp, const struct cgroup_stat *st)
+{
+	fprintf(fp, "CGROUP:");
+	if (st->usage_us != -1)
+		fprintf(fp, " cpu %.3fs user %.3fs sys %.3fs", (double) st->usage_us / 1e6,
+			(double) st->user_us / 1e6, (double) st->system_us / 1e6);
+	if (st->memory_peak != -1)
+		fprintf(fp, " memory.peak %lldKiB", st->memory_peak / 1024);
+	if (st->io_rbytes != -1)
+		fprintf(fp, " read %lldKiB written %lldKiB", st->io_rbytes / 1024,
+			st->io_wbytes / 1024);
+	fprintf(fp, "\n");
+}
+
+/* *
+ * The orphans reparented to the runner can't be told apart once they
+ * left the session of their ptest, only the ones of a ptest that ran
+ * alone are surely its own. In its cgroup they're killed with it.
+ * */
+static inline int
+own_orphans(const struct ptest_job *job)
+{
+	return job->alone && job->cgroup_dfd == -1;
+}
+
+/* *
+ * Kills the orphans left by the ptests that didn't run alone once
+ * nothing runs, they're reported outside of any ptest.
+ * */
+static void
+kill_orphans(struct ptest_engine *e)
+{
+	struct spawn_leftovers lo;
+
+	memset(&lo, 0, sizeof(struct spawn_leftovers));
+	if (spawn_kill_leftovers(SPAWN_NO_SESSION, 1, &lo, e->fp) > 0)
+		fflush(e->fp);
+	free(lo.pids);
+}
+
+/* Reports a ptest once its leftovers are gone and frees its job slot. */
+static void
+finish_job(struct ptest_engine *e, struct ptest_job *job)
+{
+	const struct ptest_options *opts = e->opts;
+	FILE *fp = e->fp;
+	char stime[GET_STIME_BUF_SIZE];
+	int status = job->status;
+	int orphans = own_orphans(job);
+	time_t entime;
+	time_t duration;
+
+	if (job->leftovers.pids_no > 0)
+		trace_span(JOB_LANE(e, job), "runner", "leftovers", &job->reaped);
+	release_cgroup(e, job, &job->usage);
+
+	entime = time(NULL);
+	duration = entime - job->sttime;
+
+	/* The log of a failed ptest must be complete before its END line. */
+	close_job_log(job, status != 0 || job->timeouted);
+
+	if (e->buffered) {
+		fprintf(fp, "%s\n", get_stime(stime, GET_STIME_BUF_SIZE, job->sttime));
+		fprintf(fp, "BEGIN: %s\n", job->ptest_dir);
+		if (job->buf != NULL)
+			fwrite(job->buf, job->buf_size, 1, fp);
+	}
+
+	if (status) {
+		fprintf(fp, "\nERROR: Exit status is %d\n", status);
+		if (e->rc != -1)
+			e->rc += 1;
+	}
+	fprintf(fp, "DURATION: %d\n", (int) duration);
+	print_ptest_usage(fp, &job->usage);
+	if (job->usage.cgroup)
+		print_cgroup_usage(fp, &job->usage.cg);
+	if (job->timeouted == PTEST_TIMEOUT_INACTIVITY)
+		fprintf(fp, "TIMEOUT: %s\n", job->ptest_dir);
+	else if (job->timeouted != PTEST_TIMEOUT_NONE)
+		fprintf(fp, "TIMEOUT: %s (%s)\n", job->ptest_dir,
+			timeout_names[job->timeouted]);
+
+	if (opts->xml_filename)
+		xml_add_case(e->xh, status, job->ptest_dir, job->timeouted, (int) duration,
+			&job->usage, job->snapshot);
+
+	if (e->hh != NULL && history_add(e->hh, job->p->ptest,
+	    (unsigned int) (job->usage.wall_ns / 1000000),
+	    status, job->timeouted) == -1)
+		fprintf(fp, "ERROR: Unable to record %s in the history, %s\n",
+			job->p->ptest, strerror(errno));
+
+	if (e->queue != NULL && queue_done(e->queue, job->p->ptest, status,
+	    (int) duration, job->timeouted) == -1)
+		fprintf(fp, "ERROR: Unable to record %s in the queue, %s\n",
+			job->p->ptest, strerror(errno));
+
+	fprintf(fp, "END: %s\n", job->ptest_dir);
+	fprintf(fp, "%s\n", get_stime(stime, GET_STIME_BUF_SIZE, entime));
+	fflush(fp);
+
+	give_slot(e, job->token);
+	admission_end(&e->adm, job->conf);
+	free_job(job);
+	e->running--;
+
+	if (e->running == 0 && !orphans)
+		kill_orphans(e);
+}
+
+/* *
+ * Kills the leftovers of a reaped ptest, the job timer checks again
+ * every SPAWN_LEFTOVER_CHECK_MS until they're gone and its cgroup is
+ * empty or for up to SPAWN_LEFTOVER_WAIT_MS, then it's reported. The
+ * processes of a timed out ptest may still be dying, not reported, the
+ * ones in its cgroup were already by cgroup_kill().
+ * */
+static void
+check_leftovers(struct ptest_engine *e, struct ptest_job *job)
+{
+	int alive;
+
+	alive = spawn_kill_leftovers(job->pid, own_orphans(job), &job->leftovers,
+		job->timeouted || job->cgroup_dfd != -1 ? NULL : job->fps[0]);
+	if (job->cgroup_dfd != -1 && cgroup_populated(job->cgroup_dfd))
+		alive++;
+
+	if (alive > 0 && elapsed_ms(&job->reaped) < SPAWN_LEFTOVER_WAIT_MS) {
+		arm_timer(job, SPAWN_LEFTOVER_CHECK_MS);
+		return;
+	}
+
+	finish_job(e, job);
+}
+
+static void
+handle_cleanup_timer(struct ptest_engine *e, struct ptest_job *job)
+{
+	uint64_t expirations;
+
+	if (read(job->timerfd, &expirations, sizeof(expirations)) == -1)
+		return;
+
+	check_leftovers(e, job);
+}
+
+/* The pid of a job being cleaned up is reaped already, it may be reused
+ * by the child of another job. */
+static void
+reap_job(struct ptest_engine *e, struct ptest_job *job)
+{
+	int status;
+
+	if (job->cleaning || wait_child(job->pid, &status, &job->usage.rusage) <= 0)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &job->reaped);
+	job->usage.wall_ns = elapsed_ns(&job->started);
+	job->status = status;
+	job->cleaning = 1;
+
+	stop_collect(e, job);
+	trace_spanf(JOB_LANE(e, job), "ptest", job->p->ptest, &job->forked,
+		"\"status\":%d,\"timeout\":\"%s\"", status,
+		job->timeouted ? timeout_names[job->timeouted] : "none");
+	drain_child(job);
+	if (job->cgroup_dfd != -1)
+		cgroup_kill(job->cgroup_dfd, job->timeouted ? NULL : job->fps[0]);
+
+	/* A reaped pidfd stays readable. */
+	if (job->pidfd != -1) {
+		close(job->pidfd);
+		job->pidfd = -1;
+	}
+
+	check_leftovers(e, job);
+}
+
+/* Only clears the timer, the main loop checks again if a ptest can start. */
+static void
+handle_admission_timer(struct ptest_engine *e)
+{
+	uint64_t expirations;
+
+	if (read(e->adm_timerfd, &expirations, sizeof(expirations)) == -1)
+		return;
+}
+
+static void
+handle_event(struct ptest_engine *e, uint64_t data)
+{
+	struct ptest_job *job = &e->jobs[EVENT_JOB(data)];
+	struct signalfd_siginfo si;
+	int i;
+
+	/* A token is back, the main loop takes it. */
+	if (EVENT_TYPE(data) == EVENT_JOBSERVER) {
+		e->js_waiting = 0;
+		return;
+	}
+
+	if (EVENT_TYPE(data) == EVENT_ADMISSION) {
+		handle_admission_timer(e);
+		return;
+	}
+
+	if (EVENT_TYPE(data) == EVENT_SAMPLE) {
+		handle_sample_timer(e);
+		return;
+	}
+
+	if (EVENT_TYPE(data) == EVENT_SIGCHLD) {
+		if (read(e->sigfd, &si, sizeof(si)) == -1)
+			return;
+		/* Signals are coalesced, check every running ptest. */
+		for (i = 0; i < e->jobs_no; i++)
+			if (e->jobs[i].pid != 0)
+				reap_job(e, &e->jobs[i]);
+		return;
+	}
+
+	/* Events of a ptest already reported in this batch. */
+	if (job->pid == 0)
+		return;
+
+	switch (EVENT_TYPE(data)) {
+		case EVENT_STDOUT:
+		case EVENT_STDERR:
+			handle_output(e, job, EVENT_TYPE(data));
+		break;
+		case EVENT_TIMER:
+			if (job->cleaning)
+				handle_cleanup_timer(e, job);
+			else
+				handle_timer(e, job);
+		break;
+		case EVENT_COLLECT:
+			handle_collect(e, job);
+		break;
+		case EVENT_EXIT:
+			reap_job(e, job);
+		break;
+	}
+}
+
+static int
+engine_init(struct ptest_engine *e, const struct ptest_options *opts,
+		FILE *fp, FILE *fp_stderr)
+{
+	sigset_t sigchld;
+	int pidfd;
+
+	memset(e, 0, sizeof(struct ptest_engine));
+	e->sigfd = -1;
+	e->adm_timerfd = -1;
+	e->sample_timerfd = -1;
+	e->opts = opts;
+	e->fp = fp;
+	e->fp_stderr = fp_stderr;
+	e->jobs_no = opts->jobs > 1 ? opts->jobs : 1;
+	e->buffered = e->jobs_no > 1;
+	clock_gettime(CLOCK_MONOTONIC, &e->started);
+
+	e->jobs = calloc((size_t) e->jobs_no, sizeof(struct ptest_job));
+	CHECK_ALLOCATION(e->jobs, (size_t) e->jobs_no * sizeof(struct ptest_job), 0);
+	if (e->jobs == NULL)
+		return -1;
+
+	e->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (e->epfd == -1) {
+		free(e->jobs);
+		return -1;
+	}
+
+	/* Daemons that leave the session of a ptest are reparented to the
+	 * runner instead of init so they can be found and killed. */
+	if (prctl(PR_GET_CHILD_SUBREAPER, &e->subreaper) == -1)
+		e->subreaper = 0;
+	prctl(PR_SET_CHILD_SUBREAPER, 1);
+
+	/* Without the timer starting is only checked again when a ptest ends. */
+	admission_init(&e->adm, opts->max_pressure, opts->min_available, e->jobs_no);
+	e->adm_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (e->adm_timerfd != -1 &&
+	    watch_fd(e, e->adm_timerfd, EVENT_DATA(0, EVENT_ADMISSION)) == -1) {
+		close(e->adm_timerfd);
+		e->adm_timerfd = -1;
+	}
+
+	/* Admission scans the sessions as well for the memory they use. */
+	e->sample_sids = calloc((size_t) e->jobs_no, sizeof(pid_t));
+	CHECK_ALLOCATION(e->sample_sids, (size_t) e->jobs_no * sizeof(pid_t), 1);
+	e->sample_buf = calloc((size_t) e->jobs_no, sizeof(struct sample));
+	CHECK_ALLOCATION(e->sample_buf, (size_t) e->jobs_no * sizeof(struct sample), 1);
+
+	/* The samples are taken from the loop, no thread or process. */
+	if (opts->samples_dir) {
+		struct itimerspec its;
+
+		its.it_value.tv_sec = opts->sample_interval / 1000;
+		its.it_value.tv_nsec = (long) (opts->sample_interval % 1000) * 1000000;
+		its.it_interval = its.it_value;
+		e->sample_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+		if (e->sample_timerfd != -1 &&
+		    (watch_fd(e, e->sample_timerfd, EVENT_DATA(0, EVENT_SAMPLE)) == -1 ||
+		     timerfd_settime(e->sample_timerfd, 0, &its, NULL) == -1)) {
+			close(e->sample_timerfd);
+			e->sample_timerfd = -1;
+		}
+	}
+
+	/* SIGCHLD is blocked so the signalfd fallback never misses one. */
+	sigemptyset(&sigchld);
+	sigaddset(&sigchld, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &sigchld, &e->sigmask);
+
+	pidfd = (int) syscall(SYS_pidfd_open, getpid(), 0);
+	if (pidfd != -1) {
+		close(pidfd);
+		return 0;
+	}
+
+	e->sigfd = signalfd(-1, &sigchld, SFD_CLOEXEC);
+	if (e->sigfd == -1 || watch_fd(e, e->sigfd, EVENT_DATA(0, EVENT_SIGCHLD)) == -1) {
+		if (e->sigfd != -1)
+			close(e->sigfd);
+		if (e->adm_timerfd != -1)
+			close(e->adm_timerfd);
+		if (e->sample_timerfd != -1)
+			close(e->sample_timerfd);
+		free(e->sample_sids);
+		free(e->sample_buf);
+		admission_free(&e->adm);
+		prctl(PR_SET_CHILD_SUBREAPER, e->subreaper);
+		sigprocmask(SIG_SETMASK, &e->sigmask, NULL);
+		close(e->epfd);
+		free(e->jobs);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+engine_free(struct ptest_engine *e)
+{
+	prctl(PR_SET_CHILD_SUBREAPER, e->subreaper);
+	sigprocmask(SIG_SETMASK, &e->sigmask, NULL);
+	if (e->sigfd != -1)
+		close(e->sigfd);
+	if (e->adm_timerfd != -1)
+		close(e->adm_timerfd);
+	if (e->sample_timerfd != -1)
+		close(e->sample_timerfd);
+	free(e->sample_sids);
+	free(e->sample_buf);
+	close(e->epfd);
+	free(e->jobs);
+	jobserver_close(e->js);
+	e->js = NULL;
+	cgroup_close(e->cg);
+	e->cg = NULL;
+	admission_free(&e->adm);
+}
+
+static int
+pending_left(struct ptest_engine *e)
+{
+	return e->pending_first < e->pending_no ||
+	    (e->busy_no > 0 && !e->rescanned);
+}
+
+static void
+take_pending(struct ptest_engine *e, int k)
+{
+	e->pending[k] = NULL;
+	while (e->pending_first < e->pending_no &&
+	    e->pending[e->pending_first] == NULL)
+		e->pending_first++;
+}
+
+/* Returns the number of ptests that won't be started. */
+static int
+drop_pending(struct ptest_engine *e)
+{
+	int k, n = e->rescanned ? 0 : e->busy_no;
+
+	for (k = e->pending_first; k < e->pending_no; k++)
+		if (e->pending[k] != NULL)
+			n++;
+	e->pending_first = e->pending_no;
+	e->busy_no = 0;
+
+	return n;
+}
+
+static void
+hold(struct ptest_engine *e, enum admission_reason r)
+{
+	struct itimerspec its;
+
+	admission_hold(&e->adm, r);
+
+	/* Pressure and memory change without a ptest ending. */
+	if (e->adm_timerfd != -1) {
+		memset(&its, 0, sizeof(its));
+		its.it_value.tv_nsec = ADMISSION_INTERVAL_MS * 1000000L;
+		timerfd_settime(e->adm_timerfd, 0, &its, NULL);
+	}
+}
+
+/* *
+ * KiB of their declared memory the running ptests already use, from the
+ * memory.current of their cgroup or else the RSS of their session, with
+ * one pass over /proc for all of them.
+ * */
+static long
+memory_used(struct ptest_engine *e)
+{
+	struct ptest_job *job;
+	long long current;
+	long used = 0;
+	int i, n = 0, k = 0;
+
+	if (e->opts->min_available == 0)
+		return 0;
+
+	for (i = 0; i < e->jobs_no; i++) {
+		job = &e->jobs[i];
+		if (job->pid != 0 && job->conf->memory > 0 &&
+		    (job->cgroup_dfd == -1 || !(e->cg->controllers & CGROUP_MEMORY)))
+			e->sample_sids[n++] = job->pid;
+	}
+	if (n > 0)
+		sampler_scan(e->sample_sids, e->sample_buf, (size_t) n);
+
+	for (i = 0; i < e->jobs_no; i++) {
+		job = &e->jobs[i];
+		if (job->pid == 0 || job->conf->memory == 0)
+			continue;
+
+		if (job->cgroup_dfd != -1 && (e->cg->controllers & CGROUP_MEMORY))
+			current = cgroup_memory_current(job->cgroup_dfd) / 1024;
+		else
+			current = e->sample_buf[k++].rss_kib;
+
+		if (current > 0)
+			used += current < job->conf->memory ? (long) current : job->conf->memory;
+	}
+
+	return used;
+}
+
+/* *
+ * Returns the first pending ptest that can start next to the running
+ * ones, so one waiting for a lock or for CPUs doesn't hold back the
+ * ones after it. Pressure, a running exclusive ptest or one waiting at
+ * the head of the pending ones hold them all, or the ptests started
+ * whenever a slot frees could keep it waiting until the end of the run.
+ * With a queue the ptest is claimed there as well, the claims taken by
+ * other runners are tried once more at the end to take over the ones
+ * of runners that died.
+ * */
+static struct ptest_list *
+pick_next(struct ptest_engine *e, int *queue_fd)
+{
+	enum admission_reason held = ADMISSION_OK, r;
+	struct ptest_list *p;
+	int k;
 
-				if (opts.xml_filename)
-					xml_add_case(xh, status, ptest_dir, _child_reader.timeouted, (int) duration);
+	*queue_fd = -1;
+	if (e->running > 0)
+		admission_sample(&e->adm, memory_used(e));
+
+	for (;;) {
+		for (k = e->pending_first; k < e->pending_no; k++) {
+			p = e->pending[k];
+			if (p == NULL)
+				continue;
+
+			if (e->running > 0) {
+				r = admission_check(&e->adm, ptest_conf(p));
+				if (r != ADMISSION_OK) {
+					if (held == ADMISSION_OK)
+						held = r;
+					if (admission_global(&e->adm, r) ||
+					    (r == ADMISSION_EXCLUSIVE && k == e->pending_first))
+						break;
+					continue;
+				}
+			}
 
-				fprintf(fp, "END: %s\n", ptest_dir);
-				fprintf(fp, "%s\n", get_stime(stime, GET_STIME_BUF_SIZE, entime));
+			take_pending(e, k);
+			if (e->queue == NULL)
+				return p;
+
+			*queue_fd = queue_claim(e->queue, p->ptest);
+			if (*queue_fd != -1)
+				return p;
+
+			if (errno == EBUSY)
+				e->busy[e->busy_no++] = p;
+			else if (errno == EALREADY)
+				e->done[e->done_no++] = p;
+			else {
+				fprintf(e->fp_stderr, "Unable to claim %s in the queue, %s.\n",
+					p->ptest, strerror(errno));
+				e->rc = -1;
+				return NULL;
 			}
-			free(ptest_dir);
+		}
+
+		if (e->pending_first < e->pending_no || e->busy_no == 0 || e->rescanned)
+			break;
+
+		/* Every array holds all the ptests, busy becomes pending. */
+		memcpy(e->pending, e->busy, sizeof(struct ptest_list *) * (size_t) e->busy_no);
+		e->pending_first = 0;
+		e->pending_no = e->busy_no;
+		e->busy_no = 0;
+		e->rescanned = 1;
+	}
+
+	if (held != ADMISSION_OK)
+		hold(e, held);
+
+	return NULL;
+}
+
+/* *
+ * The results in done/ persist, a queue directory used before skips
+ * every ptest it has one for. The skipped ptests are listed and a run
+ * that had nothing left at all is flagged.
+ * */
+static void
+report_done(struct ptest_engine *e)
+{
+	int i;
+
+	if (e->done_no == 0)
+		return;
+
+	fprintf(e->fp, "QUEUE: %d already done, skipped", e->done_no);
+	for (i = 0; i < e->done_no; i++)
+		fprintf(e->fp, "%s %s", i == 0 ? ":" : ",", e->done[i]->ptest);
+	fprintf(e->fp, "\n");
+
+	if (e->ran == 0)
+		fprintf(e->fp_stderr, "WARNING: Every ptest is already done in the"
+			" queue %s, remove it to run them again.\n", e->opts->queue_dir);
+}
+
+int
+run_ptests(struct ptest_list *head, const struct ptest_options opts,
+		const char *progname, FILE *fp, FILE *fp_stderr)
+{
+	int rc = 0;
+	FILE *xh = NULL;
+	struct ptest_history *hh = NULL;
+	struct ptest_queue *queue = NULL;
+
+	struct ptest_engine e;
+	struct epoll_event events[ENGINE_MAX_EVENTS];
+	struct ptest_list *p;
+	int i, n;
+
+	/* Before the XML file, nothing is left behind when it fails. */
+	if (opts.queue_dir) {
+		queue = queue_open(opts.queue_dir);
+		if (queue == NULL) {
+			fprintf(fp_stderr, "Queue %s could not be opened, %s.\n",
+				opts.queue_dir, strerror(errno));
+			return -1;
+		}
+	}
+
+	if (opts.xml_filename) {
+		xh = xml_create(ptest_list_length(head), opts.xml_filename);
+		if (!xh)
+			exit(EXIT_FAILURE);
+	}
+
+	/* A broken history file must not stop the ptests from running. */
+	if (opts.history_filename) {
+		hh = history_open(opts.history_filename);
+		if (hh == NULL)
+			fprintf(fp_stderr, "History file %s could not be opened, %s.\n",
+				opts.history_filename, strerror(errno));
+	}
+
+	do
+	{
+		if (opts.log_dir && mkdir(opts.log_dir, 0755) == -1 && errno != EEXIST) {
+			fprintf(fp_stderr, "Log directory %s could not be created, %s.\n",
+				opts.log_dir, strerror(errno));
+			rc = -1;
+			break;
+		}
+
+		if (opts.samples_dir && mkdir(opts.samples_dir, 0755) == -1 && errno != EEXIST) {
+			fprintf(fp_stderr, "Samples directory %s could not be created, %s.\n",
+				opts.samples_dir, strerror(errno));
+			rc = -1;
+			break;
+		}
+
+		if (engine_init(&e, &opts, fp, fp_stderr) == -1) {
+			rc = -1;
+			break;
+		}
+		e.xh = xh;
+		e.hh = hh;
+		e.queue = queue;
+
+		/* Without cgroups the ptests run as they always did. */
+		if (opts.cgroup) {
+			e.cg = cgroup_open(opts.cgroup_memory_max, opts.cgroup_cpu_max,
+				opts.cgroup_pids_max, fp_stderr);
+			if (e.cg == NULL)
+				fprintf(fp_stderr, "WARNING: cgroups are unavailable, %s,"
+					" the ptests run without them.\n", strerror(errno));
+		}
+
+		n = ptest_list_length(head);
+		e.pending = malloc(sizeof(struct ptest_list *) * (size_t) (n + 1));
+		CHECK_ALLOCATION(e.pending, sizeof(struct ptest_list *) * (size_t) (n + 1), 1);
+		e.busy = malloc(sizeof(struct ptest_list *) * (size_t) (n + 1));
+		CHECK_ALLOCATION(e.busy, sizeof(struct ptest_list *) * (size_t) (n + 1), 1);
+		e.done = malloc(sizeof(struct ptest_list *) * (size_t) (n + 1));
+		CHECK_ALLOCATION(e.done, sizeof(struct ptest_list *) * (size_t) (n + 1), 1);
+		PTEST_LIST_ITERATE_START(head, p)
+			e.pending[e.pending_no++] = p;
 		PTEST_LIST_ITERATE_END
-		fprintf(fp, "STOP: %s\n", progname);
 
-		pthread_cancel(tid);
-		pthread_join(tid, NULL);
+		if (opts.jobserver) {
+			struct epoll_event ev;
+
+			e.js = jobserver_open(e.jobs_no);
+			ev.events = 0;
+			ev.data.u64 = EVENT_DATA(0, EVENT_JOBSERVER);
+			if (e.js == NULL ||
+			    epoll_ctl(e.epfd, EPOLL_CTL_ADD, e.js->fd_read, &ev) == -1) {
+				fprintf(fp_stderr, "Unable to set up the jobserver, %s.\n",
+					strerror(errno));
+				engine_free(&e);
+				rc = -1;
+				break;
+			}
+		}
+
+		if (isatty(0) && ioctl(0, TIOCNOTTY) == -1) {
+			fprintf(fp, "ERROR: Unable to detach from controlling tty, %s\n", strerror(errno));
+		}
+
+		fprintf(fp, "START: %s\n", progname);
+		fflush(fp);
+
+		/* Every job slot is a lane of the trace. */
+		for (i = 0; i < e.jobs_no && trace_enabled(); i++) {
+			char lane[32];
+
+			snprintf(lane, sizeof(lane), "job %d", i + 1);
+			trace_lane(TRACE_LANE_JOB(i), lane);
+		}
+
+		while (pending_left(&e) || e.running > 0) {
+			/* Out of budget the ptests left aren't started. */
+			if (opts.budget > 0 && pending_left(&e) &&
+			    elapsed_ms(&e.started) >= (long) opts.budget * 1000) {
+				fprintf(fp, "BUDGET: %d ptests not run\n", drop_pending(&e));
+				fflush(fp);
+			}
+
+			for (i = 0; i < e.jobs_no && pending_left(&e); i++) {
+				int queue_fd;
+				int token;
+
+				if (e.jobs[i].pid != 0)
+					continue;
+
+				if (take_slot(&e, &token) == -1)
+					break;
+
+				p = pick_next(&e, &queue_fd);
+				if (p == NULL) {
+					give_slot(&e, token);
+					break;
+				}
+
+				if (start_job(&e, i, p) == -1) {
+					if (queue_fd != -1)
+						close(queue_fd);
+					give_slot(&e, token);
+					e.rc = -1;
+					break;
+				}
+				e.jobs[i].queue_fd = queue_fd;
+				e.jobs[i].token = token;
+				admission_start(&e.adm, e.jobs[i].conf);
+				e.ran++;
+			}
+
+			/* Stop scheduling after an error but let the running ptests end. */
+			if (e.rc == -1)
+				drop_pending(&e);
 
-		close(pipefd_stdout[0]); close(pipefd_stdout[1]);
-		close(pipefd_stderr[0]); close(pipefd_stderr[1]);
+			if (e.running == 0)
+				continue;
+
+			n = epoll_wait(e.epfd, events, ENGINE_MAX_EVENTS, -1);
+			runner_stats.iterations++;
+			if (n > 0)
+				runner_stats.events += (unsigned long) n;
+			for (i = 0; i < n; i++)
+				handle_event(&e, events[i].data.u64);
+		}
+		trace_spanf(trace_tid(), "runner", "run", &e.started, "\"ptests\":%d",
+			e.pending_no);
+		admission_report(&e.adm, fp);
+		report_done(&e);
+		if (opts.samples_dir) {
+			long long wall_ns = elapsed_ns(&e.started);
+
+			fprintf(fp, "SAMPLES: %lu taken in %.3fs of CPU, %.3f%% of the run\n",
+				e.samples, (double) e.sample_ns / 1e9,
+				wall_ns > 0 ? (double) e.sample_ns * 100 / (double) wall_ns : 0.0);
+		}
+		runner_stats.run_ns += elapsed_ns(&e.started);
+		runner_stats.samples += e.samples;
+		runner_stats.sample_ns += e.sample_ns;
+		if (opts.stats)
+			report_stats(&opts, fp, fp_stderr);
+		fprintf(fp, "STOP: %s\n", progname);
+
+		rc = e.rc;
+		free(e.pending);
+		free(e.busy);
+		free(e.done);
+		engine_free(&e);
 	} while (0);
 
 	if (rc == -1) 
@@ -566,6 +2487,9 @@ run_ptests(struct ptest_list *head, const struct ptest_options opts,
 	if (opts.xml_filename)
 		xml_finish(xh);
 
+	history_close(hh);
+	queue_close(queue);
+
 	return rc;
 }
 
@@ -586,19 +2510,85 @@ xml_create(int test_count, char *xml_filename)
 	return xh;
 }
 
+/* "]]>" can't be in a CDATA section, it's split in two. */
+static void
+xml_write_cdata(FILE *xh, const char *text)
+{
+	const char *end;
+
+	fprintf(xh, "<![CDATA[");
+	while ((end = strstr(text, "]]>")) != NULL) {
+		fwrite(text, (size_t) (end - text) + 2, 1, xh);
+		fprintf(xh, "]]><![CDATA[");
+		text = end + 2;
+	}
+	fprintf(xh, "%s]]>", text);
+}
+
+static void
+xml_add_property(FILE *xh, const char *name, long long value)
+{
+	fprintf(xh, "\t\t\t<property name='%s' value='%lld'/>\n", name, value);
+}
+
+static long long
+tv_us(const struct timeval *tv)
+{
+	return (long long) tv->tv_sec * 1000000LL + tv->tv_usec;
+}
+
 void
-xml_add_case(FILE *xh, int status, const char *ptest_dir, int timeouted, int duration)
+xml_add_case(FILE *xh, int status, const char *ptest_dir, int timeouted, int duration,
+		const struct ptest_usage *usage, const char *system_out)
 {
 	fprintf(xh, "\t<testcase classname='%s' name='run-ptest'>\n", ptest_dir);
 	fprintf(xh, "\t\t<duration>%d</duration>\n", duration);
 
+	if (usage != NULL) {
+		const struct rusage *ru = &usage->rusage;
+
+		fprintf(xh, "\t\t<properties>\n");
+		xml_add_property(xh, "wall_ns", usage->wall_ns);
+		xml_add_property(xh, "user_us", tv_us(&ru->ru_utime));
+		xml_add_property(xh, "sys_us", tv_us(&ru->ru_stime));
+		xml_add_property(xh, "maxrss_kib", ru->ru_maxrss);
+		xml_add_property(xh, "minflt", ru->ru_minflt);
+		xml_add_property(xh, "majflt", ru->ru_majflt);
+		xml_add_property(xh, "nvcsw", ru->ru_nvcsw);
+		xml_add_property(xh, "nivcsw", ru->ru_nivcsw);
+		xml_add_property(xh, "inblock", ru->ru_inblock);
+		xml_add_property(xh, "oublock", ru->ru_oublock);
+		if (usage->cgroup) {
+			const struct cgroup_stat *st = &usage->cg;
+
+			if (st->usage_us != -1) {
+				xml_add_property(xh, "cgroup_usage_us", st->usage_us);
+				xml_add_property(xh, "cgroup_user_us", st->user_us);
+				xml_add_property(xh, "cgroup_system_us", st->system_us);
+			}
+			if (st->memory_peak != -1)
+				xml_add_property(xh, "cgroup_memory_peak", st->memory_peak);
+			if (st->io_rbytes != -1) {
+				xml_add_property(xh, "cgroup_io_rbytes", st->io_rbytes);
+				xml_add_property(xh, "cgroup_io_wbytes", st->io_wbytes);
+			}
+		}
+		fprintf(xh, "\t\t</properties>\n");
+	}
+
 	if (status != 0) {
 		fprintf(xh, "\t\t<failure type='exit_code'");
 		fprintf(xh, " message='run-ptest exited with code: %d'>", status);
 		fprintf(xh, "</failure>\n");
 	}
-	if (timeouted)
-		fprintf(xh, "\t\t<failure type='timeout'/>\n");
+	if (timeouted > PTEST_TIMEOUT_NONE && timeouted <= PTEST_TIMEOUT_BUDGET)
+		fprintf(xh, "\t\t<failure type='%s'/>\n", timeout_names[timeouted]);
+
+	if (system_out != NULL) {
+		fprintf(xh, "\t\t<system-out>");
+		xml_write_cdata(xh, system_out);
+		fprintf(xh, "</system-out>\n");
+	}
 
 	fprintf(xh, "\t</testcase>\n");
 }
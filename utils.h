@@ -24,8 +24,13 @@
 #ifndef PTEST_RUNNER_UTILS_H
 #define PTEST_RUNNER_UTILS_H
 
+#include <sys/resource.h>
+
+#include "cgroup.h"
 #include "ptest_list.h"
 
+struct ptest_cache;
+
 #define PRINT_PTESTS_NOT_FOUND "No ptests found.\n"
 #define PRINT_PTESTS_NOT_FOUND_DIR "Warning: ptests not found in, %s.\n"
 #define PRINT_PTESTS_AVAILABLE "Available ptests:\n"
@@ -33,6 +38,29 @@
 #define CHECK_ALLOCATION(p, size, exit_on_null) \
 	check_allocation1(p, size, __FILE__, __LINE__, exit_on_null)
 
+enum ptest_order {
+	PTEST_ORDER_DEFAULT = 0,
+	PTEST_ORDER_LONGEST_FIRST,
+	PTEST_ORDER_SHORTEST_FIRST,
+};
+
+/* Why a ptest was killed, the order is the one of the history file. */
+enum ptest_timeout {
+	PTEST_TIMEOUT_NONE = 0,
+	PTEST_TIMEOUT_INACTIVITY, /* no output for -t seconds */
+	PTEST_TIMEOUT_DURATION, /* ran for longer than --max-duration */
+	PTEST_TIMEOUT_BUDGET, /* the run took longer than --budget */
+};
+
+/* Resources used by a ptest and the processes it waited for. */
+struct ptest_usage {
+	long long wall_ns; /* CLOCK_MONOTONIC */
+	struct rusage rusage;
+	int cgroup; /* ran in its own cgroup, cg is set */
+	int padding1;
+	struct cgroup_stat cg;
+};
+
 struct ptest_options {
 	char **dirs;
 	int dirs_no;
@@ -42,18 +70,54 @@ struct ptest_options {
 	unsigned int timeout;
 	char **ptests;
 	char *xml_filename;
+	int jobs;
+	int padding2;
+	char *history_filename;
+	enum ptest_order order;
+	int padding3;
+	char *log_dir;
+	char *cache_filename;
+	int shard_index; /* from 0 */
+	int shard_count; /* 0 when not sharding */
+	char *queue_dir;
+	int jobserver;
+	int padding4;
+	unsigned int max_pressure[3]; /* cpu, memory, io in percent, 0 no limit */
+	int padding5;
+	long min_available; /* KiB */
+	unsigned int max_duration; /* seconds per ptest, 0 no limit */
+	unsigned int budget; /* seconds for the whole run, 0 no limit */
+	unsigned int grace; /* seconds from SIGTERM to SIGKILL */
+	unsigned int collect_timeout; /* seconds, 0 doesn't capture the system state */
+	int cgroup; /* every ptest in its own cgroup */
+	unsigned int cgroup_cpu_max; /* percent of a CPU, 0 no limit */
+	long cgroup_memory_max; /* KiB, 0 no limit */
+	unsigned int cgroup_pids_max; /* 0 no limit */
+	int padding6;
+	char *samples_dir; /* time series of every ptest, NULL for none */
+	unsigned int sample_interval; /* milliseconds */
+	int padding7;
+	char *trace_filename;
+	int stats; /* STATS lines about the runner itself */
+	int padding8;
+	char *stats_filename; /* the stats as JSON, NULL for none */
 };
 
 
 extern void check_allocation1(void *, size_t, char *, int, int);
 extern struct ptest_list *get_available_ptests(const char *);
+extern void get_available_ptests_dirs(char **, int, struct ptest_list **,
+		struct ptest_cache *);
 extern int print_ptests(struct ptest_list *, FILE *);
 extern struct ptest_list *filter_ptests(struct ptest_list *, char **, int);
+extern int sort_ptests(struct ptest_list *, const struct ptest_options);
+extern int shard_ptests(struct ptest_list *, const struct ptest_options);
 extern int run_ptests(struct ptest_list *, const struct ptest_options,
 		const char *, FILE *, FILE *);
 
 extern FILE *xml_create(int, char *);
-extern void xml_add_case(FILE *, int, const char *, int, int);
+extern void xml_add_case(FILE *, int, const char *, int, int,
+		const struct ptest_usage *, const char *);
 extern void xml_finish(FILE *);
 
 void set_opts_dir(char * od);